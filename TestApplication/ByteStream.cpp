@@ -136,6 +136,110 @@ size_t ByteStream::Write8(uint64_t Value)
 	return Advance(sizeof(Value));
 }
 
+size_t ByteStream::ReadVarint(uint64_t * Value)
+{
+	const uint8_t *p = Pointer();
+	size_t Available = Remaining();
+
+	// Values below 0x4000 (1 or 2 bytes) are the common case.
+	if (Available >= 2)
+	{
+		uint64_t Low = p[0];
+		uint64_t High = p[1];
+
+		if (!(Low & 0x80))
+		{
+			if (Value)
+				*Value = Low;
+			return Advance(1);
+		}
+
+		if (!(High & 0x80))
+		{
+			if (Value)
+				*Value = (Low & 0x7f) | (High << 7);
+			return Advance(2);
+		}
+	}
+
+	uint64_t Result = 0;
+	size_t Size = std::min<size_t>(Available, MaxVarintSize);
+
+	for (size_t i = 0; i < Size; i++)
+	{
+		uint64_t Byte = p[i];
+		Result |= (Byte & 0x7f) << (7 * i);
+
+		if (!(Byte & 0x80))
+		{
+			// 10th byte carries only bit 63.
+			if (i == MaxVarintSize - 1 && Byte > 1)
+				return 0;
+
+			if (Value)
+				*Value = Result;
+			return Advance(i + 1);
+		}
+	}
+
+	return 0;
+}
+
+size_t ByteStream::ReadVarint(int64_t * Value)
+{
+	uint64_t Encoded;
+	size_t Size = ReadVarint(&Encoded);
+
+	if (Size && Value)
+		*Value = ZigZagDecode(Encoded);
+
+	return Size;
+}
+
+size_t ByteStream::WriteVarint(uint64_t Value)
+{
+	size_t Size = VarintSize(Value);
+	if (Remaining() < Size)
+		return 0;
+
+	uint8_t *p = Pointer();
+
+	for (size_t i = 0; i < Size - 1; i++, Value >>= 7)
+		p[i] = static_cast<uint8_t>(Value | 0x80);
+
+	p[Size - 1] = static_cast<uint8_t>(Value);
+
+	return Advance(Size);
+}
+
+size_t ByteStream::WriteVarint(int64_t Value)
+{
+	return WriteVarint(ZigZagEncode(Value));
+}
+
+size_t ByteStream::VarintSize(uint64_t Value)
+{
+	size_t Size = 1;
+
+	while (Value >= 0x80)
+	{
+		Value >>= 7;
+		Size++;
+	}
+
+	return Size;
+}
+
+uint64_t ByteStream::ZigZagEncode(int64_t Value)
+{
+	return (static_cast<uint64_t>(Value) << 1) ^ static_cast<uint64_t>(Value >> 63);
+}
+
+int64_t ByteStream::ZigZagDecode(uint64_t Value)
+{
+	return static_cast<int64_t>(Value >> 1) ^ -static_cast<int64_t>(Value & 1);
+}
+
 size_t ByteStream::Write(uint8_t * Buffer, size_t Size)
 {
 	size_t Count = std::min<size_t>(Size, Remaining());
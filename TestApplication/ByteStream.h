@@ -21,6 +21,23 @@ public:
 	size_t Write4(uint32_t Value);
 	size_t Write8(uint64_t Value);
 
+	// 
+	// LEB128 varint, 7 bits per byte from the least significant, high bit set if more follow.
+	// Signed values are zigzag mapped first (0, -1, 1, -2 ... => 0, 1, 2, 3 ...).
+	// Read fails on truncated or over-long (more than 64 bits) input.
+	// 
+
+	size_t ReadVarint(uint64_t *Value);
+	size_t ReadVarint(int64_t *Value);
+	size_t WriteVarint(uint64_t Value);
+	size_t WriteVarint(int64_t Value);
+
+	static size_t VarintSize(uint64_t Value);
+	static uint64_t ZigZagEncode(int64_t Value);
+	static int64_t ZigZagDecode(uint64_t Value);
+
+	constexpr static const size_t MaxVarintSize = 10;
+
 	size_t Write(uint8_t *Buffer, size_t Size);
 	size_t Advance(size_t Size);
 
@@ -8,6 +8,7 @@
 #include <thread>
 #include <mutex>
 #include <atomic>
+#include <deque>
 //nclude <shared_mutex>
 
 #ifndef WIN32_LEAN_AND_MEAN
@@ -17,8 +18,10 @@
 
 #include <winsock2.h>
 #include <WS2tcpip.h>
+#include <mswsock.h>
 
 #pragma comment(lib, "ws2_32.lib")
+#pragma comment(lib, "mswsock.lib")
 
 
 namespace IOCP
@@ -29,6 +32,13 @@ namespace IOCP
 		Recv,
 	};
 
+	enum IOCPBufferFlags : uint32_t
+	{
+		BufferFlagNone = 0x00,
+		BufferFlagTransmitFile = 0x01,	// Buffer describes a file region sent by TransmitFile()
+		BufferFlagPriority = 0x02,		// Buffer points into the priority send ring buffer
+	};
+
 	struct IOCP_OVERLAPPED_EXTENSION // Must compatible with OVERLAPPED structure
 	{
 		OVERLAPPED Overlapped; // WSASend/WSARecv references it
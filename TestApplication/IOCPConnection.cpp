@@ -11,10 +11,21 @@ IOCPConnection::IOCPConnection(SOCKET Socket, const IODispatchHandler *Dispatch,
 	SendBufferList_(OperationType::Send),
 	RecvBufferList_(OperationType::Recv),
 	SendBuffer_(SendBufferCapacity),
+	SendPriorityBuffer_(SendBufferCapacity / 4),
+	SendBulkInFlight_(0),
 	RecvBuffer_(RecvBufferCapacity),
 	SendSequenceNumber_(0),
+	SendBytesQueued_(0),
+	SendBytesIssued_(0),
 	RecvSequenceNumber_(0),
-	RecvBufferLengthPerRecvCall_(RecvBufferLengthPerRecvCall)
+	RecvBufferLengthPerRecvCall_(RecvBufferLengthPerRecvCall),
+	RecvPaused_(false),
+	RecvPauseCount_(0),
+	RecvResumeCount_(0),
+	RecvPinLimit_(RecvBufferCapacity / 2),
+	RecvBytesConsumed_(0),
+	RecvBytesReleased_(0),
+	Closed_(false)
 {
 	Assert(RecvBufferLengthPerRecvCall >= 0);
 	Assert(SendBufferCapacity >= 0);
@@ -33,19 +44,43 @@ IOCPConnection::~IOCPConnection()
 
 IOCPResultCode IOCPConnection::Send(uint8_t *Buffer, uint32_t Size, uint32_t *SizeQueued)
 {
+	return Send(Buffer, Size, SizeQueued, IOCPSendPriority::Bulk);
+}
+
+IOCPResultCode IOCPConnection::Send(uint8_t *Buffer, uint32_t Size, uint32_t *SizeQueued, IOCPSendPriority Priority)
+{
+	// 
+	// Buffer is one message (e.g. frame), never split between other messages of its lane.
+	// 
+
 	std::lock_guard<decltype(SendBufferMutex_)> Lock(SendBufferMutex_);
 	uint64_t SequenceId = SendSequenceNumber_;
 
-	if (SendBuffer_.GetWritableCount() < Size)
+	auto& Ring = SendRingOf(Priority);
+
+	if (Ring.GetWritableCount() < Size)
 		return IOCPResultCode::ErrorBufferFull;
 
-	auto ResultSize = SendBuffer_.Write(Buffer, Size);
+	auto ResultSize = Ring.Write(Buffer, Size);
 	Assert(ResultSize == Size);
 
+	if (Priority == IOCPSendPriority::Bulk)
+	{
+		SendBytesQueued_ += ResultSize;
+		SendBulkMessages_.push_back(ResultSize);
+	}
+
 	if (SizeQueued)
 		*SizeQueued = ResultSize;
 
-	if (!SendBufferList_.Count())
+	if (Priority == IOCPSendPriority::Control)
+	{
+		// Issue now, ahead of bulk data not yet issued.
+		auto ResultCode = ScheduleSend();
+		if (ResultCode != IOCPResultCode::Successful)
+			return ResultCode;
+	}
+	else if (!SendBufferList_.Count())
 	{
 		// Issue send.
 		IssueSendCompleted();
@@ -64,6 +99,39 @@ IOCPResultCode IOCPConnection::Send(uint8_t *Buffer, uint32_t Size, uint32_t *Si
 	return IOCPResultCode::Successful;
 }
 
+IOCPResultCode IOCPConnection::SendFile(HANDLE File, uint64_t Offset, uint32_t Length)
+{
+	// 
+	// Queue a file region to be sent by TransmitFile().
+	// File body is ordered after all bytes queued by Send() so far, 
+	// so that frame header followed by file body goes out without copying the body.
+	// 
+
+	if (File == nullptr || File == INVALID_HANDLE_VALUE)
+		return IOCPResultCode::ErrorInvalidParameter;
+
+	if (!Length || Length > 0x7ffffffe) // TransmitFile() limit per call
+		return IOCPResultCode::ErrorInvalidParameter;
+
+	std::lock_guard<decltype(SendBufferMutex_)> Lock(SendBufferMutex_);
+
+	IOCPSendFileRequest Request;
+	Request.File = File;
+	Request.Offset = Offset;
+	Request.Length = Length;
+	Request.StreamOffset = SendBytesQueued_;
+
+	SendFileQueue_.push_back(Request);
+
+	if (!SendBufferList_.Count())
+	{
+		// Issue send.
+		IssueSendCompleted();
+	}
+
+	return IOCPResultCode::Successful;
+}
+
 bool IOCPConnection::IssueSendCompleted()
 {
 	OverlappedIssueWrite_.Buffer.buf = nullptr;
@@ -128,7 +196,27 @@ IOCPResultCode IOCPConnection::SendCompletion(IOCP_OVERLAPPED_EXTENSION *Overlap
 
 	std::lock_guard<decltype(SendBufferMutex_)> Lock(SendBufferMutex_);
 
-	if (OverlappedExtension->Buffer.buf)
+	if (OverlappedExtension->Flags & BufferFlagTransmitFile)
+	{
+		// 
+		// 2. Remove completion buffer from send buffer list.
+		//    File body is not stored in send ring buffer, nothing to release.
+		// 
+
+		auto Buffer = SendBufferList_.Remove(OverlappedExtension->SequenceNumber);
+		Assert(Buffer != nullptr);
+
+		Assert(SendBulkInFlight_ >= OverlappedExtension->Buffer.len);
+		SendBulkInFlight_ -= OverlappedExtension->Buffer.len;
+
+		if (Dispatch_)
+		{
+			const_cast<IODispatchHandler *>(Dispatch_)->SendComplete(
+				nullptr,
+				OverlappedExtension->Buffer.len);
+		}
+	}
+	else if (OverlappedExtension->Buffer.buf)
 	{
 		// 
 		// 2. Remove completion buffer from send buffer list.
@@ -143,12 +231,21 @@ IOCPResultCode IOCPConnection::SendCompletion(IOCP_OVERLAPPED_EXTENSION *Overlap
 			OverlappedExtension->Buffer.len);
 
 		// 
-		// 3. Release sent bytes from send ring buffer.
+		// 3. Release sent bytes from send ring buffer of the lane.
 		// 
 
-		uint32_t BytesReleased = SendBuffer_.Release(OverlappedExtension->Buffer.len);
+		bool Priority = !!(OverlappedExtension->Flags & BufferFlagPriority);
+		auto& Ring = SendRingOf(Priority ? IOCPSendPriority::Control : IOCPSendPriority::Bulk);
+
+		uint32_t BytesReleased = Ring.Release(OverlappedExtension->Buffer.len);
 		Assert(BytesReleased == OverlappedExtension->Buffer.len);
 
+		if (!Priority)
+		{
+			Assert(SendBulkInFlight_ >= OverlappedExtension->Buffer.len);
+			SendBulkInFlight_ -= OverlappedExtension->Buffer.len;
+		}
+
 		uint64_t CurrentTick = GetTickCount64();
 		if (DebugTraceTick_ + 5000 < CurrentTick)
 		{
@@ -160,75 +257,213 @@ IOCPResultCode IOCPConnection::SendCompletion(IOCP_OVERLAPPED_EXTENSION *Overlap
 	}
 
 	// 
-	// 4. If data remains in the ring buffer, call WSASend().
+	// 4. If data remains in the ring buffers or file queue, call WSASend()/TransmitFile().
 	//    Otherwise, do nothing.
 	// 
 
-	uint32_t BytesToSend = SendBuffer_.GetReadableCount();
+	auto ResultCode = ScheduleSend();
+	if (ResultCode != IOCPResultCode::Successful)
+		return ResultCode;
 
-	if (BytesToSend)
+	// 
+	// 5. Finally, release the lock.
+	//    This is automatically done by dtor.
+	// 
+
+	return IOCPResultCode::Successful;
+}
+
+IOCPResultCode IOCPConnection::ScheduleSend()
+{
+	// 
+	// Send scheduler, called with SendBufferMutex_ held.
+	// Control lane is issued first and whole. Bulk lane is issued in whole messages
+	// while less than SendBulkQuantum bytes are in flight, so that control data queued later
+	// overtakes bulk data at the next message boundary instead of behind the whole backlog.
+	// Ring buffer data queued before a file body is sent first. A file body is part of the
+	// bulk message in front of it (its frame header), so it is issued as soon as the bytes
+	// before it are, whatever is in flight, and control data never goes in between.
+	// 
+
+	while (true)
 	{
-		// Split the buffer because buffer is not contiguous
-
-		ptrdiff_t Difference = SendBuffer_.GetBufferEndPointer() - SendBuffer_.GetReadPointer();
-		Assert(!(Difference & 0xffffffff00000000ull));
-		uint32_t RemainingCountWraparound = static_cast<uint32_t>(Difference);
-		uint32_t ReadableCount = SendBuffer_.GetReadableCount();
-
-		auto SplitList = {
-			// 1st buffer
-			std::make_tuple(
-				0,
-				std::min<uint32_t>(ReadableCount, RemainingCountWraparound),
-				SendBuffer_.GetReadPointer()),
-			// 2nd buffer
-			std::make_tuple(
-				1,
-				(ReadableCount >= RemainingCountWraparound) ? ReadableCount - RemainingCountWraparound : 0,
-				SendBuffer_.GetBufferStartPointer()),
-		};
-
-		for (auto& SplitBufferIterator : SplitList)
+		if (!SendFileQueue_.empty() && SendFileQueue_.front().StreamOffset == SendBytesIssued_)
 		{
-			uint32_t Count = 0;
-			const uint8_t *Pointer = nullptr;
-			std::tie(std::ignore, Count, Pointer) = SplitBufferIterator;
+			auto& Request = SendFileQueue_.front();
 
-			if (!Count)
-				continue;
+			auto ResultCode = IssueTransmitFile(Request);
+			if (ResultCode != IOCPResultCode::Successful)
+				return ResultCode;
 
-			// Data remains.
-			uint64_t SequenceNumber = SendSequenceNumber_;
-			auto Buffer = SendBufferList_.Add(SequenceNumber, const_cast<uint8_t *>(Pointer), Count, nullptr);
+			SendBulkInFlight_ += Request.Length;
+			SendFileQueue_.pop_front();
+			continue;
+		}
 
-			int Result = WSASend(
-				SocketFd_,
-				const_cast<WSABUF *>(&Buffer->OverlappedExtension()->Buffer),
-				1,
-				nullptr,
-				0,
-				const_cast<OVERLAPPED *>(&Buffer->OverlappedExtension()->Overlapped),
-				nullptr);
+		uint32_t ControlBytes = SendPriorityBuffer_.GetReadableCount();
+		if (ControlBytes)
+		{
+			auto ResultCode = IssueSendBuffer(IOCPSendPriority::Control, ControlBytes);
+			if (ResultCode != IOCPResultCode::Successful)
+				return ResultCode;
 
-			int LastError = WSAGetLastError();
-			if (Result == SOCKET_ERROR && (ERROR_IO_PENDING != LastError))
-			{
-				Trace("!! WSASend failed, LastError = %d\n", LastError);
-				return IOCPResultCode::ErrorSendFailure;
-			}
+			continue;
+		}
 
-			// Lock data.
-			uint32_t FlushCount = SendBuffer_.Read(nullptr, Count);
-			Assert(FlushCount == Count);
+		if (SendBulkInFlight_ >= SendBulkQuantum)
+			break;
+
+		uint64_t BytesLimit = SendBulkQuantum - SendBulkInFlight_;
 
-			SendSequenceNumber_++;
+		if (!SendFileQueue_.empty())
+		{
+			auto& Request = SendFileQueue_.front();
+			Assert(Request.StreamOffset > SendBytesIssued_);
+
+			uint64_t BytesBeforeFile = Request.StreamOffset - SendBytesIssued_;
+			BytesLimit = std::min<uint64_t>(BytesLimit, BytesBeforeFile);
 		}
+
+		// Whole messages only, at least one.
+		uint32_t BytesToSend = 0;
+		uint32_t MessagesCount = 0;
+
+		for (auto Size : SendBulkMessages_)
+		{
+			if (MessagesCount && BytesToSend + static_cast<uint64_t>(Size) > BytesLimit)
+				break;
+
+			BytesToSend += Size;
+			MessagesCount++;
+		}
+
+		if (!BytesToSend)
+			break;
+
+		auto ResultCode = IssueSendBuffer(IOCPSendPriority::Bulk, BytesToSend);
+		if (ResultCode != IOCPResultCode::Successful)
+			return ResultCode;
+
+		SendBulkMessages_.erase(SendBulkMessages_.begin(), SendBulkMessages_.begin() + MessagesCount);
 	}
 
-	// 
-	// 5. Finally, release the lock.
-	//    This is automatically done by dtor.
-	// 
+	return IOCPResultCode::Successful;
+}
+
+IOCPResultCode IOCPConnection::IssueSendBuffer(IOCPSendPriority Priority, uint32_t Count)
+{
+	auto& Ring = SendRingOf(Priority);
+
+	// Split the buffer because buffer is not contiguous
+
+	ptrdiff_t Difference = Ring.GetBufferEndPointer() - Ring.GetReadPointer();
+	Assert(!(Difference & 0xffffffff00000000ull));
+	uint32_t RemainingCountWraparound = static_cast<uint32_t>(Difference);
+	uint32_t ReadableCount = std::min<uint32_t>(Count, Ring.GetReadableCount());
+
+	auto SplitList = {
+		// 1st buffer
+		std::make_tuple(
+			0,
+			std::min<uint32_t>(ReadableCount, RemainingCountWraparound),
+			Ring.GetReadPointer()),
+		// 2nd buffer
+		std::make_tuple(
+			1,
+			(ReadableCount >= RemainingCountWraparound) ? ReadableCount - RemainingCountWraparound : 0,
+			Ring.GetBufferStartPointer()),
+	};
+
+	for (auto& SplitBufferIterator : SplitList)
+	{
+		uint32_t SplitCount = 0;
+		const uint8_t *Pointer = nullptr;
+		std::tie(std::ignore, SplitCount, Pointer) = SplitBufferIterator;
+
+		if (!SplitCount)
+			continue;
+
+		// Data remains.
+		uint64_t SequenceNumber = SendSequenceNumber_;
+		auto Buffer = SendBufferList_.Add(SequenceNumber, const_cast<uint8_t *>(Pointer), SplitCount, nullptr);
+
+		if (Priority == IOCPSendPriority::Control)
+		{
+			bool FlagResult = SendBufferList_.SetBufferFlag(SequenceNumber, BufferFlagPriority);
+			Assert(FlagResult);
+		}
+
+		int Result = WSASend(
+			SocketFd_,
+			const_cast<WSABUF *>(&Buffer->OverlappedExtension()->Buffer),
+			1,
+			nullptr,
+			0,
+			const_cast<OVERLAPPED *>(&Buffer->OverlappedExtension()->Overlapped),
+			nullptr);
+
+		int LastError = WSAGetLastError();
+		if (Result == SOCKET_ERROR && (ERROR_IO_PENDING != LastError))
+		{
+			Trace("!! WSASend failed, LastError = %d\n", LastError);
+			return IOCPResultCode::ErrorSendFailure;
+		}
+
+		// Lock data.
+		uint32_t FlushCount = Ring.Read(nullptr, SplitCount);
+		Assert(FlushCount == SplitCount);
+
+		if (Priority == IOCPSendPriority::Bulk)
+		{
+			SendBytesIssued_ += SplitCount;
+			SendBulkInFlight_ += SplitCount;
+		}
+
+		SendSequenceNumber_++;
+	}
+
+	return IOCPResultCode::Successful;
+}
+
+RingBuffer& IOCPConnection::SendRingOf(IOCPSendPriority Priority)
+{
+	return (Priority == IOCPSendPriority::Control) ? SendPriorityBuffer_ : SendBuffer_;
+}
+
+IOCPResultCode IOCPConnection::IssueTransmitFile(const IOCPSendFileRequest& Request)
+{
+	uint64_t SequenceNumber = SendSequenceNumber_;
+	auto Buffer = SendBufferList_.Add(SequenceNumber, nullptr, Request.Length, nullptr);
+	Assert(Buffer != nullptr);
+
+	bool FlagResult = SendBufferList_.SetBufferFlag(SequenceNumber, BufferFlagTransmitFile);
+	Assert(FlagResult);
+
+	// TransmitFile() takes file offset from the OVERLAPPED structure.
+	auto Overlapped = const_cast<OVERLAPPED *>(&Buffer->OverlappedExtension()->Overlapped);
+	Overlapped->Offset = static_cast<DWORD>(Request.Offset);
+	Overlapped->OffsetHigh = static_cast<DWORD>(Request.Offset >> 0x20);
+
+	BOOL Result = TransmitFile(
+		SocketFd_,
+		Request.File,
+		Request.Length,
+		0,
+		Overlapped,
+		nullptr,
+		0);
+
+	int LastError = WSAGetLastError();
+	if (!Result && (ERROR_IO_PENDING != LastError) && (WSA_IO_PENDING != LastError))
+	{
+		auto RequestedBuffer = SendBufferList_.Remove(SequenceNumber);
+		Assert(RequestedBuffer != nullptr);
+
+		Trace("!! TransmitFile failed, LastError = %d\n", LastError);
+		return IOCPResultCode::ErrorSendFailure;
+	}
+
+	SendSequenceNumber_++;
 
 	return IOCPResultCode::Successful;
 }
@@ -275,8 +510,8 @@ IOCPResultCode IOCPConnection::ReceiveCompletion(IOCP_OVERLAPPED_EXTENSION *Over
 	}
 
 	// 
-	// 3. Write the received data chunks to received ring buffer by sequential order.
-	//    If sequence number does not match as expected, stop processing and goto next step.
+	// 3. Park the received data chunks by sequential order.
+	//    They are written to received ring buffer as space becomes available.
 	// 
 
 	for (uint32_t i = 0; i < CompletedCountContiguous; i++)
@@ -285,85 +520,123 @@ IOCPResultCode IOCPConnection::ReceiveCompletion(IOCP_OVERLAPPED_EXTENSION *Over
 
 		auto Buffer = RecvBufferList_.Remove();
 		Assert(Buffer != nullptr);
+		Assert(Buffer->OverlappedExtension()->SequenceNumber == TargetSequenceNumber);
 
-		auto TargetOverlapped = Buffer->OverlappedExtension();
-		Assert(TargetOverlapped->SequenceNumber == TargetSequenceNumber);
+		RecvParkedList_.push_back(std::move(Buffer));
+	}
 
-		uint32_t ReceivedLength = TargetOverlapped->Buffer.len;
-		if (RecvBuffer_.GetWritableCount() < ReceivedLength)
-		{
-			Trace("!! Receive ring buffer full, Cannot write chunk [sequence number %llu, size %u]\n",
-				TargetSequenceNumber, ReceivedLength);
-			break;
-		}
+	// 
+	// 4. Process the received data, then pause or resume receiving.
+	// 
 
-		auto BytesWritten = RecvBuffer_.Write(
-			reinterpret_cast<uint8_t *>(TargetOverlapped->Buffer.buf),
-			TargetOverlapped->Buffer.len);
-		Assert(BytesWritten == TargetOverlapped->Buffer.len);
+	return ProcessReceived();
+}
 
-		uint64_t CurrentTick = GetTickCount64();
-		if (DebugTraceTick_ + 5000 < CurrentTick)
+IOCPResultCode IOCPConnection::ResumeReceive()
+{
+	// 
+	// Retry processing of parked chunks, for dispatch handlers which could not consume
+	// data in ReceiveComplete() (no further receive completion is coming while paused).
+	// 
+
+	std::lock_guard<decltype(RecvBufferMutex_)> Lock(RecvBufferMutex_);
+
+	return ProcessReceived();
+}
+
+bool IOCPConnection::IsReceivePaused()
+{
+	std::lock_guard<decltype(RecvBufferMutex_)> Lock(RecvBufferMutex_);
+	return RecvPaused_;
+}
+
+uint64_t IOCPConnection::ReceivePauseCount()
+{
+	std::lock_guard<decltype(RecvBufferMutex_)> Lock(RecvBufferMutex_);
+	return RecvPauseCount_;
+}
+
+uint64_t IOCPConnection::ReceiveResumeCount()
+{
+	std::lock_guard<decltype(RecvBufferMutex_)> Lock(RecvBufferMutex_);
+	return RecvResumeCount_;
+}
+
+IOCPResultCode IOCPConnection::ProcessReceived()
+{
+	// 
+	// Called with RecvBufferMutex_ held.
+	// 
+
+	while (true)
+	{
+		// 
+		// 1. Write the parked chunks to received ring buffer by sequential order,
+		//    as long as they fit. The rest stays parked, nothing is dropped.
+		// 
+
+		while (!RecvParkedList_.empty())
 		{
-			Trace("Removed the buffer object after recv [sequence number %llu, size %u]\n",
-				TargetSequenceNumber, ReceivedLength);
-			DebugTraceTick_ = CurrentTick;
+			auto TargetOverlapped = RecvParkedList_.front()->OverlappedExtension();
+
+			uint32_t ReceivedLength = TargetOverlapped->Buffer.len;
+			if (RecvBuffer_.GetWritableCount() < ReceivedLength)
+				break;
+
+			auto BytesWritten = RecvBuffer_.Write(
+				reinterpret_cast<uint8_t *>(TargetOverlapped->Buffer.buf),
+				TargetOverlapped->Buffer.len);
+			Assert(BytesWritten == TargetOverlapped->Buffer.len);
+
+			uint64_t CurrentTick = GetTickCount64();
+			if (DebugTraceTick_ + 5000 < CurrentTick)
+			{
+				Trace("Removed the buffer object after recv [sequence number %llu, size %u]\n",
+					TargetOverlapped->SequenceNumber, ReceivedLength);
+				DebugTraceTick_ = CurrentTick;
+			}
+
+			RecvParkedList_.pop_front();
 		}
+
+		// 
+		// 2. Process the received data in the ring buffer.
+		//    Stop when all chunks are written or the handler made no room for the next one.
+		// 
+
+		uint32_t SizeConsumed = DispatchReceived();
+
+		if (RecvParkedList_.empty() || !SizeConsumed)
+			break;
 	}
 
 	// 
-	// *4. Process the received data in the ring buffer.
+	// 3. Pause receiving while chunks are parked. No WSARecv() is issued, 
+	//    so that a slow handler slows the sender by TCP flow control.
 	// 
 
-	if (Dispatch_)
+	if (!RecvParkedList_.empty())
 	{
-		// Split the buffer because buffer is not contiguous
-
-		ptrdiff_t Difference = SendBuffer_.GetBufferEndPointer() - SendBuffer_.GetReadPointer();
-		Assert(!(Difference & 0xffffffff00000000ull));
-		uint32_t RemainingCountWraparound = static_cast<uint32_t>(Difference);
-		uint32_t ReadableCount = RecvBuffer_.GetReadableCount();
-
-		auto SplitList = {
-			// 1st buffer
-			std::make_tuple(
-				0,
-				std::min<uint32_t>(ReadableCount, RemainingCountWraparound),
-				RecvBuffer_.GetReadPointer()),
-			// 2nd buffer
-			std::make_tuple(
-				1,
-				(ReadableCount >= RemainingCountWraparound) ? ReadableCount - RemainingCountWraparound : 0,
-				RecvBuffer_.GetBufferStartPointer()),
-		};
-
-		for (auto& SplitBufferIterator : SplitList)
+		if (!RecvPaused_)
 		{
-			uint32_t Count = 0;
-			const uint8_t *Pointer = nullptr;
-			std::tie(std::ignore, Count, Pointer) = SplitBufferIterator;
-
-			if (!Count)
-				continue;
+			Trace("Receive paused, ring buffer full [%zu chunks parked, %u bytes readable]\n",
+				RecvParkedList_.size(), RecvBuffer_.GetReadableCount());
 
-			// Call our dispatch handler.
-			Assert(const_cast<IODispatchHandler *>(Dispatch_)->ReceiveComplete(Pointer, Count));
-
-			// Advance the read pointer.
-			RecvBuffer_.Read(nullptr, Count);
-			RecvBuffer_.Release(Count);
+			RecvPaused_ = true;
+			RecvPauseCount_++;
 		}
+
+		return IOCPResultCode::Successful;
 	}
-	else
+
+	if (RecvPaused_)
 	{
-		// Flush the buffer.
-		uint32_t Count = RecvBuffer_.GetReadableCount();
-		RecvBuffer_.Read(nullptr, Count);
-		RecvBuffer_.Release(Count);
+		RecvPaused_ = false;
+		RecvResumeCount_++;
 	}
 
 	// 
-	// 5. If receive buffer list is empty, add new buffer and call WSARecv().
+	// 4. If receive buffer list is empty, add new buffer and call WSARecv().
 	// 
 
 	if (!RecvBufferList_.Count())
@@ -396,14 +669,178 @@ IOCPResultCode IOCPConnection::ReceiveCompletion(IOCP_OVERLAPPED_EXTENSION *Over
 		RecvSequenceNumber_++;
 	}
 
+	return IOCPResultCode::Successful;
+}
+
+uint32_t IOCPConnection::DispatchReceived()
+{
 	// 
-	// 6. Finally, release the lock.
-	//    This is automatically done by dtor.
+	// Returns bytes consumed from the received ring buffer.
 	// 
 
-	return IOCPResultCode::Successful;
+	uint32_t ReadableCount = RecvBuffer_.GetReadableCount();
+	if (!ReadableCount)
+		return 0;
+
+	if (!Dispatch_)
+	{
+		// Flush the buffer.
+		RecvBuffer_.Read(nullptr, ReadableCount);
+		RecvBytesConsumed_ += ReadableCount;
+		ReleaseReceived();
+		return ReadableCount;
+	}
+
+	// Split the buffer because buffer is not contiguous
+
+	ptrdiff_t Difference = RecvBuffer_.GetBufferEndPointer() - RecvBuffer_.GetReadPointer();
+	Assert(!(Difference & 0xffffffff00000000ull));
+	uint32_t RemainingCountWraparound = static_cast<uint32_t>(Difference);
+
+	IODispatchBuffer Buffers[2] = {
+		// 1st buffer
+		{
+			RecvBuffer_.GetReadPointer(),
+			std::min<uint32_t>(ReadableCount, RemainingCountWraparound)
+		},
+		// 2nd buffer
+		{
+			RecvBuffer_.GetBufferStartPointer(),
+			(ReadableCount >= RemainingCountWraparound) ? ReadableCount - RemainingCountWraparound : 0
+		},
+	};
+
+	// Call our dispatch handler.
+	// Unconsumed bytes (e.g. incomplete frame) are left in the ring buffer.
+	uint32_t SizeConsumed = 0;
+	if (!const_cast<IODispatchHandler *>(Dispatch_)->ReceiveComplete(
+		Buffers, Buffers[1].Size ? 2 : 1, &SizeConsumed))
+	{
+		Trace("!! Dispatch handler failed to process received data [size %u, consumed %u]\n",
+			ReadableCount, SizeConsumed);
+	}
+
+	Assert(SizeConsumed <= ReadableCount);
+
+	// Advance the read pointer, bytes are released unless pinned.
+	RecvBuffer_.Read(nullptr, SizeConsumed);
+	RecvBytesConsumed_ += SizeConsumed;
+	ReleaseReceived();
+
+	return SizeConsumed;
+}
+
+void IOCPConnection::ReleaseReceived()
+{
+	// 
+	// Called with RecvBufferMutex_ held.
+	// Releases consumed bytes up to the first pin.
+	// 
+
+	uint64_t Limit = RecvBytesConsumed_;
+	if (!RecvPins_.empty())
+		Limit = std::min(Limit, RecvPins_.begin()->first);
+
+	if (Limit <= RecvBytesReleased_)
+		return;
+
+	uint64_t Count = Limit - RecvBytesReleased_;
+	Assert(!(Count & 0xffffffff00000000ull));
+
+	auto BytesReleased = RecvBuffer_.Release(static_cast<uint32_t>(Count));
+	Assert(BytesReleased == Count);
+
+	RecvBytesReleased_ = Limit;
+}
+
+bool IOCPConnection::PinReceived(const uint8_t * Pointer, uint64_t * Position)
+{
+	std::lock_guard<decltype(RecvBufferMutex_)> Lock(RecvBufferMutex_);
+
+	// Distance from read pointer, the readable part may wrap around.
+	const uint8_t *ReadPointer = RecvBuffer_.GetReadPointer();
+	const uint8_t *EndPointer = RecvBuffer_.GetBufferEndPointer();
+	const uint8_t *StartPointer = RecvBuffer_.GetBufferStartPointer();
+	ptrdiff_t Difference;
+
+	if (Pointer >= ReadPointer && Pointer < EndPointer)
+		Difference = Pointer - ReadPointer;
+	else if (Pointer >= StartPointer && Pointer < ReadPointer)
+		Difference = (EndPointer - ReadPointer) + (Pointer - StartPointer);
+	else
+		return false;
+
+	if (static_cast<uint64_t>(Difference) >= RecvBuffer_.GetReadableCount())
+		return false; // Not received (e.g. a copy outside the ring buffer)
+
+	*Position = RecvBytesConsumed_ + Difference;
+
+	// Past the high-water mark, an older pin is held too long for the ring buffer to take more.
+	uint64_t First = RecvPins_.empty() ? *Position : RecvPins_.begin()->first;
+	if (*Position - First > RecvPinLimit_)
+		return false;
+
+	RecvPins_[*Position]++;
+
+	return true;
 }
 
+IOCPResultCode IOCPConnection::UnpinReceived(uint64_t Position)
+{
+	std::lock_guard<decltype(RecvBufferMutex_)> Lock(RecvBufferMutex_);
+
+	auto it = RecvPins_.find(Position);
+	if (it == RecvPins_.end())
+		return IOCPResultCode::ErrorInvalidParameter;
+
+	if (--it->second)
+		return IOCPResultCode::Successful;
+
+	RecvPins_.erase(it);
+	ReleaseReceived();
+
+	// Parked chunks may fit now (no receive completion is coming while paused).
+	// The last pin may be released after Close(), nothing is dispatched then.
+	return (RecvPaused_ && !Closed_) ? ProcessReceived() : IOCPResultCode::Successful;
+}
+
+uint32_t IOCPConnection::GetPinnedCount()
+{
+	std::lock_guard<decltype(RecvBufferMutex_)> Lock(RecvBufferMutex_);
+
+	uint64_t Count = RecvBytesConsumed_ - RecvBytesReleased_;
+	Assert(!(Count & 0xffffffff00000000ull));
+	return static_cast<uint32_t>(Count);
+}
+
+std::shared_ptr<IOCPConnection> IOCPConnection::Reference()
+{
+	return Self_.lock();
+}
+
+bool IOCPConnection::Tick()
+{
+	if (!Dispatch_ || Closed_)
+		return true;
+
+	return const_cast<IODispatchHandler *>(Dispatch_)->Tick();
+}
+
+void IOCPConnection::Close()
+{
+	// 
+	// Pending WSASend()/WSARecv() complete with an error, 
+	// the object stays in the manager until it shuts down.
+	// 
+
+	if (Closed_.exchange(true))
+		return;
+
+	Trace("Closing connection [socket 0x%llx]\n", static_cast<uint64_t>(SocketFd_));
+	closesocket(SocketFd_);
+}
+
+
 
 
 }
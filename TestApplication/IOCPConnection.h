@@ -14,45 +14,114 @@ enum class IOCPResultCode : uint32_t
 	ErrorBufferFull,
 	ErrorSendFailure,
 	ErrorRecvFailure,
+	ErrorInvalidParameter,
+};
+
+enum class IOCPSendPriority : uint32_t
+{
+	Bulk = 0,		// Calls, file bodies
+	Control,		// Responses and control frames, sent ahead of queued bulk data
+};
+
+struct IOCPSendFileRequest
+{
+	HANDLE File;				// File handle (must stay open until SendComplete is dispatched)
+	uint64_t Offset;			// Offset in file
+	uint32_t Length;			// Number of bytes to transmit
+	uint64_t StreamOffset;		// Send stream position the file body is ordered after
 };
 
 class IOCPConnection
 {
 public:
+	// Bulk bytes passed to WSASend()/TransmitFile() but not completed, at most.
+	// Control data waits for no more than this to drain.
+	constexpr static const uint32_t SendBulkQuantum = 0x40000;
+
 	IOCPConnection(SOCKET Socket, const IODispatchHandler *Dispatch, uint32_t SendBufferCapacity, uint32_t RecvBufferCapacity, uint32_t RecvBufferLengthPerRecvCall);
 	~IOCPConnection();
 
 	IOCPResultCode Send(uint8_t *Buffer, uint32_t Size, uint32_t *SizeQueued);
+	IOCPResultCode Send(uint8_t *Buffer, uint32_t Size, uint32_t *SizeQueued, IOCPSendPriority Priority);
+	IOCPResultCode SendFile(HANDLE File, uint64_t Offset, uint32_t Length);
+
+	// Receive is paused while the ring buffer cannot take completed chunks (see ProcessReceived).
+	IOCPResultCode ResumeReceive();
+	bool IsReceivePaused();
+	uint64_t ReceivePauseCount();
+	uint64_t ReceiveResumeCount();
+
+	// 
+	// Pinned bytes stay in the receive ring buffer after the dispatch handler consumed them,
+	// so that they can be referenced in place beyond ReceiveComplete() (e.g. argument views).
+	// Pointer must be in the buffers passed to the running ReceiveComplete(). Space is released
+	// in order, a pin holds back every byte received after it too. Pins hold back at most
+	// RecvPinLimit_ bytes (half the ring buffer), PinReceived() fails past it and the caller copies.
+	// 
+	bool PinReceived(const uint8_t *Pointer, uint64_t *Position);
+	IOCPResultCode UnpinReceived(uint64_t Position);
+	uint32_t GetPinnedCount();
+
+	// Owning reference for objects that may outlive the manager's (e.g. RpcReceivePin).
+	// Empty if the connection was not added by IOCPConnectionManager.
+	std::shared_ptr<IOCPConnection> Reference();
 
 private:
 
 	bool IssueSendCompleted();
 	bool IssueRecvCompleted();
 
+	IOCPResultCode ScheduleSend();
+	IOCPResultCode IssueSendBuffer(IOCPSendPriority Priority, uint32_t Count);
+	IOCPResultCode IssueTransmitFile(const IOCPSendFileRequest& Request);
+
 	IOCPResultCode SendCompletion(IOCP_OVERLAPPED_EXTENSION *OverlappedExtension);
 	IOCPResultCode ReceiveCompletion(IOCP_OVERLAPPED_EXTENSION *OverlappedExtension);
+	IOCPResultCode ProcessReceived();
+	uint32_t DispatchReceived();
+	void ReleaseReceived();
+	bool Tick();
+	void Close();
 
 
 	SOCKET SocketFd_;								// Socket file descriptor.
 
 	std::recursive_mutex SendBufferMutex_;			// Mutex for send operation.
 	RingBuffer SendBuffer_;							// Ring buffer which stores data to send.
+	RingBuffer SendPriorityBuffer_;					// Ring buffer which stores control data to send.
+	std::deque<uint32_t> SendBulkMessages_;			// Sizes of messages in send ring buffer not yet issued.
+	uint32_t SendBulkInFlight_;						// Bulk bytes issued but not completed.
 	IOCPBufferList SendBufferList_;					// Buffer list for WSASend().
 	std::atomic_uint64_t SendSequenceNumber_;		// Send sequence number.
+	std::deque<IOCPSendFileRequest> SendFileQueue_;	// File bodies waiting for TransmitFile().
+	uint64_t SendBytesQueued_;						// Total bytes written to send ring buffer.
+	uint64_t SendBytesIssued_;						// Total bytes of send ring buffer passed to WSASend().
 
 	std::recursive_mutex RecvBufferMutex_;			// Mutex for receive operation.
 	RingBuffer RecvBuffer_;							// Ring buffer which stores data received.
 	IOCPBufferList RecvBufferList_;					// Buffer list for WSARecv().
 	std::atomic_uint64_t RecvSequenceNumber_;		// Receive sequence number.
 	uint32_t RecvBufferLengthPerRecvCall_;			// Receive buffer length per WSARecv() call (WSABUF::len)
+	std::deque<std::unique_ptr<IOCPBuffer>> RecvParkedList_;	// Completed chunks waiting for ring buffer space.
+	bool RecvPaused_;								// No WSARecv() is issued while set.
+	uint64_t RecvPauseCount_;
+	uint64_t RecvResumeCount_;
+	std::map<uint64_t, uint32_t> RecvPins_;			// <Receive stream position, pin count>
+	uint32_t RecvPinLimit_;							// Bytes from the first pin to a new one, at most
+	uint64_t RecvBytesConsumed_;					// Total bytes consumed by dispatch handler.
+	uint64_t RecvBytesReleased_;					// Total bytes released from receive ring buffer.
 
 	uint64_t DebugTraceTick_;
+	std::atomic_bool Closed_;						// Socket closed by Close()
+	std::weak_ptr<IOCPConnection> Self_;			// Set by IOCPConnectionManager::AddConnection()
 
 	IOCP_OVERLAPPED_EXTENSION OverlappedIssueRead_;
 	IOCP_OVERLAPPED_EXTENSION OverlappedIssueWrite_;
 
 	const IODispatchHandler *Dispatch_;
 
+	RingBuffer& SendRingOf(IOCPSendPriority Priority);
+
 	friend class IOCPConnectionManager;
 };
 
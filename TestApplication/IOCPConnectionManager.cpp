@@ -5,13 +5,15 @@ namespace IOCP
 
 IOCPConnectionManager::IOCPConnectionManager() : 
 	Initialized_(false),
-	WorkersCount_(0)
+	WorkersCount_(0),
+	NextTick_(0)
 {
 }
 
 IOCPConnectionManager::IOCPConnectionManager(uint32_t WorkersCount) : 
 	Initialized_(false),
-	WorkersCount_(WorkersCount)
+	WorkersCount_(WorkersCount),
+	NextTick_(0)
 {
 
 }
@@ -52,7 +54,13 @@ bool IOCPConnectionManager::Initialize()
 				&BytesTransferred,
 				reinterpret_cast<ULONG_PTR *>(&Connection),
 				reinterpret_cast<LPOVERLAPPED *>(&OverlappedExtension),
-				INFINITE);
+				TickIntervalMs);
+
+			TickConnections();
+
+			// Timed out, nothing dequeued.
+			if (!Result && !OverlappedExtension)
+				continue;
 
 			// 
 			// Add order number in our overlapped context when calling WSARecv()
@@ -145,10 +153,12 @@ bool IOCPConnectionManager::Shutdown()
 
 IOCPConnection * IOCPConnectionManager::AddConnection(SOCKET Socket, const IODispatchHandler *Dispatch, uint32_t SendBufferCapacity, uint32_t RecvBufferCapacity, uint32_t RecvBufferLengthPerRecvCall)
 {
-	auto Connection = std::make_unique<IOCPConnection>(Socket, Dispatch, SendBufferCapacity, RecvBufferCapacity, RecvBufferLengthPerRecvCall);
+	auto Connection = std::make_shared<IOCPConnection>(Socket, Dispatch, SendBufferCapacity, RecvBufferCapacity, RecvBufferLengthPerRecvCall);
 	if (!Connection)
 		return nullptr;
 
+	Connection->Self_ = Connection;
+
 	std::lock_guard<decltype(Mutex_)> Lock(Mutex_);
 	uintptr_t Key = Socket;
 	auto& it = ConnectionMap_.find(Key);
@@ -185,4 +195,22 @@ IOCPConnection * IOCPConnectionManager::AddConnection(SOCKET Socket, const IODis
 	return Object;
 }
 
+void IOCPConnectionManager::TickConnections()
+{
+	// One worker ticks per interval, others go back to waiting.
+	uint64_t Now = GetTickCount64();
+	uint64_t Next = NextTick_;
+
+	if (Now < Next || !NextTick_.compare_exchange_strong(Next, Now + TickIntervalMs))
+		return;
+
+	std::lock_guard<decltype(Mutex_)> Lock(Mutex_);
+
+	for (auto& it : ConnectionMap_)
+	{
+		if (!it.second->Tick())
+			it.second->Close();
+	}
+}
+
 }
@@ -12,6 +12,9 @@ namespace IOCP
 class IOCPConnectionManager
 {
 public:
+	// Period of IODispatchHandler::Tick() of every connection.
+	constexpr static const uint32_t TickIntervalMs = 10;
+
 	IOCPConnectionManager();
 	IOCPConnectionManager(uint32_t WorkersCount);
 	~IOCPConnectionManager();
@@ -22,11 +25,14 @@ public:
 	IOCPConnection *AddConnection(SOCKET Socket, const IODispatchHandler *Dispatch, uint32_t SendBufferCapacity, uint32_t RecvBufferCapacity, uint32_t RecvBufferLengthPerRecvCall);
 
 private:
+	void TickConnections();
+
 	std::recursive_mutex Mutex_;
-	std::map<uintptr_t, std::unique_ptr<IOCPConnection>> ConnectionMap_;
+	std::map<uintptr_t, std::shared_ptr<IOCPConnection>> ConnectionMap_;	// Receive pins may hold a reference too
 	std::unique_ptr<std::thread[]> Workers_;
 	uint32_t WorkersCount_;
 	HANDLE IoCompletionPort_;
+	std::atomic<uint64_t> NextTick_;		// GetTickCount64() of next TickConnections()
 	bool Initialized_;
 };
 
@@ -5,6 +5,12 @@
 namespace IOCP
 {
 
+struct IODispatchBuffer
+{
+	const uint8_t *Pointer;
+	uint32_t Size;
+};
+
 class IODispatchHandler
 {
 public:
@@ -13,7 +19,26 @@ public:
 		return true;
 	}
 
-	virtual bool ReceiveComplete(const uint8_t *BufferReceived, uint32_t Size) noexcept
+	// 
+	// Buffers describe the readable part of receive ring buffer (2 buffers if wrapped around).
+	// Bytes not consumed stay in the ring buffer and are passed again on next completion.
+	// 
+	virtual bool ReceiveComplete(const IODispatchBuffer *Buffers, uint32_t BuffersCount, uint32_t *SizeConsumed) noexcept
+	{
+		uint32_t Size = 0;
+		for (uint32_t i = 0; i < BuffersCount; i++)
+			Size += Buffers[i].Size;
+
+		*SizeConsumed = Size;
+		return true;
+	}
+
+	// 
+	// Called about every IOCPConnectionManager::TickIntervalMs from a worker thread,
+	// for deferred work (e.g. flushing collected replies). Never concurrently with itself.
+	// Returning false closes the connection (e.g. peer not responding).
+	// 
+	virtual bool Tick() noexcept
 	{
 		return true;
 	}
@@ -1,8 +1,101 @@
 #include "Rpc.h"
+#include "RpcMarshalPlan.h"
+#include "SRPCFrameHandler.h"
 
 namespace SRPC
 {
 
+uint64_t Rpc::Register(void * PtrFunction, uint32_t ParamsCount, const uint8_t * TypeRecord, size_t TypeRecordSize, uint64_t Id)
+{
+	RpcRegisteredCall Call;
+	Call.Function = PtrFunction;
+	Call.Id = Id;
+	Call.ParamsCount = ParamsCount;
+	Call.TypeRecord = TypeRecord;
+	Call.TypeRecordSize = TypeRecordSize;
+
+	if (TypeRecord)
+	{
+		// Compile the marshalling plan once, calls only execute it.
+		auto Records = RpcTypeRecords::Deserialize(TypeRecord, TypeRecordSize);
+
+		auto Plan = std::make_shared<RpcMarshalPlan>();
+		auto CompactPlan = std::make_shared<RpcMarshalPlan>();
+		if (!Records ||
+			!Plan->Compile(*Records) ||
+			!CompactPlan->Compile(*Records, RpcIntegerEncoding::Compact) ||
+			Plan->ParamsCount() != ParamsCount)
+		{
+			Trace("!! Type record of call 0x%llx is invalid\n", Id);
+			return 0;
+		}
+
+		Call.Plan = std::move(Plan);
+		Call.CompactPlan = std::move(CompactPlan);
+	}
 
+	std::lock_guard<decltype(Mutex_)> Lock(Mutex_);
+
+	auto ResultPair = CallMap_.try_emplace(Id, std::move(Call));
+	if (!ResultPair.second)
+		return 0;
+
+	if (TypeRecord)
+	{
+		for (auto Handler : Handlers_)
+			Handler->RegisterSchema(Id, TypeRecord, static_cast<uint32_t>(TypeRecordSize));
+	}
+
+	return Id;
 }
 
+void Rpc::Attach(SRPCFrameHandler * Handler)
+{
+	std::lock_guard<decltype(Mutex_)> Lock(Mutex_);
+
+	for (auto& it : CallMap_)
+	{
+		if (it.second.TypeRecord)
+			Handler->RegisterSchema(it.first, it.second.TypeRecord, static_cast<uint32_t>(it.second.TypeRecordSize));
+	}
+
+	Handlers_.push_back(Handler);
+}
+
+void Rpc::Detach(SRPCFrameHandler * Handler)
+{
+	std::lock_guard<decltype(Mutex_)> Lock(Mutex_);
+
+	Handlers_.erase(std::remove(Handlers_.begin(), Handlers_.end(), Handler), Handlers_.end());
+}
+
+std::shared_ptr<RpcMarshalPlan> Rpc::GetMarshalPlan(uint64_t Id)
+{
+	return GetMarshalPlan(Id, RpcIntegerEncoding::Fixed);
+}
+
+std::shared_ptr<RpcMarshalPlan> Rpc::GetMarshalPlan(uint64_t Id, RpcIntegerEncoding Encoding)
+{
+	std::lock_guard<decltype(Mutex_)> Lock(Mutex_);
+
+	auto it = CallMap_.find(Id);
+	if (it == CallMap_.end())
+		return nullptr;
+
+	return Encoding == RpcIntegerEncoding::Compact ? it->second.CompactPlan : it->second.Plan;
+}
+
+bool Rpc::Call(SRPCFrameHandler & Handler, uint64_t Id, void * const * Params, uint32_t DeadlineMs, 
+	std::function<void(RpcCallStatus Status)> Completion, uint32_t * Rsn)
+{
+	auto Plan = GetMarshalPlan(Id, Handler.IntegerEncoding());
+	if (!Plan)
+	{
+		Trace("!! Call 0x%llx is not registered with a type record\n", Id);
+		return false;
+	}
+
+	return Handler.Call(Id, std::move(Plan), Params, DeadlineMs, std::move(Completion), Rsn);
+}
+
+}
@@ -3,6 +3,7 @@
 #include "SRPCBase.h"
 #include "ThreadPool.h"
 #include "ByteStream.h"
+#include "RpcPendingCallTable.h"
 
 namespace SRPC
 {
@@ -13,21 +14,42 @@ constexpr uint32_t EvaluateParamsCount(TReturn(*Function)(TArgs...))
 	return sizeof...(TArgs);
 }
 
+template <typename TFunction>
+struct RpcFunctionTypeRecord; // RpcTypeTraits.h
+
+class RpcMarshalPlan;
+class SRPCFrameHandler;
+
 struct RpcRegisteredCall
 {
 	uint64_t Id;
 	void *Function;
 	uint32_t ParamsCount;
+	const uint8_t *TypeRecord;	// Serialized PARAM_LIST record (nullptr if not known)
+	size_t TypeRecordSize;
+	std::shared_ptr<RpcMarshalPlan> Plan;	// Compiled from TypeRecord at registration
+	std::shared_ptr<RpcMarshalPlan> CompactPlan;	// Same, for RpcIntegerEncoding::Compact
 };
 
 enum class RpcFrameType : uint16_t
 {
 	None = 0,
-	Register,
-	Unregister,
+	Register,		// Response: schema of fingerprint acknowledged
+	Unregister,		// Response: schema of fingerprint unknown, call Rsn dropped
 	Call,
-//	Cancel,
+	Cancel,			// Abandon call of Rsn (no CallReturn follows)
 	CallReturn,
+	CallBatch,		// Many Call (or CallReturn, if Response) bodies in one frame
+	Credit,			// Flow control: receiver grants more bytes of frames to sender
+	Ping,			// Keepalive, pong if Response
+	Settings,		// Features supported and digest types accepted by the sender
+};
+
+// Features advertised by Settings frame, used toward the peer once both sides have them.
+enum RpcFeatures : uint32_t
+{
+	FeatureNone = 0x00,
+	FeatureCompactIntegers = 0x01,	// Call/CallReturn messages with Compact flag
 };
 
 #pragma pack(push, 4)
@@ -46,12 +68,20 @@ struct RpcFrameHeader
 		{
 			uint16_t Response : 1;	// Response (if set)
 			uint16_t EoR : 1;		// End of request/response (if set)
-			uint16_t Reserved : 14;
+			uint16_t Digest : 2;	// Digest type (see RpcDigestType)
+			uint16_t Deadline : 1;	// Call message starts with deadline (see RpcFrameBody::Call)
+			uint16_t Schema : 1;	// Call message has schema block (see RpcFrameBody::Schema)
+			uint16_t Compact : 1;	// Integers of parameters are compact (see RpcIntegerEncoding)
+			uint16_t Reserved : 9;
 		} Bitfields;
 		uint16_t Flags;
 	} u;
 	uint32_t Digest3;		// [127:96] of digest
+	uint32_t Length;		// Length of frame body in bytes
 };
+#pragma pack(pop)
+
+static_assert(sizeof(RpcFrameHeader) == 40, "RpcFrameHeader must be 40 bytes !!");
 
 
 /*
@@ -61,7 +91,7 @@ struct RpcFrameHeader
 
 	TypeId: 2-byte
 	Attributes: 1-byte
-	ArrayCount: 4-byte
+	ArrayCount: 4-byte (varint if compact)
 	Packing: 1-byte
 	FieldsCount: 1-byte
 
@@ -161,6 +191,19 @@ inline RpcTypeAttributes& operator|=(RpcTypeAttributes& lhs, RpcTypeAttributes r
 	return lhs;
 }
 
+// 
+// Integers of parameters on the wire: Fixed is full width little-endian, Compact is LEB128 varint 
+// (zigzag for signed) for 16/32/64-bit integers, at any depth of UDTs and arrays, so the bytes 
+// depend only on the types. 8-bit integers, characters, floats and pointers are fixed in both,
+// as are frame headers, deadlines and type records.
+// 
+
+enum class RpcIntegerEncoding
+{
+	Fixed,
+	Compact,
+};
+
 
 union RpcFrameBody
 {
@@ -172,14 +215,52 @@ union RpcFrameBody
 
 	struct
 	{
-		// Call: Id, { Parameter Type Records }, { Parameters }
+		// Call: [Deadline], [Schema], Id, { Parameters }
+		// Deadline (if Deadline flag): milliseconds the caller waits from sending, 
+		// relative so that clocks of both hosts need not agree.
+		uint32_t Deadline;
 		uint64_t Id;
 	} Call;
 
+	struct
+	{
+		// Schema (if Schema flag): Fingerprint, RecordSize, { Parameter Type Records }
+		// RecordSize is 0 once the peer acknowledged the fingerprint (Register response).
+		// Register/Unregister response: Fingerprint
+		uint64_t Fingerprint;
+		uint32_t RecordSize;
+	} Schema;
+
 	struct
 	{
 		// CallReturn: Id, { Return Type Record }, Return Value
 	} CallReturn;
+
+	struct
+	{
+		// CallBatch: Count, { Rsn, Size, Call/CallReturn body }[Count]
+		uint32_t Count;
+	} CallBatch;
+
+	struct
+	{
+		// Credit: Increment (bytes of frames the sender may send in addition)
+		uint32_t Increment;
+	} Credit;
+
+	struct
+	{
+		// Ping: Timestamp (echoed in pong)
+		uint64_t Timestamp;
+	} Ping;
+
+	struct
+	{
+		// Settings: Features (see RpcFeatures) and digest types accepted by the sender 
+		// (see RpcFrameParser::SetDigestAcceptMask), sent when attached and when changed
+		uint32_t Features;
+		uint32_t DigestAcceptMask;
+	} Settings;
 };
 
 
@@ -211,40 +292,39 @@ public:
 
 	uint64_t Register(void *PtrFunction, uint32_t ParamsCount, uint64_t Id)
 	{
-		std::lock_guard<decltype(Mutex_)> Lock(Mutex_);
-
-		RpcRegisteredCall Call;
-		Call.Function = PtrFunction;
-		Call.Id = Id;
-		Call.ParamsCount = ParamsCount;
+		return Register(PtrFunction, ParamsCount, nullptr, 0, Id);
+	}
 
-		auto ResultPair = CallMap_.try_emplace(Id, Call);
-		if (ResultPair.second)
-			return Id;
+	uint64_t Register(void *PtrFunction, uint32_t ParamsCount, const uint8_t *TypeRecord, size_t TypeRecordSize, uint64_t Id);
+	std::shared_ptr<RpcMarshalPlan> GetMarshalPlan(uint64_t Id);
+	std::shared_ptr<RpcMarshalPlan> GetMarshalPlan(uint64_t Id, RpcIntegerEncoding Encoding);
 
-		return 0;
-	}
+	// Calls made on Handler carry the type records of registered calls (see SRPCFrameHandler::RegisterSchema),
+	// those registered later included. Handler must be detached before it is destroyed.
+	void Attach(SRPCFrameHandler *Handler);
+	void Detach(SRPCFrameHandler *Handler);
 
-	template <
-		typename TFunction, 
-		typename = std::enable_if<std::is_function<TFunction>::value, typename = void>>
-		uint64_t Register(TFunction Function, uint64_t Id)
+	// Type record is generated from the signature at compile time (include RpcTypeTraits.h).
+	template <typename TReturn, typename... TArgs>
+	uint64_t Register(TReturn(*Function)(TArgs...), uint64_t Id)
 	{
-		uint32_t ParamsCount = EvaluateParamsCount(PtrFunction);
-		return Register(PtrFunction, ParamsCount, Id);
-	}
+		using TypeRecord = RpcFunctionTypeRecord<TReturn(TArgs...)>;
 
-private:
-	
-	/*
-		TODO: Implement function call helper.
-	*/
+		return Register(reinterpret_cast<void *>(Function), EvaluateParamsCount(Function), 
+			TypeRecord::Data(), TypeRecord::Size, Id);
+	}
 
+	// Calls registered call Id on Handler by its plan in the encoding Handler uses toward the peer,
+	// the CallReturn is decoded back into Params (see SRPCFrameHandler::Call).
+	bool Call(SRPCFrameHandler& Handler, uint64_t Id, void * const *Params, uint32_t DeadlineMs,
+		std::function<void(RpcCallStatus Status)> Completion, uint32_t *Rsn);
 
+private:
 	uint32_t ThreadCount_;
 	ThreadPool ThreadPool_;
 	std::recursive_mutex Mutex_;
 	std::map<uint64_t, RpcRegisteredCall> CallMap_;
+	std::vector<SRPCFrameHandler *> Handlers_;
 };
 
 }
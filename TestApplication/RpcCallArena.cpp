@@ -0,0 +1,176 @@
+
+#include "RpcCallArena.h"
+
+namespace SRPC
+{
+
+RpcCallArena::RpcCallArena() :
+	First_(NewBlock(BlockSize)),
+	Offset_(0),
+	Used_(0),
+	Finalizers_(nullptr),
+	References_(0)
+{
+	Current_ = First_;
+}
+
+RpcCallArena::~RpcCallArena()
+{
+	Reset();
+	::operator delete(First_);
+}
+
+void * RpcCallArena::Allocate(size_t Size, size_t Alignment)
+{
+	Assert(Alignment && !(Alignment & (Alignment - 1)));
+
+	for (;;)
+	{
+		uintptr_t Base = reinterpret_cast<uintptr_t>(BlockData(Current_));
+		size_t Offset = ((Base + Offset_ + Alignment - 1) & ~static_cast<uintptr_t>(Alignment - 1)) - Base;
+		if (Offset <= Current_->Size && Size <= Current_->Size - Offset)
+		{
+			Offset_ = Offset + Size;
+			Used_ += Size;
+			return BlockData(Current_) + Offset;
+		}
+
+		if (!Current_->Next)
+			break;
+
+		// Block kept from a previous call.
+		Current_ = Current_->Next;
+		Offset_ = 0;
+	}
+
+	// Room for Size at any Alignment.
+	Current_->Next = NewBlock(std::max(BlockSize, Size + Alignment));
+	Current_ = Current_->Next;
+	Offset_ = 0;
+
+	return Allocate(Size, Alignment);
+}
+
+void RpcCallArena::Reset()
+{
+	while (Finalizers_)
+	{
+		auto Entry = Finalizers_;
+		Finalizers_ = Entry->Next;
+		Entry->Destroy(Entry->Object);
+	}
+
+	// Blocks of BlockSize are kept for the next call, larger ones were for one large reply.
+	Block **Link = &First_->Next;
+	while (*Link)
+	{
+		Block *Target = *Link;
+		if (Target->Size > BlockSize)
+		{
+			*Link = Target->Next;
+			::operator delete(Target);
+		}
+		else
+		{
+			Link = &Target->Next;
+		}
+	}
+
+	Current_ = First_;
+	Offset_ = 0;
+	Used_ = 0;
+}
+
+size_t RpcCallArena::Used() const
+{
+	return Used_;
+}
+
+RpcCallArena::Block * RpcCallArena::NewBlock(size_t Size)
+{
+	auto Target = static_cast<Block *>(::operator new(sizeof(Block) + Size));
+	Target->Next = nullptr;
+	Target->Size = Size;
+
+	return Target;
+}
+
+uint8_t * RpcCallArena::BlockData(Block * Target)
+{
+	return reinterpret_cast<uint8_t *>(Target + 1);
+}
+
+void RpcCallArenaRef::Release()
+{
+	if (!Arena_)
+		return;
+
+	if (--Arena_->References_ == 0)
+	{
+		auto Pool = std::move(Arena_->Pool_);
+		Pool->Release(Arena_);
+	}
+
+	Arena_ = nullptr;
+}
+
+RpcCallArenaPool::RpcCallArenaPool()
+{
+	// Release() never grows it.
+	Free_.reserve(MaxFreeArenas);
+}
+
+RpcCallArenaPool::~RpcCallArenaPool()
+{
+	for (auto Arena : Free_)
+		delete Arena;
+}
+
+RpcCallArenaRef RpcCallArenaPool::Acquire()
+{
+	static thread_local std::shared_ptr<RpcCallArenaPool> Pool = std::make_shared<RpcCallArenaPool>();
+	return Pool->AcquireArena();
+}
+
+RpcCallArenaRef RpcCallArenaPool::AcquireArena()
+{
+	RpcCallArena *Arena = nullptr;
+
+	{
+		std::lock_guard<decltype(Mutex_)> Lock(Mutex_);
+
+		if (!Free_.empty())
+		{
+			Arena = Free_.back();
+			Free_.pop_back();
+		}
+	}
+
+	if (!Arena)
+		Arena = new RpcCallArena();
+
+	Arena->References_ = 1;
+	Arena->Pool_ = shared_from_this();
+
+	return RpcCallArenaRef(Arena);
+}
+
+void RpcCallArenaPool::Release(RpcCallArena * Arena)
+{
+	// Objects of the call may hold references to other arenas, reset before taking the lock.
+	Arena->Reset();
+
+	{
+		std::lock_guard<decltype(Mutex_)> Lock(Mutex_);
+
+		if (Free_.size() < MaxFreeArenas)
+		{
+			Free_.push_back(Arena);
+			return;
+		}
+	}
+
+	delete Arena;
+}
+
+}
@@ -0,0 +1,213 @@
+#pragma once
+
+#include "SRPCBase.h"
+
+namespace SRPC
+{
+
+class RpcCallArenaPool;
+
+//
+// Bump allocator for everything one call needs: decoded arguments, reply buffer, task object.
+// Memory is released all at once when the last RpcCallArenaRef goes away, the arena then goes back
+// to the pool it came from with its first block kept, so a call that fits in it does not allocate.
+// Objects made by New() are destroyed then, in reverse order. Allocate() memory is not initialized.
+//
+
+class RpcCallArena
+{
+public:
+	constexpr static const size_t BlockSize = 0x4000;
+
+	RpcCallArena();
+	~RpcCallArena();
+
+	RpcCallArena(const RpcCallArena&) = delete;
+	RpcCallArena& operator=(const RpcCallArena&) = delete;
+
+	void *Allocate(size_t Size, size_t Alignment);
+
+	template <typename T, typename... TArg>
+	T *New(TArg&&... Args)
+	{
+		auto Entry = static_cast<Finalizer *>(Allocate(sizeof(Finalizer), alignof(Finalizer)));
+		auto Object = new (Allocate(sizeof(T), alignof(T))) T(std::forward<TArg>(Args)...);
+
+		Entry->Destroy = [](void *Pointer) { static_cast<T *>(Pointer)->~T(); };
+		Entry->Object = Object;
+		Entry->Next = Finalizers_;
+		Finalizers_ = Entry;
+
+		return Object;
+	}
+
+	void Reset();
+	size_t Used() const;
+
+private:
+	friend class RpcCallArenaRef;
+	friend class RpcCallArenaPool;
+
+	struct Block
+	{
+		Block *Next;
+		size_t Size;			// Bytes after the header
+	};
+
+	struct Finalizer
+	{
+		void (*Destroy)(void *Object);
+		void *Object;
+		Finalizer *Next;
+	};
+
+	static Block *NewBlock(size_t Size);
+	static uint8_t *BlockData(Block *Target);
+
+	Block *First_;				// Kept by Reset()
+	Block *Current_;
+	size_t Offset_;				// In Current_
+	size_t Used_;
+	Finalizer *Finalizers_;		// Most recent first
+
+	std::atomic<uint32_t> References_;
+	std::shared_ptr<RpcCallArenaPool> Pool_;	// Set while acquired
+};
+
+//
+// Counted reference to an acquired arena, copies share it. Copying does not allocate and moving 
+// does not throw, so a std::function capturing it with a few more words stays in its small buffer
+// (e.g. RpcStreamWriter::ChunkSource of a reply).
+//
+
+class RpcCallArenaRef
+{
+public:
+	RpcCallArenaRef() : Arena_(nullptr)
+	{
+	}
+
+	RpcCallArenaRef(const RpcCallArenaRef& rhs) : Arena_(rhs.Arena_)
+	{
+		if (Arena_)
+			Arena_->References_++;
+	}
+
+	RpcCallArenaRef(RpcCallArenaRef&& rhs) noexcept : Arena_(rhs.Arena_)
+	{
+		rhs.Arena_ = nullptr;
+	}
+
+	~RpcCallArenaRef()
+	{
+		Release();
+	}
+
+	RpcCallArenaRef& operator=(RpcCallArenaRef rhs) noexcept
+	{
+		std::swap(Arena_, rhs.Arena_);
+		return *this;
+	}
+
+	RpcCallArena *operator->() const
+	{
+		return Arena_;
+	}
+
+	RpcCallArena& operator*() const
+	{
+		return *Arena_;
+	}
+
+	explicit operator bool() const
+	{
+		return !!Arena_;
+	}
+
+private:
+	friend class RpcCallArenaPool;
+
+	explicit RpcCallArenaRef(RpcCallArena *Arena) : Arena_(Arena)
+	{
+	}
+
+	void Release();
+
+	RpcCallArena *Arena_;
+};
+
+//
+// Standard allocator over an arena (e.g. for std::allocate_shared), deallocate() does nothing.
+// What it allocated must be destroyed before the arena is released.
+//
+
+template <typename T>
+class RpcCallArenaAllocator
+{
+public:
+	using value_type = T;
+
+	explicit RpcCallArenaAllocator(RpcCallArena& Arena) : Arena_(&Arena)
+	{
+	}
+
+	template <typename U>
+	RpcCallArenaAllocator(const RpcCallArenaAllocator<U>& rhs) : Arena_(rhs.Arena_)
+	{
+	}
+
+	T *allocate(size_t Count)
+	{
+		return static_cast<T *>(Arena_->Allocate(sizeof(T) * Count, alignof(T)));
+	}
+
+	void deallocate(T *Pointer, size_t Count)
+	{
+	}
+
+	template <typename U>
+	bool operator==(const RpcCallArenaAllocator<U>& rhs) const
+	{
+		return Arena_ == rhs.Arena_;
+	}
+
+	template <typename U>
+	bool operator!=(const RpcCallArenaAllocator<U>& rhs) const
+	{
+		return Arena_ != rhs.Arena_;
+	}
+
+private:
+	template <typename U>
+	friend class RpcCallArenaAllocator;
+
+	RpcCallArena *Arena_;
+};
+
+//
+// Free arenas of one thread. Acquire() takes from the pool of the calling thread, an arena goes
+// back to that pool from whichever thread drops the last reference (e.g. the one sending the reply).
+// At most MaxFreeArenas are kept, the pool lives until its thread ended and its arenas came back.
+//
+
+class RpcCallArenaPool : public std::enable_shared_from_this<RpcCallArenaPool>
+{
+public:
+	constexpr static const size_t MaxFreeArenas = 0x10;
+
+	RpcCallArenaPool();
+	~RpcCallArenaPool();
+
+	static RpcCallArenaRef Acquire();
+
+private:
+	friend class RpcCallArenaRef;
+
+	RpcCallArenaRef AcquireArena();
+	void Release(RpcCallArena *Arena);
+
+	std::mutex Mutex_;
+	std::vector<RpcCallArena *> Free_;
+};
+
+}
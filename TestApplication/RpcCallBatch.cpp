@@ -0,0 +1,139 @@
+
+#include "RpcCallBatch.h"
+
+namespace SRPC
+{
+
+RpcCallBatch::RpcCallBatch(uint32_t MaxSize) :
+	MaxSize_(MaxSize),
+	Count_(0)
+{
+	Assert(MaxSize_ > CountSize + EntryHeaderSize);
+
+	Buffer_.reserve(MaxSize_);
+	Clear();
+}
+
+RpcCallBatch::~RpcCallBatch()
+{
+}
+
+bool RpcCallBatch::AppendCall(uint32_t Rsn, uint64_t Id, const uint8_t * Parameters, uint32_t ParametersSize)
+{
+	if (ParametersSize > MaxSize_ || !Fits(sizeof(Id) + ParametersSize))
+		return false;
+
+	uint8_t *Entry = AppendEntry(Rsn, sizeof(Id) + ParametersSize);
+
+	memcpy(Entry, &Id, sizeof(Id));
+	if (ParametersSize)
+		memcpy(Entry + sizeof(Id), Parameters, ParametersSize);
+
+	return true;
+}
+
+bool RpcCallBatch::AppendReturn(uint32_t Rsn, const uint8_t * Body, uint32_t Size)
+{
+	if (!Fits(Size))
+		return false;
+
+	uint8_t *Entry = AppendEntry(Rsn, Size);
+	if (Size)
+		memcpy(Entry, Body, Size);
+
+	return true;
+}
+
+bool RpcCallBatch::Fits(uint32_t BodySize) const
+{
+	return static_cast<uint64_t>(Buffer_.size()) + EntryHeaderSize + BodySize <= MaxSize_;
+}
+
+void RpcCallBatch::Clear()
+{
+	Count_ = 0;
+	Buffer_.assign(CountSize, 0);
+}
+
+uint32_t RpcCallBatch::Count() const
+{
+	return Count_;
+}
+
+uint32_t RpcCallBatch::Size() const
+{
+	return static_cast<uint32_t>(Buffer_.size());
+}
+
+const uint8_t * RpcCallBatch::Data() const
+{
+	return Buffer_.data();
+}
+
+bool RpcCallBatch::Parse(const uint8_t * Body, uint32_t Size, EntryHandler Handler)
+{
+	// Entry bounds are checked against the frame body before dispatch, a malformed batch dispatches nothing.
+	// No batch is sent without entries.
+	if (Size < CountSize)
+		return false;
+
+	uint32_t Count = 0;
+	memcpy(&Count, Body, sizeof(Count));
+
+	if (!Count)
+		return false;
+
+	uint32_t Offset = CountSize;
+
+	for (uint32_t i = 0; i < Count; i++)
+	{
+		if (Size - Offset < EntryHeaderSize)
+			return false;
+
+		uint32_t EntrySize = 0;
+		memcpy(&EntrySize, Body + Offset + sizeof(uint32_t), sizeof(EntrySize));
+		Offset += EntryHeaderSize;
+
+		if (Size - Offset < EntrySize)
+			return false;
+
+		Offset += EntrySize;
+	}
+
+	if (Offset != Size)
+		return false;
+
+	for (Offset = CountSize; Offset < Size;)
+	{
+		uint32_t Rsn = 0;
+		uint32_t EntrySize = 0;
+		memcpy(&Rsn, Body + Offset, sizeof(Rsn));
+		memcpy(&EntrySize, Body + Offset + sizeof(Rsn), sizeof(EntrySize));
+		Offset += EntryHeaderSize;
+
+		if (!Handler(Rsn, Body + Offset, EntrySize))
+			return false;
+
+		Offset += EntrySize;
+	}
+
+	return true;
+}
+
+uint8_t * RpcCallBatch::AppendEntry(uint32_t Rsn, uint32_t Size)
+{
+	size_t Offset = Buffer_.size();
+	Buffer_.resize(Offset + EntryHeaderSize + Size);
+
+	uint8_t *Entry = Buffer_.data() + Offset;
+	memcpy(Entry, &Rsn, sizeof(Rsn));
+	memcpy(Entry + sizeof(Rsn), &Size, sizeof(Size));
+
+	Count_++;
+	memcpy(Buffer_.data(), &Count_, sizeof(Count_));
+
+	return Entry + EntryHeaderSize;
+}
+
+}
+
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "RpcFrame.h"
+
+namespace SRPC
+{
+
+// 
+// Body of a CallBatch frame: Count, then Count entries of { Rsn, Size, Body }.
+// For a request each entry body is a Call body (Id, Parameters); for a response (Response flag)
+// it is a CallReturn body. The whole batch shares one frame header and one digest.
+// 
+
+class RpcCallBatch
+{
+public:
+	constexpr static const uint32_t CountSize = sizeof(uint32_t);
+	constexpr static const uint32_t EntryHeaderSize = sizeof(uint32_t) * 2;
+
+	// Receives one entry. Returns false to stop parsing.
+	using EntryHandler = std::function<bool(uint32_t Rsn, const uint8_t *Body, uint32_t Size)>;
+
+	RpcCallBatch(uint32_t MaxSize);
+	~RpcCallBatch();
+
+	bool AppendCall(uint32_t Rsn, uint64_t Id, const uint8_t *Parameters, uint32_t ParametersSize);
+	bool AppendReturn(uint32_t Rsn, const uint8_t *Body, uint32_t Size);
+
+	bool Fits(uint32_t BodySize) const;
+	void Clear();
+
+	uint32_t Count() const;
+	uint32_t Size() const;
+	const uint8_t *Data() const;
+
+	// Returns false if the batch is malformed (truncated entry, Count not matching Size, no entries),
+	// nothing is dispatched then, or if Handler stopped it.
+	static bool Parse(const uint8_t *Body, uint32_t Size, EntryHandler Handler);
+
+private:
+	uint8_t *AppendEntry(uint32_t Rsn, uint32_t Size);
+
+	uint32_t MaxSize_;
+	uint32_t Count_;
+	std::vector<uint8_t> Buffer_;
+};
+
+}
+
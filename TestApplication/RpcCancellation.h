@@ -0,0 +1,70 @@
+#pragma once
+
+#include "SRPCBase.h"
+#include "RpcCallArena.h"
+
+namespace SRPC
+{
+
+// 
+// Shared cancellation state of a call. Copies refer to the same state,
+// so that a running handler polls what the Cancel frame sets.
+// Deadline is that of the caller (time_point::max() if none).
+// State made in an arena is freed with it, copies must not outlive the arena then.
+// 
+
+class RpcCancellationToken
+{
+public:
+	using Clock = std::chrono::steady_clock;
+
+	RpcCancellationToken() : RpcCancellationToken(Clock::time_point::max())
+	{
+	}
+
+	RpcCancellationToken(Clock::time_point Deadline) :
+		State_(std::make_shared<TokenState>())
+	{
+		State_->Cancelled = false;
+		State_->Deadline = Deadline;
+	}
+
+	RpcCancellationToken(Clock::time_point Deadline, RpcCallArena& Arena) :
+		State_(std::allocate_shared<TokenState>(RpcCallArenaAllocator<TokenState>(Arena)))
+	{
+		State_->Cancelled = false;
+		State_->Deadline = Deadline;
+	}
+
+	bool IsCancelled() const
+	{
+		return State_->Cancelled;
+	}
+
+	void Cancel()
+	{
+		State_->Cancelled = true;
+	}
+
+	Clock::time_point Deadline() const
+	{
+		return State_->Deadline;
+	}
+
+	bool IsExpired() const
+	{
+		return State_->Deadline != Clock::time_point::max() && Clock::now() >= State_->Deadline;
+	}
+
+private:
+	struct TokenState
+	{
+		std::atomic<bool> Cancelled;
+		Clock::time_point Deadline;		// Set once at construction
+	};
+
+	std::shared_ptr<TokenState> State_;
+};
+
+}
+
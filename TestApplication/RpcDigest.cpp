@@ -0,0 +1,317 @@
+
+#include "RpcDigest.h"
+
+#if defined(_M_X64) || defined(_M_IX86)
+#define SRPC_DIGEST_CRC32C_X86
+#include <intrin.h>
+#elif defined(_M_ARM64)
+#define SRPC_DIGEST_CRC32C_ARM64
+#include <arm64_neon.h>
+#endif
+
+namespace SRPC
+{
+
+// 
+// CRC32C (Castagnoli)
+// 
+
+RpcDigestCrc32c::RpcDigestCrc32c() : Crc_(0)
+{
+}
+
+RpcDigestType RpcDigestCrc32c::Type() const
+{
+	return RpcDigestType::Crc32c;
+}
+
+void RpcDigestCrc32c::Reset()
+{
+	Crc_ = 0;
+}
+
+void RpcDigestCrc32c::Update(const uint8_t * Buffer, size_t Size)
+{
+	Crc_ = Compute(Crc_, Buffer, Size);
+}
+
+RpcDigestValue RpcDigestCrc32c::Finalize()
+{
+	RpcDigestValue Value = {};
+	Value.Value[0] = Crc_;
+	return Value;
+}
+
+uint32_t RpcDigestCrc32c::Compute(uint32_t Crc, const uint8_t * Buffer, size_t Size)
+{
+	static const ComputeRoutine Routine = SelectCompute();
+	return Routine(Crc, Buffer, Size);
+}
+
+RpcDigestCrc32c::ComputeRoutine RpcDigestCrc32c::SelectCompute()
+{
+#if defined(SRPC_DIGEST_CRC32C_X86)
+	int Info[4] = {};
+	__cpuid(Info, 1);
+
+	if (Info[2] & (1 << 20)) // SSE4.2
+		return &ComputeHardware;
+
+	return &ComputeSoftware;
+#elif defined(SRPC_DIGEST_CRC32C_ARM64)
+	// CRC32 instructions are mandatory on ARMv8.1 and present on all Windows ARM64 targets.
+	return &ComputeHardware;
+#else
+	return &ComputeSoftware;
+#endif
+}
+
+uint32_t RpcDigestCrc32c::ComputeSoftware(uint32_t Crc, const uint8_t * Buffer, size_t Size)
+{
+	struct Table
+	{
+		uint32_t Entry[0x100];
+
+		Table()
+		{
+			for (uint32_t i = 0; i < 0x100; i++)
+			{
+				uint32_t Value = i;
+				for (int j = 0; j < 8; j++)
+					Value = (Value >> 1) ^ ((Value & 1) ? 0x82f63b78 : 0);
+				Entry[i] = Value;
+			}
+		}
+	};
+
+	static const Table CrcTable;
+
+	Crc = ~Crc;
+
+	for (size_t i = 0; i < Size; i++)
+		Crc = CrcTable.Entry[(Crc ^ Buffer[i]) & 0xff] ^ (Crc >> 8);
+
+	return ~Crc;
+}
+
+uint32_t RpcDigestCrc32c::ComputeHardware(uint32_t Crc, const uint8_t * Buffer, size_t Size)
+{
+#if defined(SRPC_DIGEST_CRC32C_X86) && defined(_M_X64)
+	uint64_t Value = ~Crc;
+
+	for (; Size >= 8; Size -= 8, Buffer += 8)
+	{
+		uint64_t Data;
+		memcpy(&Data, Buffer, sizeof(Data));
+		Value = _mm_crc32_u64(Value, Data);
+	}
+
+	uint32_t Value32 = static_cast<uint32_t>(Value);
+	for (; Size; Size--, Buffer++)
+		Value32 = _mm_crc32_u8(Value32, *Buffer);
+
+	return ~Value32;
+#elif defined(SRPC_DIGEST_CRC32C_X86)
+	uint32_t Value = ~Crc;
+
+	for (; Size >= 4; Size -= 4, Buffer += 4)
+	{
+		uint32_t Data;
+		memcpy(&Data, Buffer, sizeof(Data));
+		Value = _mm_crc32_u32(Value, Data);
+	}
+
+	for (; Size; Size--, Buffer++)
+		Value = _mm_crc32_u8(Value, *Buffer);
+
+	return ~Value;
+#elif defined(SRPC_DIGEST_CRC32C_ARM64)
+	uint32_t Value = ~Crc;
+
+	for (; Size >= 8; Size -= 8, Buffer += 8)
+	{
+		uint64_t Data;
+		memcpy(&Data, Buffer, sizeof(Data));
+		Value = __crc32cd(Value, Data);
+	}
+
+	for (; Size; Size--, Buffer++)
+		Value = __crc32cb(Value, *Buffer);
+
+	return ~Value;
+#else
+	return ComputeSoftware(Crc, Buffer, Size);
+#endif
+}
+
+
+// 
+// 128-bit hash (MurmurHash3 x64/128, streaming)
+// 
+
+RpcDigestHash128::RpcDigestHash128()
+{
+	Reset();
+}
+
+RpcDigestType RpcDigestHash128::Type() const
+{
+	return RpcDigestType::Hash128;
+}
+
+void RpcDigestHash128::Reset()
+{
+	H1_ = 0;
+	H2_ = 0;
+	Length_ = 0;
+	TailSize_ = 0;
+}
+
+void RpcDigestHash128::Update(const uint8_t * Buffer, size_t Size)
+{
+	Length_ += Size;
+
+	if (TailSize_)
+	{
+		size_t Count = std::min<size_t>(sizeof(Tail_) - TailSize_, Size);
+		memcpy(Tail_ + TailSize_, Buffer, Count);
+		TailSize_ += static_cast<uint32_t>(Count);
+		Buffer += Count;
+		Size -= Count;
+
+		if (TailSize_ < sizeof(Tail_))
+			return;
+
+		Block(Tail_);
+		TailSize_ = 0;
+	}
+
+	for (; Size >= sizeof(Tail_); Size -= sizeof(Tail_), Buffer += sizeof(Tail_))
+		Block(Buffer);
+
+	if (Size)
+	{
+		memcpy(Tail_, Buffer, Size);
+		TailSize_ = static_cast<uint32_t>(Size);
+	}
+}
+
+RpcDigestValue RpcDigestHash128::Finalize()
+{
+	uint64_t k1 = 0;
+	uint64_t k2 = 0;
+
+	switch (TailSize_)
+	{
+	case 15: k2 ^= static_cast<uint64_t>(Tail_[14]) << 48;
+	case 14: k2 ^= static_cast<uint64_t>(Tail_[13]) << 40;
+	case 13: k2 ^= static_cast<uint64_t>(Tail_[12]) << 32;
+	case 12: k2 ^= static_cast<uint64_t>(Tail_[11]) << 24;
+	case 11: k2 ^= static_cast<uint64_t>(Tail_[10]) << 16;
+	case 10: k2 ^= static_cast<uint64_t>(Tail_[9]) << 8;
+	case 9:  k2 ^= static_cast<uint64_t>(Tail_[8]);
+		k2 *= Hash128C2; k2 = Rotl64(k2, 33); k2 *= Hash128C1; H2_ ^= k2;
+
+	case 8:  k1 ^= static_cast<uint64_t>(Tail_[7]) << 56;
+	case 7:  k1 ^= static_cast<uint64_t>(Tail_[6]) << 48;
+	case 6:  k1 ^= static_cast<uint64_t>(Tail_[5]) << 40;
+	case 5:  k1 ^= static_cast<uint64_t>(Tail_[4]) << 32;
+	case 4:  k1 ^= static_cast<uint64_t>(Tail_[3]) << 24;
+	case 3:  k1 ^= static_cast<uint64_t>(Tail_[2]) << 16;
+	case 2:  k1 ^= static_cast<uint64_t>(Tail_[1]) << 8;
+	case 1:  k1 ^= static_cast<uint64_t>(Tail_[0]);
+		k1 *= Hash128C1; k1 = Rotl64(k1, 31); k1 *= Hash128C2; H1_ ^= k1;
+	}
+
+	uint64_t h1 = H1_ ^ Length_;
+	uint64_t h2 = H2_ ^ Length_;
+
+	h1 += h2;
+	h2 += h1;
+
+	h1 = Mix64(h1);
+	h2 = Mix64(h2);
+
+	h1 += h2;
+	h2 += h1;
+
+	RpcDigestValue Value;
+	Value.Value[0] = static_cast<uint32_t>(h1);
+	Value.Value[1] = static_cast<uint32_t>(h1 >> 0x20);
+	Value.Value[2] = static_cast<uint32_t>(h2);
+	Value.Value[3] = static_cast<uint32_t>(h2 >> 0x20);
+
+	return Value;
+}
+
+uint64_t RpcDigestHash128::Rotl64(uint64_t Value, int Shift)
+{
+	return (Value << Shift) | (Value >> (64 - Shift));
+}
+
+uint64_t RpcDigestHash128::Load64(const uint8_t * p)
+{
+	// Little-endian load
+	return
+		(static_cast<uint64_t>(p[7]) << 0x38) |
+		(static_cast<uint64_t>(p[6]) << 0x30) |
+		(static_cast<uint64_t>(p[5]) << 0x28) |
+		(static_cast<uint64_t>(p[4]) << 0x20) |
+		(static_cast<uint64_t>(p[3]) << 0x18) |
+		(static_cast<uint64_t>(p[2]) << 0x10) |
+		(static_cast<uint64_t>(p[1]) << 0x08) |
+		p[0];
+}
+
+uint64_t RpcDigestHash128::Mix64(uint64_t k)
+{
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdull;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ull;
+	k ^= k >> 33;
+	return k;
+}
+
+void RpcDigestHash128::Block(const uint8_t * Block)
+{
+	uint64_t k1 = Load64(Block);
+	uint64_t k2 = Load64(Block + 8);
+
+	k1 *= Hash128C1; k1 = Rotl64(k1, 31); k1 *= Hash128C2; H1_ ^= k1;
+	H1_ = Rotl64(H1_, 27); H1_ += H2_; H1_ = H1_ * 5 + 0x52dce729;
+
+	k2 *= Hash128C2; k2 = Rotl64(k2, 33); k2 *= Hash128C1; H2_ ^= k2;
+	H2_ = Rotl64(H2_, 31); H2_ += H1_; H2_ = H2_ * 5 + 0x38495ab5;
+}
+
+
+// 
+// Digest engine set
+// 
+
+RpcDigestEngine * RpcDigestSet::Select(RpcDigestType Type)
+{
+	switch (Type)
+	{
+	case RpcDigestType::Crc32c:
+		return &Crc32c_;
+	case RpcDigestType::Hash128:
+		return &Hash128_;
+	}
+
+	return nullptr;
+}
+
+bool RpcDigestSet::IsAccepted(uint32_t AcceptMask, RpcDigestType Type)
+{
+	return !!(AcceptMask & AcceptMaskOf(Type));
+}
+
+uint32_t RpcDigestSet::AcceptMaskOf(RpcDigestType Type)
+{
+	return 1u << static_cast<uint32_t>(Type);
+}
+
+}
+
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "SRPCBase.h"
+
+namespace SRPC
+{
+
+enum class RpcDigestType : uint16_t
+{
+	None = 0,		// No digest (trusted link)
+	Crc32c,			// CRC32C in Digest0
+	Hash128,		// 128-bit non-cryptographic hash (MurmurHash3 x64/128)
+	DigestTypeMax,
+};
+
+struct RpcDigestValue
+{
+	uint32_t Value[4];	// Digest0..Digest3
+};
+
+class RpcDigestEngine
+{
+public:
+	virtual RpcDigestType Type() const = 0;
+	virtual void Reset() = 0;
+	virtual void Update(const uint8_t *Buffer, size_t Size) = 0;
+	virtual RpcDigestValue Finalize() = 0;
+
+	virtual ~RpcDigestEngine() { }
+};
+
+class RpcDigestCrc32c : public RpcDigestEngine
+{
+public:
+	RpcDigestCrc32c();
+
+	RpcDigestType Type() const;
+	void Reset();
+	void Update(const uint8_t *Buffer, size_t Size);
+	RpcDigestValue Finalize();
+
+	static uint32_t Compute(uint32_t Crc, const uint8_t *Buffer, size_t Size);
+	// Table driven, what Compute() falls back to without CRC instructions.
+	static uint32_t ComputeSoftware(uint32_t Crc, const uint8_t *Buffer, size_t Size);
+
+private:
+	using ComputeRoutine = uint32_t(*)(uint32_t Crc, const uint8_t *Buffer, size_t Size);
+
+	static ComputeRoutine SelectCompute();
+	static uint32_t ComputeHardware(uint32_t Crc, const uint8_t *Buffer, size_t Size);
+
+	uint32_t Crc_;
+};
+
+class RpcDigestHash128 : public RpcDigestEngine
+{
+public:
+	RpcDigestHash128();
+
+	RpcDigestType Type() const;
+	void Reset();
+	void Update(const uint8_t *Buffer, size_t Size);
+	RpcDigestValue Finalize();
+
+private:
+	constexpr static const uint64_t Hash128C1 = 0x87c37b91114253d5ull;
+	constexpr static const uint64_t Hash128C2 = 0x4cf5ad432745937full;
+
+	static uint64_t Rotl64(uint64_t Value, int Shift);
+	static uint64_t Load64(const uint8_t *p);
+	static uint64_t Mix64(uint64_t k);
+
+	void Block(const uint8_t *Block);
+
+	uint64_t H1_;
+	uint64_t H2_;
+	uint64_t Length_;
+	uint8_t Tail_[16];		// Partial block
+	uint32_t TailSize_;
+};
+
+// Holds all digest engines so that selecting one needs no allocation.
+class RpcDigestSet
+{
+public:
+	RpcDigestEngine *Select(RpcDigestType Type);
+
+	static bool IsAccepted(uint32_t AcceptMask, RpcDigestType Type);
+	static uint32_t AcceptMaskOf(RpcDigestType Type);
+
+private:
+	RpcDigestCrc32c Crc32c_;
+	RpcDigestHash128 Hash128_;
+};
+
+}
+
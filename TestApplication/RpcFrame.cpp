@@ -0,0 +1,280 @@
+
+#include "RpcFrame.h"
+
+#if defined(_M_X64) || defined(_M_IX86)
+#define SRPC_FRAME_SIMD_X86
+#include <intrin.h>
+#endif
+
+namespace SRPC
+{
+
+constexpr const uint8_t RpcFrame::Magic[4];
+constexpr const uint8_t RpcFrameHeaderLayout::MagicBytes[4];
+
+void RpcFrame::InitializeHeader(RpcFrameHeader & Header, RpcFrameType Type, uint32_t Rsn, bool Response, bool EoR)
+{
+	memset(&Header, 0, sizeof(Header));
+	memcpy(Header.Magic, Magic, sizeof(Header.Magic));
+
+	Header.Type = static_cast<uint16_t>(Type);
+	Header.Rsn = Rsn;
+	Header.u.Bitfields.Response = Response ? 1 : 0;
+	Header.u.Bitfields.EoR = EoR ? 1 : 0;
+}
+
+size_t RpcFrame::WriteHeader(const RpcFrameHeader & Header, uint8_t * Buffer, size_t Size)
+{
+	if (!RpcFrameCodec::WideCopy)
+		return WriteHeaderPortable(Header, Buffer, Size);
+
+	if (Size < HeaderSize)
+		return 0;
+
+	RpcFrameCodec::Encode(Header, Buffer);
+
+	return HeaderSize;
+}
+
+size_t RpcFrame::ReadHeader(RpcFrameHeader & Header, const uint8_t * Buffer, size_t Size)
+{
+	if (!RpcFrameCodec::WideCopy)
+		return ReadHeaderPortable(Header, Buffer, Size);
+
+	if (Size < HeaderSize)
+		return 0;
+
+	RpcFrameCodec::Decode(Header, Buffer);
+
+	return HeaderSize;
+}
+
+size_t RpcFrame::WriteHeaderPortable(const RpcFrameHeader & Header, uint8_t * Buffer, size_t Size)
+{
+	if (Size < HeaderSize)
+		return 0;
+
+	ByteStream Stream(Buffer, Size);
+
+	size_t SizeWritten =
+		Stream.Write1(Header.Magic[0]) +
+		Stream.Write1(Header.Magic[1]) +
+		Stream.Write1(Header.Magic[2]) +
+		Stream.Write1(Header.Magic[3]) +
+		Stream.Write4(Header.Digest0) +
+		Stream.Write8(Header.Fsn) +
+		Stream.Write4(Header.Digest1) +
+		Stream.Write4(Header.Rsn) +
+		Stream.Write4(Header.Digest2) +
+		Stream.Write2(Header.Type) +
+		Stream.Write2(Header.u.Flags) +
+		Stream.Write4(Header.Digest3) +
+		Stream.Write4(Header.Length);
+
+	Assert(SizeWritten == HeaderSize);
+
+	return SizeWritten;
+}
+
+size_t RpcFrame::ReadHeaderPortable(RpcFrameHeader & Header, const uint8_t * Buffer, size_t Size)
+{
+	if (Size < HeaderSize)
+		return 0;
+
+	ByteStream Stream(const_cast<uint8_t *>(Buffer), Size);
+
+	size_t SizeRead =
+		Stream.Read1(&Header.Magic[0]) +
+		Stream.Read1(&Header.Magic[1]) +
+		Stream.Read1(&Header.Magic[2]) +
+		Stream.Read1(&Header.Magic[3]) +
+		Stream.Read4(&Header.Digest0) +
+		Stream.Read8(&Header.Fsn) +
+		Stream.Read4(&Header.Digest1) +
+		Stream.Read4(&Header.Rsn) +
+		Stream.Read4(&Header.Digest2) +
+		Stream.Read2(&Header.Type) +
+		Stream.Read2(&Header.u.Flags) +
+		Stream.Read4(&Header.Digest3) +
+		Stream.Read4(&Header.Length);
+
+	Assert(SizeRead == HeaderSize);
+
+	return SizeRead;
+}
+
+bool RpcFrame::IsValidMagic(const RpcFrameHeader & Header)
+{
+	return !memcmp(Header.Magic, Magic, sizeof(Header.Magic));
+}
+
+bool RpcFrame::IsValidType(uint16_t Type)
+{
+	return Type < 32 && !!((RpcFrameHeaderLayout::ValidTypeMask >> Type) & 1);
+}
+
+bool RpcFrame::IsValidHeader(const RpcFrameHeader & Header, uint32_t MaxBodySize)
+{
+	return RpcFrameCodec::Validate(Header, MaxBodySize);
+}
+
+void RpcFrame::UpdateDigestHeader(RpcDigestEngine * Engine, const RpcFrameHeader & Header)
+{
+	RpcFrameHeader DigestHeader = Header;
+	DigestHeader.Digest0 = 0;
+	DigestHeader.Digest1 = 0;
+	DigestHeader.Digest2 = 0;
+	DigestHeader.Digest3 = 0;
+
+	uint8_t Buffer[HeaderSize];
+	WriteHeader(DigestHeader, Buffer, sizeof(Buffer));
+
+	Engine->Update(Buffer, sizeof(Buffer));
+}
+
+void RpcFrame::SetDigest(RpcFrameHeader & Header, const RpcDigestValue & Value)
+{
+	Header.Digest0 = Value.Value[0];
+	Header.Digest1 = Value.Value[1];
+	Header.Digest2 = Value.Value[2];
+	Header.Digest3 = Value.Value[3];
+}
+
+bool RpcFrame::MatchDigest(const RpcFrameHeader & Header, const RpcDigestValue & Value)
+{
+	return
+		Header.Digest0 == Value.Value[0] &&
+		Header.Digest1 == Value.Value[1] &&
+		Header.Digest2 == Value.Value[2] &&
+		Header.Digest3 == Value.Value[3];
+}
+
+size_t RpcFrame::FindMagic(const uint8_t * Buffer, size_t Size)
+{
+	static const FindMagicRoutine Routine = SelectFindMagic();
+	return Routine(Buffer, Size);
+}
+
+RpcFrame::FindMagicRoutine RpcFrame::SelectFindMagic()
+{
+#ifdef SRPC_FRAME_SIMD_X86
+	int Info[4] = {};
+
+	__cpuid(Info, 0);
+	int MaxLeaf = Info[0];
+
+	__cpuid(Info, 1);
+	bool OsXSave = !!(Info[2] & (1 << 27));
+	bool Avx = !!(Info[2] & (1 << 28));
+
+	if (MaxLeaf >= 7 && OsXSave && Avx)
+	{
+		// OS must save YMM state.
+		if ((_xgetbv(0) & 0x06) == 0x06)
+		{
+			__cpuidex(Info, 7, 0);
+			if (Info[1] & (1 << 5))
+				return &FindMagicAVX2;
+		}
+	}
+
+	return &FindMagicSSE2;
+#else
+	return &FindMagicScalar;
+#endif
+}
+
+size_t RpcFrame::FindMagicScalar(const uint8_t * Buffer, size_t Size)
+{
+	if (Size < sizeof(Magic))
+		return Size;
+
+	const uint8_t *Start = Buffer;
+	const uint8_t *Last = Buffer + Size - sizeof(Magic);
+
+	while (Start <= Last)
+	{
+		auto Found = static_cast<const uint8_t *>(memchr(Start, Magic[0], Last - Start + 1));
+		if (!Found)
+			break;
+
+		if (Found[1] == Magic[1] && Found[2] == Magic[2] && Found[3] == Magic[3])
+			return Found - Buffer;
+
+		Start = Found + 1;
+	}
+
+	return Size;
+}
+
+size_t RpcFrame::FindMagicSSE2(const uint8_t * Buffer, size_t Size)
+{
+#ifdef SRPC_FRAME_SIMD_X86
+	const __m128i Magic0 = _mm_set1_epi8(static_cast<char>(Magic[0]));
+	const __m128i Magic1 = _mm_set1_epi8(static_cast<char>(Magic[1]));
+	const __m128i Magic2 = _mm_set1_epi8(static_cast<char>(Magic[2]));
+	const __m128i Magic3 = _mm_set1_epi8(static_cast<char>(Magic[3]));
+
+	size_t Offset = 0;
+
+	// Compare 16 positions at once; each lane checks 4 bytes starting at that position.
+	for (; Offset + 16 + sizeof(Magic) - 1 <= Size; Offset += 16)
+	{
+		const uint8_t *p = Buffer + Offset;
+
+		__m128i Match = _mm_and_si128(
+			_mm_and_si128(
+				_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 0)), Magic0),
+				_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 1)), Magic1)),
+			_mm_and_si128(
+				_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 2)), Magic2),
+				_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 3)), Magic3)));
+
+		unsigned long Mask = static_cast<unsigned long>(_mm_movemask_epi8(Match));
+		unsigned long Index = 0;
+		if (_BitScanForward(&Index, Mask))
+			return Offset + Index;
+	}
+
+	return Offset + FindMagicScalar(Buffer + Offset, Size - Offset);
+#else
+	return FindMagicScalar(Buffer, Size);
+#endif
+}
+
+size_t RpcFrame::FindMagicAVX2(const uint8_t * Buffer, size_t Size)
+{
+#ifdef SRPC_FRAME_SIMD_X86
+	const __m256i Magic0 = _mm256_set1_epi8(static_cast<char>(Magic[0]));
+	const __m256i Magic1 = _mm256_set1_epi8(static_cast<char>(Magic[1]));
+	const __m256i Magic2 = _mm256_set1_epi8(static_cast<char>(Magic[2]));
+	const __m256i Magic3 = _mm256_set1_epi8(static_cast<char>(Magic[3]));
+
+	size_t Offset = 0;
+
+	for (; Offset + 32 + sizeof(Magic) - 1 <= Size; Offset += 32)
+	{
+		const uint8_t *p = Buffer + Offset;
+
+		__m256i Match = _mm256_and_si256(
+			_mm256_and_si256(
+				_mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 0)), Magic0),
+				_mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 1)), Magic1)),
+			_mm256_and_si256(
+				_mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 2)), Magic2),
+				_mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 3)), Magic3)));
+
+		unsigned long Mask = static_cast<unsigned long>(static_cast<uint32_t>(_mm256_movemask_epi8(Match)));
+		unsigned long Index = 0;
+		if (_BitScanForward(&Index, Mask))
+			return Offset + Index;
+	}
+
+	// Remaining tail is shorter than one AVX2 block.
+	return Offset + FindMagicSSE2(Buffer + Offset, Size - Offset);
+#else
+	return FindMagicScalar(Buffer, Size);
+#endif
+}
+
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "Rpc.h"
+#include "ByteStream.h"
+#include "RpcDigest.h"
+#include "RpcFrameCodec.h"
+
+namespace SRPC
+{
+
+struct RpcFrameSegment
+{
+	const uint8_t *Pointer;
+	uint32_t Size;
+};
+
+class RpcFrame
+{
+public:
+	constexpr static const size_t HeaderSize = sizeof(RpcFrameHeader);
+	constexpr static const uint8_t Magic[4] = { 0x1a, 0xa5, 0xfa, 0x71 };
+
+	static void InitializeHeader(RpcFrameHeader& Header, RpcFrameType Type, uint32_t Rsn, bool Response, bool EoR);
+
+	// Header serialization (little-endian wire order)
+	static size_t WriteHeader(const RpcFrameHeader& Header, uint8_t *Buffer, size_t Size);
+	static size_t ReadHeader(RpcFrameHeader& Header, const uint8_t *Buffer, size_t Size);
+
+	// Field by field serialization for big-endian hosts
+	static size_t WriteHeaderPortable(const RpcFrameHeader& Header, uint8_t *Buffer, size_t Size);
+	static size_t ReadHeaderPortable(RpcFrameHeader& Header, const uint8_t *Buffer, size_t Size);
+
+	static bool IsValidMagic(const RpcFrameHeader& Header);
+	static bool IsValidType(uint16_t Type);
+	static bool IsValidHeader(const RpcFrameHeader& Header, uint32_t MaxBodySize);
+
+	// Digest covers header (with digest fields zeroed) followed by body.
+	static void UpdateDigestHeader(RpcDigestEngine *Engine, const RpcFrameHeader& Header);
+	static void SetDigest(RpcFrameHeader& Header, const RpcDigestValue& Value);
+	static bool MatchDigest(const RpcFrameHeader& Header, const RpcDigestValue& Value);
+
+	// Returns offset of first { 1a a5 fa 71 } sequence in Buffer, or Size if not found.
+	static size_t FindMagic(const uint8_t *Buffer, size_t Size);
+
+private:
+	using FindMagicRoutine = size_t(*)(const uint8_t *Buffer, size_t Size);
+
+	static FindMagicRoutine SelectFindMagic();
+	static size_t FindMagicScalar(const uint8_t *Buffer, size_t Size);
+	static size_t FindMagicSSE2(const uint8_t *Buffer, size_t Size);
+	static size_t FindMagicAVX2(const uint8_t *Buffer, size_t Size);
+};
+
+}
+
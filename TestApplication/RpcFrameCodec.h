@@ -0,0 +1,111 @@
+#pragma once
+
+#include "Rpc.h"
+#include "RpcDigest.h"
+
+#include <cstddef>
+
+namespace SRPC
+{
+
+struct RpcFrameFieldLayout
+{
+	uint32_t Offset;	// Offset in wire header
+	uint32_t Size;		// Size in bytes
+};
+
+// 
+// Wire layout of RpcFrameHeader (all fields little-endian).
+// 
+
+struct RpcFrameHeaderLayout
+{
+	constexpr static const RpcFrameFieldLayout Magic	= { 0x00, 4 };
+	constexpr static const RpcFrameFieldLayout Digest0	= { 0x04, 4 };
+	constexpr static const RpcFrameFieldLayout Fsn		= { 0x08, 8 };
+	constexpr static const RpcFrameFieldLayout Digest1	= { 0x10, 4 };
+	constexpr static const RpcFrameFieldLayout Rsn		= { 0x14, 4 };
+	constexpr static const RpcFrameFieldLayout Digest2	= { 0x18, 4 };
+	constexpr static const RpcFrameFieldLayout Type		= { 0x1c, 2 };
+	constexpr static const RpcFrameFieldLayout Flags	= { 0x1e, 2 };
+	constexpr static const RpcFrameFieldLayout Digest3	= { 0x20, 4 };
+	constexpr static const RpcFrameFieldLayout Length	= { 0x24, 4 };
+
+	constexpr static const uint32_t Size = 0x28;
+
+	// Magic byte sequence, compared as bytes so the check does not depend on host byte order
+	constexpr static const uint8_t MagicBytes[4] = { 0x1a, 0xa5, 0xfa, 0x71 };
+
+	// Flags: [0] Response, [1] EoR, [3:2] Digest, [4] Deadline, [5] Schema, [6] Compact, [15:7] Reserved
+	constexpr static const uint16_t FlagsResponse = 0x0001;
+	constexpr static const uint16_t FlagsEoR = 0x0002;
+	constexpr static const uint16_t FlagsDeadline = 0x0010;
+	constexpr static const uint16_t FlagsSchema = 0x0020;
+	constexpr static const uint16_t FlagsCompact = 0x0040;
+	constexpr static const uint16_t FlagsDigestShift = 2;
+	constexpr static const uint16_t FlagsDigestMask = 0x0003;
+	constexpr static const uint16_t FlagsReservedMask = 0xff80;
+
+	// Bit (1 << RpcFrameType) set for each valid frame type
+	constexpr static const uint32_t ValidTypeMask =
+		(1u << static_cast<uint32_t>(RpcFrameType::Register)) |
+		(1u << static_cast<uint32_t>(RpcFrameType::Unregister)) |
+		(1u << static_cast<uint32_t>(RpcFrameType::Call)) |
+		(1u << static_cast<uint32_t>(RpcFrameType::Cancel)) |
+		(1u << static_cast<uint32_t>(RpcFrameType::CallReturn)) |
+		(1u << static_cast<uint32_t>(RpcFrameType::CallBatch)) |
+		(1u << static_cast<uint32_t>(RpcFrameType::Credit)) |
+		(1u << static_cast<uint32_t>(RpcFrameType::Ping)) |
+		(1u << static_cast<uint32_t>(RpcFrameType::Settings));
+};
+
+// Wire layout must match in-memory layout for the wide load/store path.
+static_assert(sizeof(RpcFrameHeader) == RpcFrameHeaderLayout::Size, "RpcFrameHeader size mismatch !!");
+static_assert(offsetof(RpcFrameHeader, Magic) == RpcFrameHeaderLayout::Magic.Offset, "Magic offset mismatch !!");
+static_assert(offsetof(RpcFrameHeader, Digest0) == RpcFrameHeaderLayout::Digest0.Offset, "Digest0 offset mismatch !!");
+static_assert(offsetof(RpcFrameHeader, Fsn) == RpcFrameHeaderLayout::Fsn.Offset, "Fsn offset mismatch !!");
+static_assert(offsetof(RpcFrameHeader, Digest1) == RpcFrameHeaderLayout::Digest1.Offset, "Digest1 offset mismatch !!");
+static_assert(offsetof(RpcFrameHeader, Rsn) == RpcFrameHeaderLayout::Rsn.Offset, "Rsn offset mismatch !!");
+static_assert(offsetof(RpcFrameHeader, Digest2) == RpcFrameHeaderLayout::Digest2.Offset, "Digest2 offset mismatch !!");
+static_assert(offsetof(RpcFrameHeader, Type) == RpcFrameHeaderLayout::Type.Offset, "Type offset mismatch !!");
+static_assert(offsetof(RpcFrameHeader, u) == RpcFrameHeaderLayout::Flags.Offset, "Flags offset mismatch !!");
+static_assert(offsetof(RpcFrameHeader, Digest3) == RpcFrameHeaderLayout::Digest3.Offset, "Digest3 offset mismatch !!");
+static_assert(offsetof(RpcFrameHeader, Length) == RpcFrameHeaderLayout::Length.Offset, "Length offset mismatch !!");
+static_assert(static_cast<uint32_t>(RpcDigestType::DigestTypeMax) <= RpcFrameHeaderLayout::FlagsDigestMask + 1, "Digest flags too narrow !!");
+
+class RpcFrameCodec
+{
+public:
+	constexpr static const bool WideCopy = (SRPC_LITTLE_ENDIAN != 0);
+
+	// Buffer must have at least RpcFrameHeaderLayout::Size bytes.
+	static inline void Encode(const RpcFrameHeader& Header, uint8_t *Buffer)
+	{
+		// In-memory layout equals wire layout on little-endian hosts.
+		memcpy(Buffer, &Header, RpcFrameHeaderLayout::Size);
+	}
+
+	static inline void Decode(RpcFrameHeader& Header, const uint8_t *Buffer)
+	{
+		memcpy(&Header, Buffer, RpcFrameHeaderLayout::Size);
+	}
+
+	static inline bool Validate(const RpcFrameHeader& Header, uint32_t MaxBodySize)
+	{
+		// All checks combined without short-circuit branches.
+		uint32_t Type = Header.Type;
+		uint32_t Flags = Header.u.Flags;
+		uint32_t Digest = (Flags >> RpcFrameHeaderLayout::FlagsDigestShift) & RpcFrameHeaderLayout::FlagsDigestMask;
+
+		return
+			(memcmp(Header.Magic, RpcFrameHeaderLayout::MagicBytes, sizeof(Header.Magic)) == 0) &
+			(Type < 32) &
+			static_cast<bool>((RpcFrameHeaderLayout::ValidTypeMask >> (Type & 31)) & 1) &
+			((Flags & RpcFrameHeaderLayout::FlagsReservedMask) == 0) &
+			(Digest < static_cast<uint32_t>(RpcDigestType::DigestTypeMax)) &
+			(Header.Length <= MaxBodySize);
+	}
+};
+
+}
+
@@ -0,0 +1,361 @@
+
+#include "RpcFrameParser.h"
+
+namespace SRPC
+{
+
+RpcFrameParser::RpcFrameParser(uint32_t MaxBodySize, FrameHandler Handler) :
+	MaxBodySize_(MaxBodySize),
+	Handler_(Handler),
+	State_(RpcFrameParserState::Header),
+	Header_{},
+	HeaderBytes_{},
+	HeaderReceived_(0),
+	FramesParsed_(0),
+	ResyncCount_(0),
+	BytesSkipped_(0),
+	FramesDropped_(0),
+	Digest_(nullptr),
+	DigestAcceptMask_(~0u),
+	BodyDigested_(0),
+	BodyVerified_(false),
+	DigestErrors_(0)
+{
+}
+
+RpcFrameParser::~RpcFrameParser()
+{
+}
+
+uint32_t RpcFrameParser::Parse(const RpcFrameSegment * Segments, uint32_t SegmentsCount)
+{
+	// 
+	// Returns bytes consumed.
+	// Parsing stops at incomplete body or incomplete candidate header.
+	// 
+
+	uint32_t Consumed = 0;
+	uint32_t Available = 0;
+	for (uint32_t i = 0; i < SegmentsCount; i++)
+		Available += Segments[i].Size;
+
+	uint32_t SegmentIndex = 0;
+	uint32_t SegmentOffset = 0;
+
+	auto Advance = [&](uint32_t Count)
+	{
+		Consumed += Count;
+		SegmentOffset += Count;
+
+		while (SegmentIndex < SegmentsCount && SegmentOffset >= Segments[SegmentIndex].Size)
+		{
+			SegmentOffset -= Segments[SegmentIndex].Size;
+			SegmentIndex++;
+		}
+	};
+
+	auto CopyInput = [&](uint8_t *Buffer, uint32_t Count)
+	{
+		// Copy bytes at current position (may cross segment boundary).
+		uint32_t Index = SegmentIndex;
+		uint32_t Offset = SegmentOffset;
+
+		while (Count)
+		{
+			Assert(Index < SegmentsCount);
+
+			uint32_t Length = std::min<uint32_t>(Count, Segments[Index].Size - Offset);
+			memcpy(Buffer, Segments[Index].Pointer + Offset, Length);
+
+			Buffer += Length;
+			Count -= Length;
+			Offset = 0;
+			Index++;
+		}
+	};
+
+	// Skip leading empty segments.
+	Advance(0);
+
+	while (true)
+	{
+		if (State_ == RpcFrameParserState::Resync)
+		{
+			uint32_t Remaining = Available - Consumed;
+			if (Remaining < sizeof(RpcFrame::Magic))
+				break;
+
+			const uint8_t *Pointer = Segments[SegmentIndex].Pointer + SegmentOffset;
+			uint32_t Contiguous = Segments[SegmentIndex].Size - SegmentOffset;
+			uint32_t Skip = 0;
+			bool Candidate = false;
+
+			if (Contiguous >= sizeof(RpcFrame::Magic))
+			{
+				size_t Found = RpcFrame::FindMagic(Pointer, Contiguous);
+				if (Found < Contiguous)
+				{
+					Skip = static_cast<uint32_t>(Found);
+					Candidate = true;
+				}
+				else
+				{
+					// Last bytes may be start of magic which continues in next segment.
+					Skip = Contiguous - static_cast<uint32_t>(sizeof(RpcFrame::Magic) - 1);
+				}
+			}
+			else
+			{
+				// Magic may straddle segment boundary.
+				uint8_t Bytes[sizeof(RpcFrame::Magic)];
+				CopyInput(Bytes, sizeof(Bytes));
+				Candidate = !memcmp(Bytes, RpcFrame::Magic, sizeof(Bytes));
+				Skip = Candidate ? 0 : 1;
+			}
+
+			Advance(Skip);
+			BytesSkipped_ += Skip;
+
+			if (!Candidate)
+				continue;
+
+			// Validate candidate header before resuming.
+			if (Available - Consumed < RpcFrame::HeaderSize)
+				break; // Wait for complete candidate header.
+
+			uint8_t Bytes[RpcFrame::HeaderSize];
+			CopyInput(Bytes, sizeof(Bytes));
+			RpcFrame::ReadHeader(Header_, Bytes, sizeof(Bytes));
+
+			if (!RpcFrame::IsValidHeader(Header_, MaxBodySize_))
+			{
+				Advance(1);
+				BytesSkipped_++;
+				continue;
+			}
+
+			Trace("Frame resynchronized [Fsn %llu, %llu bytes skipped]\n", Header_.Fsn, BytesSkipped_);
+
+			ResyncCount_++;
+			State_ = RpcFrameParserState::Header;
+			HeaderReceived_ = 0;
+		}
+
+		if (State_ == RpcFrameParserState::Header)
+		{
+			if (Consumed == Available)
+				break;
+
+			const uint8_t *Pointer = Segments[SegmentIndex].Pointer + SegmentOffset;
+			uint32_t Contiguous = Segments[SegmentIndex].Size - SegmentOffset;
+
+			if (!HeaderReceived_ && Contiguous >= RpcFrame::HeaderSize)
+			{
+				// Fast path: whole header is contiguous.
+				RpcFrame::ReadHeader(Header_, Pointer, RpcFrame::HeaderSize);
+
+				if (!ValidateHeader())
+				{
+					// Rescan from next byte, header bytes may contain next frame.
+					Advance(1);
+					BytesSkipped_++;
+					State_ = RpcFrameParserState::Resync;
+					continue;
+				}
+
+				Advance(static_cast<uint32_t>(RpcFrame::HeaderSize));
+			}
+			else
+			{
+				uint32_t Count = std::min<uint32_t>(
+					static_cast<uint32_t>(RpcFrame::HeaderSize) - HeaderReceived_, Contiguous);
+
+				memcpy(HeaderBytes_ + HeaderReceived_, Pointer, Count);
+				HeaderReceived_ += Count;
+				Advance(Count);
+
+				if (HeaderReceived_ < RpcFrame::HeaderSize)
+					continue;
+
+				RpcFrame::ReadHeader(Header_, HeaderBytes_, sizeof(HeaderBytes_));
+				HeaderReceived_ = 0;
+
+				if (!ValidateHeader())
+				{
+					// Header bytes are already consumed, rescan from current position.
+					State_ = RpcFrameParserState::Resync;
+					continue;
+				}
+			}
+
+			State_ = RpcFrameParserState::Body;
+
+			Digest_ = Digests_.Select(static_cast<RpcDigestType>(Header_.u.Bitfields.Digest));
+			if (Digest_)
+			{
+				Digest_->Reset();
+				RpcFrame::UpdateDigestHeader(Digest_, Header_);
+			}
+
+			BodyDigested_ = 0;
+			BodyVerified_ = !Digest_;
+		}
+
+		if (State_ == RpcFrameParserState::Body)
+		{
+			uint32_t BodyAvailable = std::min<uint32_t>(Available - Consumed, Header_.Length);
+
+			if (!BodyVerified_ && BodyDigested_ < BodyAvailable)
+			{
+				// 
+				// Digest body bytes as they arrive, so that verification is done
+				// in this pass while data is still hot in cache (no second walk on completion).
+				// 
+
+				uint32_t Index = SegmentIndex;
+				uint32_t Offset = SegmentOffset + BodyDigested_;
+				uint32_t Remaining = BodyAvailable - BodyDigested_;
+
+				while (Index < SegmentsCount && Offset >= Segments[Index].Size)
+				{
+					Offset -= Segments[Index].Size;
+					Index++;
+				}
+
+				while (Remaining)
+				{
+					Assert(Index < SegmentsCount);
+
+					uint32_t Count = std::min<uint32_t>(Remaining, Segments[Index].Size - Offset);
+					Digest_->Update(Segments[Index].Pointer + Offset, Count);
+
+					Remaining -= Count;
+					Offset = 0;
+					Index++;
+				}
+
+				BodyDigested_ = BodyAvailable;
+			}
+
+			if (Available - Consumed < Header_.Length)
+				break; // Body incomplete, leave it in the input.
+
+			if (!BodyVerified_)
+			{
+				if (!RpcFrame::MatchDigest(Header_, Digest_->Finalize()))
+				{
+					// Drop the corrupted frame.
+					Trace("!! Frame digest mismatch [Fsn %llu, Rsn %u]\n", Header_.Fsn, Header_.Rsn);
+
+					Advance(Header_.Length);
+					DigestErrors_++;
+
+					State_ = RpcFrameParserState::Header;
+					continue;
+				}
+
+				BodyVerified_ = true;
+			}
+
+			RpcFrameSegment Body[2] = {};
+			uint32_t BodyCount = 0;
+			uint32_t Remaining = Header_.Length;
+			uint32_t Index = SegmentIndex;
+			uint32_t Offset = SegmentOffset;
+
+			while (Remaining)
+			{
+				Assert(Index < SegmentsCount && BodyCount < std::size(Body));
+
+				uint32_t Count = std::min<uint32_t>(Remaining, Segments[Index].Size - Offset);
+				Body[BodyCount].Pointer = Segments[Index].Pointer + Offset;
+				Body[BodyCount].Size = Count;
+				BodyCount++;
+
+				Remaining -= Count;
+				Offset = 0;
+				Index++;
+			}
+
+			// Dispatching the same bytes again would fail the same way, drop the frame.
+			if (Handler_ && !Handler_(Header_, Body, BodyCount))
+			{
+				Trace("!! Frame handler failed, frame dropped [Fsn %llu, Rsn %u]\n", Header_.Fsn, Header_.Rsn);
+				FramesDropped_++;
+			}
+			else
+			{
+				FramesParsed_++;
+			}
+
+			Advance(Header_.Length);
+
+			State_ = RpcFrameParserState::Header;
+		}
+	}
+
+	return Consumed;
+}
+
+void RpcFrameParser::Reset()
+{
+	State_ = RpcFrameParserState::Header;
+	HeaderReceived_ = 0;
+}
+
+RpcFrameParserState RpcFrameParser::State() const
+{
+	return State_;
+}
+
+uint64_t RpcFrameParser::FramesParsed() const
+{
+	return FramesParsed_;
+}
+
+uint64_t RpcFrameParser::ResyncCount() const
+{
+	return ResyncCount_;
+}
+
+uint64_t RpcFrameParser::BytesSkipped() const
+{
+	return BytesSkipped_;
+}
+
+uint64_t RpcFrameParser::DigestErrors() const
+{
+	return DigestErrors_;
+}
+
+uint64_t RpcFrameParser::FramesDropped() const
+{
+	return FramesDropped_;
+}
+
+void RpcFrameParser::SetDigestAcceptMask(uint32_t AcceptMask)
+{
+	DigestAcceptMask_ = AcceptMask;
+}
+
+bool RpcFrameParser::ValidateHeader()
+{
+	if (!RpcFrame::IsValidHeader(Header_, MaxBodySize_))
+	{
+		Trace("!! Invalid frame header [Fsn %llu, type %hu, size %u]\n", 
+			Header_.Fsn, Header_.Type, Header_.Length);
+		return false;
+	}
+
+	if (!RpcDigestSet::IsAccepted(DigestAcceptMask_, static_cast<RpcDigestType>(Header_.u.Bitfields.Digest)))
+	{
+		Trace("!! Frame digest type %hu not accepted [Fsn %llu]\n", 
+			static_cast<uint16_t>(Header_.u.Bitfields.Digest), Header_.Fsn);
+		return false;
+	}
+
+	return true;
+}
+
+}
+
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "Rpc.h"
+#include "RpcFrame.h"
+
+namespace SRPC
+{
+
+enum class RpcFrameParserState : uint32_t
+{
+	Header = 0,		// Collecting header bytes
+	Body,			// Header parsed, waiting for complete body
+	Resync,			// Invalid header, searching for next frame candidate
+};
+
+// 
+// Resumable frame parser.
+// Header bytes are consumed as they arrive (even if split across segments or completions).
+// Body is left unconsumed until it is complete, then passed to the handler as 
+// up to 2 segments pointing directly into the input, so no reassembly copy is made.
+// After an invalid header, input is scanned for the next magic and the 
+// candidate header is validated before parsing resumes.
+// Every byte passed is consumed once the frame it belongs to is complete, including bytes 
+// skipped by resync and frames dropped (digest mismatch, handler failure), so that the 
+// consumed count can be granted back to the sender as credit.
+// 
+
+class RpcFrameParser
+{
+public:
+	// Returns false if the frame cannot be processed, it is dropped then.
+	using FrameHandler = std::function<bool(const RpcFrameHeader& Header, const RpcFrameSegment *Body, uint32_t BodyCount)>;
+
+	RpcFrameParser(uint32_t MaxBodySize, FrameHandler Handler);
+	~RpcFrameParser();
+
+	uint32_t Parse(const RpcFrameSegment *Segments, uint32_t SegmentsCount);
+	void Reset();
+
+	RpcFrameParserState State() const;
+	uint64_t FramesParsed() const;
+	uint64_t ResyncCount() const;
+	uint64_t BytesSkipped() const;
+	uint64_t DigestErrors() const;
+	uint64_t FramesDropped() const;
+
+	// Bit (1 << RpcDigestType) set for each digest type accepted from peer.
+	// Excluding RpcDigestType::None requires every frame to carry a digest.
+	void SetDigestAcceptMask(uint32_t AcceptMask);
+
+private:
+	bool ValidateHeader();
+
+	uint32_t MaxBodySize_;
+	FrameHandler Handler_;
+
+	RpcFrameParserState State_;
+	RpcFrameHeader Header_;
+	uint8_t HeaderBytes_[RpcFrame::HeaderSize];	// Partial header
+	uint32_t HeaderReceived_;
+
+	uint64_t FramesParsed_;
+	uint64_t ResyncCount_;
+	uint64_t BytesSkipped_;
+	uint64_t FramesDropped_;		// Handler failed
+
+	RpcDigestSet Digests_;
+	RpcDigestEngine *Digest_;		// Digest of current frame (nullptr if none)
+	uint32_t DigestAcceptMask_;
+	uint32_t BodyDigested_;			// Body bytes already digested
+	bool BodyVerified_;
+	uint64_t DigestErrors_;
+};
+
+}
+
@@ -0,0 +1,104 @@
+
+#include "RpcKeepalive.h"
+
+namespace SRPC
+{
+
+RpcKeepalive::RpcKeepalive(Clock::duration IdleThreshold, Clock::duration PongTimeout) :
+	IdleThreshold_(IdleThreshold),
+	PongTimeout_(PongTimeout),
+	LastReceived_(Clock::now()),
+	PingSent_(),
+	PingOutstanding_(false),
+	PingsSent_(0),
+	PongsReceived_(0),
+	SmoothedRtt_(0),
+	RttVariance_(0)
+{
+}
+
+RpcKeepalive::~RpcKeepalive()
+{
+}
+
+void RpcKeepalive::FrameReceived(Clock::time_point Now)
+{
+	std::lock_guard<decltype(Mutex_)> Lock(Mutex_);
+
+	LastReceived_ = Now;
+	PingOutstanding_ = false; // Peer is alive, pong is not needed for liveness.
+}
+
+void RpcKeepalive::PongReceived(uint64_t Timestamp, Clock::time_point Now)
+{
+	uint64_t NowTimestamp = TimestampOf(Now);
+	if (Timestamp > NowTimestamp)
+		return; // Not ours
+
+	int64_t Rtt = static_cast<int64_t>(NowTimestamp - Timestamp);
+
+	std::lock_guard<decltype(Mutex_)> Lock(Mutex_);
+
+	if (!PongsReceived_)
+	{
+		SmoothedRtt_ = Rtt;
+		RttVariance_ = Rtt / 2;
+	}
+	else
+	{
+		// RTTVAR = 3/4 RTTVAR + 1/4 |SRTT - R|, SRTT = 7/8 SRTT + 1/8 R
+		int64_t Delta = SmoothedRtt_ - Rtt;
+		RttVariance_ += ((Delta < 0 ? -Delta : Delta) - RttVariance_) / 4;
+		SmoothedRtt_ += (Rtt - SmoothedRtt_) / 8;
+	}
+
+	PongsReceived_++;
+}
+
+RpcKeepalive::Action RpcKeepalive::Poll(Clock::time_point Now, uint64_t * Timestamp)
+{
+	std::lock_guard<decltype(Mutex_)> Lock(Mutex_);
+
+	if (PingOutstanding_)
+	{
+		// A slow path gets more time than PongTimeout, a few retransmit timeouts.
+		auto Timeout = std::max<Clock::duration>(PongTimeout_, 
+			std::chrono::microseconds(4 * (SmoothedRtt_ + 4 * RttVariance_)));
+
+		return (Now - PingSent_ >= Timeout) ? Action::PeerDead : Action::None;
+	}
+
+	if (Now - LastReceived_ < IdleThreshold_)
+		return Action::None;
+
+	PingSent_ = Now;
+	PingOutstanding_ = true;
+	PingsSent_++;
+
+	*Timestamp = TimestampOf(Now);
+
+	return Action::SendPing;
+}
+
+RpcKeepaliveStats RpcKeepalive::Stats()
+{
+	std::lock_guard<decltype(Mutex_)> Lock(Mutex_);
+
+	RpcKeepaliveStats Stats;
+	Stats.PingsSent = PingsSent_;
+	Stats.PongsReceived = PongsReceived_;
+	Stats.SmoothedRtt = std::chrono::microseconds(SmoothedRtt_);
+	Stats.RttVariance = std::chrono::microseconds(RttVariance_);
+	Stats.RetransmitTimeout = std::chrono::microseconds(SmoothedRtt_ + 4 * RttVariance_);
+
+	return Stats;
+}
+
+uint64_t RpcKeepalive::TimestampOf(Clock::time_point Time)
+{
+	return static_cast<uint64_t>(
+		std::chrono::duration_cast<std::chrono::microseconds>(Time.time_since_epoch()).count());
+}
+
+}
+
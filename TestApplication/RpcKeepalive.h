@@ -0,0 +1,65 @@
+#pragma once
+
+#include "SRPCBase.h"
+
+namespace SRPC
+{
+
+struct RpcKeepaliveStats
+{
+	uint64_t PingsSent;
+	uint64_t PongsReceived;
+	std::chrono::microseconds SmoothedRtt;		// 0 until first sample
+	std::chrono::microseconds RttVariance;
+	std::chrono::microseconds RetransmitTimeout;	// SmoothedRtt + 4 * RttVariance
+};
+
+// 
+// Liveness and RTT of a connection.
+// A ping is sent only when nothing was received for IdleThreshold. The peer echoes 
+// the timestamp in the pong, so RTT needs no per-ping state. Smoothed RTT and variance 
+// follow RFC 6298. Peer is dead if nothing (not even the pong) arrives within PongTimeout of a ping,
+// or within 4 retransmit timeouts (SmoothedRtt + 4 * RttVariance) if that is longer.
+// 
+
+class RpcKeepalive
+{
+public:
+	using Clock = std::chrono::steady_clock;
+
+	enum class Action
+	{
+		None,
+		SendPing,
+		PeerDead,
+	};
+
+	RpcKeepalive(Clock::duration IdleThreshold, Clock::duration PongTimeout);
+	~RpcKeepalive();
+
+	void FrameReceived(Clock::time_point Now);
+	void PongReceived(uint64_t Timestamp, Clock::time_point Now);
+
+	// Called periodically. Timestamp receives the ping payload if SendPing.
+	Action Poll(Clock::time_point Now, uint64_t *Timestamp);
+
+	RpcKeepaliveStats Stats();
+
+	static uint64_t TimestampOf(Clock::time_point Time);
+
+private:
+	std::mutex Mutex_;
+	Clock::duration IdleThreshold_;
+	Clock::duration PongTimeout_;
+	Clock::time_point LastReceived_;
+	Clock::time_point PingSent_;
+	bool PingOutstanding_;
+
+	uint64_t PingsSent_;
+	uint64_t PongsReceived_;
+	int64_t SmoothedRtt_;		// microseconds
+	int64_t RttVariance_;		// microseconds
+};
+
+}
+
@@ -0,0 +1,618 @@
+
+#include "RpcMarshalPlan.h"
+
+namespace SRPC
+{
+
+RpcMarshalPlan::RpcMarshalPlan() :
+	WireSize_{},
+	FuseBarrier_(0),
+	OutOnly_(false),
+	Encoding_(RpcIntegerEncoding::Fixed)
+{
+}
+
+RpcMarshalPlan::~RpcMarshalPlan()
+{
+}
+
+bool RpcMarshalPlan::Compile(RpcTypeRecords & Records)
+{
+	return Compile(Records, RpcIntegerEncoding::Fixed);
+}
+
+bool RpcMarshalPlan::Compile(RpcTypeRecords & Records, RpcIntegerEncoding Encoding)
+{
+	Encoding_ = Encoding;
+	Ops_.clear();
+	Fields_.clear();
+	WireSize_[0] = WireSize_[1] = 0;
+	FuseBarrier_ = 0;
+
+	const uint16_t ParamListTypeId = static_cast<uint16_t>(RpcTypeId::PARAM_LIST);
+
+	auto Info = Records.GetTypeInfo(ParamListTypeId);
+	if (!Info || !Info->Struct.FieldsCount)
+		return false; // No return type slot
+
+	// Lay out every referenced UDT first, this rejects undefined and circular types.
+	for (auto TypeId : Records.GetReferencedTypeIdList(ParamListTypeId))
+	{
+		RpcTypeLayout Layout;
+		if (!Records.GetLayout(TypeId, &Layout))
+			return false;
+	}
+
+	auto FieldTypes = Records.GetFieldTypes(ParamListTypeId);
+
+	for (uint8_t FieldId = 0; FieldId < Info->Struct.FieldsCount; FieldId++)
+	{
+		auto& Field = FieldTypes[FieldId];
+
+		FieldPlan Plan{};
+
+		if (Field.TypeId != static_cast<uint16_t>(RpcTypeId::Undefined))
+		{
+			RpcTypeLayout Layout;
+			if (!Records.GetFieldLayout(Field, &Layout))
+				return false;
+
+			Plan.NativeSize = Layout.Size;
+		}
+
+		auto& CallOps = Plan.Ops[static_cast<size_t>(RpcMarshalDirection::Call)];
+		auto& ReturnOps = Plan.Ops[static_cast<size_t>(RpcMarshalDirection::Return)];
+
+		if (!EmitFieldOps(Records, Field, Plan.NativeSize, false, &CallOps))
+			return false;
+
+		Plan.Used[static_cast<size_t>(RpcMarshalDirection::Call)] = FieldId != 0;
+
+		if (FieldId == 0 || IsOut(Records, Field))
+		{
+			ReturnOps = CallOps;
+			Plan.Used[static_cast<size_t>(RpcMarshalDirection::Return)] = true;
+		}
+		else
+		{
+			// Out fields inside an in parameter, if any.
+			if (!EmitFieldOps(Records, Field, Plan.NativeSize, true, &ReturnOps))
+				return false;
+
+			Plan.Used[static_cast<size_t>(RpcMarshalDirection::Return)] = !!ReturnOps.OpsCount;
+		}
+
+		for (size_t i = 0; i < std::size(WireSize_); i++)
+		{
+			if (Plan.Used[i])
+				WireSize_[i] += Plan.Ops[i].WireSize;
+		}
+
+		Fields_.push_back(Plan);
+	}
+
+	return true;
+}
+
+size_t RpcMarshalPlan::Encode(RpcMarshalDirection Direction, const void * const * Params, uint8_t * Buffer, size_t Size) const
+{
+	size_t Index = static_cast<size_t>(Direction);
+	if (Encoding_ == RpcIntegerEncoding::Fixed && Size < WireSize_[Index])
+		return 0;
+
+	uint8_t *Wire = Buffer;
+
+	for (size_t FieldId = 0; FieldId < Fields_.size(); FieldId++)
+	{
+		auto& Field = Fields_[FieldId];
+		auto& Ops = Field.Ops[Index];
+		if (!Field.Used[Index] || !Ops.OpsCount)
+			continue;
+
+		Assert(Params[FieldId] != nullptr);
+
+		const RpcMarshalOp *Op = Ops_.data() + Ops.FirstOp;
+		if (!Execute<true>(Op, Op + Ops.OpsCount,
+			const_cast<uint8_t *>(static_cast<const uint8_t *>(Params[FieldId])), Wire, Buffer + Size))
+			return 0;
+	}
+
+	return Wire - Buffer;
+}
+
+size_t RpcMarshalPlan::Decode(RpcMarshalDirection Direction, void * const * Params, const uint8_t * Buffer, size_t Size) const
+{
+	size_t Index = static_cast<size_t>(Direction);
+	if (Encoding_ == RpcIntegerEncoding::Fixed && Size < WireSize_[Index])
+		return 0;
+
+	uint8_t *Wire = const_cast<uint8_t *>(Buffer); // Only read
+
+	for (size_t FieldId = 0; FieldId < Fields_.size(); FieldId++)
+	{
+		auto& Field = Fields_[FieldId];
+		auto& Ops = Field.Ops[Index];
+		if (!Field.Used[Index] || !Ops.OpsCount)
+			continue;
+
+		Assert(Params[FieldId] != nullptr);
+
+		const RpcMarshalOp *Op = Ops_.data() + Ops.FirstOp;
+		if (!Execute<false>(Op, Op + Ops.OpsCount, static_cast<uint8_t *>(Params[FieldId]), Wire, Buffer + Size))
+			return 0;
+	}
+
+	return Wire - Buffer;
+}
+
+void ** RpcMarshalPlan::AllocateParams(RpcMarshalDirection Direction, RpcCallArena & Arena) const
+{
+	size_t Index = static_cast<size_t>(Direction);
+
+	auto Params = static_cast<void **>(Arena.Allocate(Fields_.size() * sizeof(void *), alignof(void *)));
+
+	for (size_t FieldId = 0; FieldId < Fields_.size(); FieldId++)
+	{
+		auto& Field = Fields_[FieldId];
+
+		// Native alignment of a field is at most 16 (PackingShift 4).
+		Params[FieldId] = Field.Used[Index] && Field.NativeSize ? Arena.Allocate(Field.NativeSize, 16) : nullptr;
+	}
+
+	return Params;
+}
+
+size_t RpcMarshalPlan::View(RpcMarshalDirection Direction, RpcArgumentView * Views, const uint8_t * Buffer, size_t Size) const
+{
+	size_t Index = static_cast<size_t>(Direction);
+	if (Encoding_ == RpcIntegerEncoding::Fixed && Size < WireSize_[Index])
+		return 0;
+
+	const uint8_t *Wire = Buffer;
+
+	for (size_t FieldId = 0; FieldId < Fields_.size(); FieldId++)
+	{
+		auto& Field = Fields_[FieldId];
+		if (!Field.Used[Index])
+		{
+			Views[FieldId] = RpcArgumentView{ nullptr, 0 };
+			continue;
+		}
+
+		auto& Ops = Field.Ops[Index];
+
+		if (Encoding_ == RpcIntegerEncoding::Fixed)
+		{
+			// Wire size of a field is fixed, no need to walk its ops.
+			Views[FieldId] = RpcArgumentView{ Wire, Ops.WireSize };
+			Wire += Ops.WireSize;
+			continue;
+		}
+
+		const uint8_t *Start = Wire;
+		const RpcMarshalOp *Op = Ops_.data() + Ops.FirstOp;
+		if (!Skip(Op, Op + Ops.OpsCount, Wire, Buffer + Size))
+			return 0;
+
+		Views[FieldId] = RpcArgumentView{ Start, static_cast<uint32_t>(Wire - Start) };
+	}
+
+	return Wire - Buffer;
+}
+
+bool RpcMarshalPlan::IsViewable(uint32_t FieldId) const
+{
+	return IsViewable(RpcMarshalDirection::Call, FieldId);
+}
+
+bool RpcMarshalPlan::IsViewable(RpcMarshalDirection Direction, uint32_t FieldId) const
+{
+	return FieldId < Fields_.size() && Fields_[FieldId].Ops[static_cast<size_t>(Direction)].Viewable;
+}
+
+size_t RpcMarshalPlan::WireSize(RpcMarshalDirection Direction) const
+{
+	return WireSize_[static_cast<size_t>(Direction)];
+}
+
+RpcIntegerEncoding RpcMarshalPlan::IntegerEncoding() const
+{
+	return Encoding_;
+}
+
+uint32_t RpcMarshalPlan::ParamsCount() const
+{
+	return Fields_.empty() ? 0 : static_cast<uint32_t>(Fields_.size() - 1);
+}
+
+uint32_t RpcMarshalPlan::NativeSize(uint32_t FieldId) const
+{
+	return FieldId < Fields_.size() ? Fields_[FieldId].NativeSize : 0;
+}
+
+const std::vector<RpcMarshalOp>& RpcMarshalPlan::Ops() const
+{
+	return Ops_;
+}
+
+bool RpcMarshalPlan::EmitFieldOps(RpcTypeRecords & Records, const RpcTypeBaseInfo & Field, uint32_t NativeSize, bool OutOnly, FieldOps * Ops)
+{
+	Ops->FirstOp = static_cast<uint32_t>(Ops_.size());
+
+	// Parameters are not adjacent in memory.
+	FuseBarrier_ = Ops_.size();
+	OutOnly_ = OutOnly;
+
+	if (Field.TypeId != static_cast<uint16_t>(RpcTypeId::Undefined) &&
+		!EmitField(Records, Field, 0))
+		return false;
+
+	OutOnly_ = false;
+
+	Ops->OpsCount = static_cast<uint32_t>(Ops_.size()) - Ops->FirstOp;
+	Ops->WireSize = static_cast<uint32_t>(GetWireSize(Ops_.data() + Ops->FirstOp, Ops_.data() + Ops_.size()));
+	Ops->Viewable = Ops->OpsCount == 1 && Ops_[Ops->FirstOp].Code == RpcMarshalOpCode::Copy &&
+		!Ops_[Ops->FirstOp].Offset && Ops_[Ops->FirstOp].Size == NativeSize;
+
+	return true;
+}
+
+bool RpcMarshalPlan::IsOut(RpcTypeRecords & Records, const RpcTypeBaseInfo & Field)
+{
+	// Out field, or field of an Out UDT.
+	if (Field.Attributes & RpcTypeAttributes::OutAttribute)
+		return true;
+
+	auto Info = Records.GetTypeInfo(Field.TypeId);
+	return Info && !!(Info->Base.Attributes & RpcTypeAttributes::OutAttribute);
+}
+
+bool RpcMarshalPlan::EmitType(RpcTypeRecords & Records, uint16_t TypeId, uint32_t Offset)
+{
+	if (RpcTypeRecords::IsTypeIdPrimitive(TypeId))
+	{
+		// Reached in OutOnly_ mode only if not Out.
+		if (!OutOnly_)
+			EmitPrimitive(TypeId, Offset);
+
+		return true;
+	}
+
+	auto Info = Records.GetTypeInfo(TypeId);
+	if (!Info)
+		return false;
+
+	RpcTypeLayout Layout;
+	if (!Records.GetLayout(TypeId, &Layout))
+		return false;
+
+	if (Layout.WireIdentical && !OutOnly_ && Encoding_ == RpcIntegerEncoding::Fixed)
+	{
+		// One block, so is an array of it (see EmitField). In Compact its integers are varints 
+		// like anywhere else, fields without any are still fused into one copy below.
+		EmitCopy(Offset, Layout.Size);
+		return true;
+	}
+
+	// Nested UDT is flattened into its parent.
+
+	auto FieldTypes = Records.GetFieldTypes(TypeId);
+	uint32_t Packing = 1u << Info->Struct.PackingShift;
+	uint32_t FieldOffset = 0;
+
+	for (uint8_t FieldId = 0; FieldId < Info->Struct.FieldsCount; FieldId++)
+	{
+		auto& Field = FieldTypes[FieldId];
+
+		RpcTypeLayout FieldLayout;
+		if (!Records.GetFieldLayout(Field, &FieldLayout))
+			return false;
+
+		uint32_t FieldAlignment = std::min(FieldLayout.Alignment, Packing);
+		FieldOffset = (FieldOffset + FieldAlignment - 1) / FieldAlignment * FieldAlignment;
+
+		if (OutOnly_ && IsOut(Records, Field))
+		{
+			// Whole field is Out.
+			OutOnly_ = false;
+			bool Emitted = EmitField(Records, Field, Offset + FieldOffset);
+			OutOnly_ = true;
+
+			if (!Emitted)
+				return false;
+		}
+		else if (!EmitField(Records, Field, Offset + FieldOffset))
+		{
+			return false;
+		}
+
+		FieldOffset += FieldLayout.Size;
+	}
+
+	return true;
+}
+
+bool RpcMarshalPlan::EmitField(RpcTypeRecords & Records, const RpcTypeBaseInfo & Field, uint32_t Offset)
+{
+	if (!(Field.Attributes & RpcTypeAttributes::Array))
+		return EmitType(Records, Field.TypeId, Offset);
+
+	RpcTypeLayout Element;
+	if (!Records.GetLayout(Field.TypeId, &Element))
+		return false;
+
+	if (!Field.Array.Count || !Element.Size)
+		return true;
+
+	size_t Start = Ops_.size();
+	size_t Barrier = FuseBarrier_;
+
+	RpcMarshalOp Op{};
+	Op.Code = RpcMarshalOpCode::Array;
+	Op.Offset = Offset;
+	Op.Count = Field.Array.Count;
+	Op.Stride = Element.Size;
+	Ops_.push_back(Op);
+
+	// Element ops are relative to the element, do not fuse them with ops before the array.
+	FuseBarrier_ = Ops_.size();
+
+	if (!EmitType(Records, Field.TypeId, 0))
+		return false;
+
+	uint32_t BodyCount = static_cast<uint32_t>(Ops_.size() - Start - 1);
+	auto& Body = Ops_.back();
+
+	if (!BodyCount ||
+		(BodyCount == 1 && Body.Code == RpcMarshalOpCode::Copy && !Body.Offset && Body.Size == Element.Size))
+	{
+		// Element has no padding, whole array is one run.
+		Ops_.resize(Start);
+		FuseBarrier_ = Barrier;
+
+		if (BodyCount)
+			EmitCopy(Offset, Element.Size * Field.Array.Count);
+
+		return true;
+	}
+
+	Ops_[Start].Size = BodyCount;
+	FuseBarrier_ = Ops_.size();
+
+	return true;
+}
+
+void RpcMarshalPlan::EmitCopy(uint32_t Offset, uint32_t Size)
+{
+	if (!Size)
+		return;
+
+	if (Ops_.size() > FuseBarrier_)
+	{
+		auto& Last = Ops_.back();
+		if (Last.Code == RpcMarshalOpCode::Copy && Last.Offset + Last.Size == Offset)
+		{
+			// Adjacent in memory and on the wire.
+			Last.Size += Size;
+			return;
+		}
+	}
+
+	RpcMarshalOp Op{};
+	Op.Code = RpcMarshalOpCode::Copy;
+	Op.Offset = Offset;
+	Op.Size = Size;
+	Ops_.push_back(Op);
+}
+
+void RpcMarshalPlan::EmitPrimitive(uint16_t TypeId, uint32_t Offset)
+{
+	RpcMarshalOp Op{};
+	Op.Code = RpcMarshalOpCode::Copy;
+	Op.Offset = Offset;
+	Op.Size = RpcTypeRecords::GetPrimitiveSize(TypeId);
+
+	if (Encoding_ == RpcIntegerEncoding::Compact)
+	{
+		switch (static_cast<RpcTypeId>(TypeId))
+		{
+		case RpcTypeId::INT_16:
+		case RpcTypeId::INT_32:
+		case RpcTypeId::INT_64:
+			Op.Code = RpcMarshalOpCode::ZigZag;
+			break;
+
+		case RpcTypeId::INT_16U:
+		case RpcTypeId::INT_32U:
+		case RpcTypeId::INT_64U:
+			Op.Code = RpcMarshalOpCode::Varint;
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	if (Op.Code == RpcMarshalOpCode::Copy)
+		EmitCopy(Op.Offset, Op.Size);
+	else
+		Ops_.push_back(Op);
+}
+
+size_t RpcMarshalPlan::GetWireSize(const RpcMarshalOp * Op, const RpcMarshalOp * End)
+{
+	size_t Size = 0;
+
+	while (Op < End)
+	{
+		if (Op->Code == RpcMarshalOpCode::Copy)
+		{
+			Size += Op->Size;
+			Op++;
+			continue;
+		}
+
+		if (Op->Code == RpcMarshalOpCode::Varint || Op->Code == RpcMarshalOpCode::ZigZag)
+		{
+			Size += (Op->Size * 8 + 6) / 7; // Longest varint
+			Op++;
+			continue;
+		}
+
+		Size += Op->Count * GetWireSize(Op + 1, Op + 1 + Op->Size);
+		Op += 1 + Op->Size;
+	}
+
+	return Size;
+}
+
+template <bool Encoding>
+bool RpcMarshalPlan::Execute(const RpcMarshalOp * Op, const RpcMarshalOp * End, uint8_t * Native, uint8_t *& Wire, const uint8_t * WireEnd)
+{
+	while (Op < End)
+	{
+		if (Op->Code == RpcMarshalOpCode::Copy)
+		{
+			if (static_cast<size_t>(WireEnd - Wire) < Op->Size)
+				return false;
+
+			if (Encoding)
+				memcpy(Wire, Native + Op->Offset, Op->Size);
+			else
+				memcpy(Native + Op->Offset, Wire, Op->Size);
+
+			Wire += Op->Size;
+			Op++;
+			continue;
+		}
+
+		if (Op->Code != RpcMarshalOpCode::Array)
+		{
+			if (Encoding ? !EncodeVarint(Op, Native, Wire, WireEnd) : !DecodeVarint(Op, Native, Wire, WireEnd))
+				return false;
+
+			Op++;
+			continue;
+		}
+
+		const RpcMarshalOp *Body = Op + 1;
+		const RpcMarshalOp *BodyEnd = Body + Op->Size;
+		uint8_t *Element = Native + Op->Offset;
+
+		for (uint32_t i = 0; i < Op->Count; i++, Element += Op->Stride)
+		{
+			if (!Execute<Encoding>(Body, BodyEnd, Element, Wire, WireEnd))
+				return false;
+		}
+
+		Op = BodyEnd;
+	}
+
+	return true;
+}
+
+bool RpcMarshalPlan::Skip(const RpcMarshalOp * Op, const RpcMarshalOp * End, const uint8_t *& Wire, const uint8_t * WireEnd)
+{
+	while (Op < End)
+	{
+		if (Op->Code == RpcMarshalOpCode::Copy)
+		{
+			if (static_cast<size_t>(WireEnd - Wire) < Op->Size)
+				return false;
+
+			Wire += Op->Size;
+			Op++;
+			continue;
+		}
+
+		if (Op->Code != RpcMarshalOpCode::Array)
+		{
+			ByteStream Stream(const_cast<uint8_t *>(Wire), WireEnd - Wire);
+			size_t Size = Stream.ReadVarint(static_cast<uint64_t *>(nullptr));
+			if (!Size)
+				return false;
+
+			Wire += Size;
+			Op++;
+			continue;
+		}
+
+		for (uint32_t i = 0; i < Op->Count; i++)
+		{
+			if (!Skip(Op + 1, Op + 1 + Op->Size, Wire, WireEnd))
+				return false;
+		}
+
+		Op += 1 + Op->Size;
+	}
+
+	return true;
+}
+
+bool RpcMarshalPlan::EncodeVarint(const RpcMarshalOp * Op, const uint8_t * Native, uint8_t *& Wire, const uint8_t * WireEnd)
+{
+	const uint8_t *p = Native + Op->Offset;
+	uint64_t Value = 0;
+
+	switch (Op->Size)
+	{
+	case sizeof(uint16_t): { uint16_t v; memcpy(&v, p, sizeof(v)); Value = v; break; }
+	case sizeof(uint32_t): { uint32_t v; memcpy(&v, p, sizeof(v)); Value = v; break; }
+	case sizeof(uint64_t): { uint64_t v; memcpy(&v, p, sizeof(v)); Value = v; break; }
+	default: return false;
+	}
+
+	if (Op->Code == RpcMarshalOpCode::ZigZag)
+	{
+		// Sign-extend from native width.
+		uint32_t Shift = 64 - Op->Size * 8;
+		Value = ByteStream::ZigZagEncode(static_cast<int64_t>(Value << Shift) >> Shift);
+	}
+
+	ByteStream Stream(Wire, WireEnd - Wire);
+	size_t Size = Stream.WriteVarint(Value);
+	Wire += Size;
+
+	return !!Size;
+}
+
+bool RpcMarshalPlan::DecodeVarint(const RpcMarshalOp * Op, uint8_t * Native, uint8_t *& Wire, const uint8_t * WireEnd)
+{
+	ByteStream Stream(Wire, WireEnd - Wire);
+	uint64_t Value = 0;
+	size_t Size = Stream.ReadVarint(&Value);
+	if (!Size)
+		return false;
+
+	Wire += Size;
+
+	uint32_t Shift = 64 - Op->Size * 8;
+
+	if (Op->Code == RpcMarshalOpCode::ZigZag)
+	{
+		// Must fit in native width, i.e. survive truncation and sign extension.
+		int64_t Signed = ByteStream::ZigZagDecode(Value);
+		if (Shift && (static_cast<int64_t>(static_cast<uint64_t>(Signed) << Shift) >> Shift) != Signed)
+			return false;
+
+		Value = static_cast<uint64_t>(Signed);
+	}
+	else if (Shift && (Value >> (64 - Shift)))
+	{
+		return false;
+	}
+
+	uint8_t *p = Native + Op->Offset;
+
+	switch (Op->Size)
+	{
+	case sizeof(uint16_t): { uint16_t v = static_cast<uint16_t>(Value); memcpy(p, &v, sizeof(v)); break; }
+	case sizeof(uint32_t): { uint32_t v = static_cast<uint32_t>(Value); memcpy(p, &v, sizeof(v)); break; }
+	case sizeof(uint64_t): memcpy(p, &Value, sizeof(Value)); break;
+	default: return false;
+	}
+
+	return true;
+}
+
+}
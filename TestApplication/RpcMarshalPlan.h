@@ -0,0 +1,133 @@
+#pragma once
+
+#include "RpcTypeRecords.h"
+#include "RpcCallArena.h"
+
+namespace SRPC
+{
+
+//
+// Marshalling plan of a PARAM_LIST, compiled once from RpcTypeRecords.
+// Native side is each parameter in memory (UDT layout by PackingShift), wire side is
+// fields in order without padding. Nested UDTs are flattened into their parent and adjacent
+// fixed-size fields are fused, so a padding-free structure (or an array of them) is a single copy.
+// Wire byte order is little-endian like ByteStream and copies are in host order, so the host
+// must be little-endian (no swap is done, checked below).
+// With RpcIntegerEncoding::Compact, 16/32/64-bit integers are varints instead of being copied,
+// also inside wire-identical UDTs, and WireSize() is an upper bound. Wire-identical UDTs 
+// (see RpcTypeRecords::IsWireIdentical) and arrays of them are one copy in Fixed encoding.
+// Return direction carries the return value and what is marked OutAttribute: a whole parameter 
+// (its field in PARAM_LIST or its UDT), otherwise only the Out fields inside it, at any depth and 
+// in every array element. Decode() of a CallReturn writes those and leaves the rest of caller storage as is.
+//
+
+static_assert(SRPC_LITTLE_ENDIAN, "RpcMarshalPlan copies integers in host order, host must be little-endian !!");
+
+enum class RpcMarshalDirection
+{
+	Call,		// Parameters
+	Return,		// Return value and Out parameters
+};
+
+enum class RpcMarshalOpCode : uint8_t
+{
+	Copy,		// Size bytes at Offset
+	Array,		// Next Size ops, Count times, Offset advanced by Stride each time
+	Varint,		// Unsigned integer of Size bytes at Offset, varint on the wire
+	ZigZag,		// Signed integer of Size bytes at Offset, zigzag varint on the wire
+};
+
+struct RpcMarshalOp
+{
+	RpcMarshalOpCode Code;
+	uint32_t Offset;		// From native base of parameter (or array element)
+	uint32_t Size;
+	uint32_t Count;
+	uint32_t Stride;
+};
+
+// 
+// Wire bytes of one parameter in a received message, nothing is copied.
+// If the parameter is viewable (see RpcMarshalPlan::IsViewable), the bytes are its native
+// representation (e.g. INT_8[N], CP_16 string), otherwise Decode() is needed.
+// Pointer is not aligned in general.
+// 
+
+struct RpcArgumentView
+{
+	const uint8_t *Pointer;
+	uint32_t Size;
+};
+
+class RpcMarshalPlan
+{
+public:
+	RpcMarshalPlan();
+	~RpcMarshalPlan();
+
+	bool Compile(RpcTypeRecords& Records);
+	bool Compile(RpcTypeRecords& Records, RpcIntegerEncoding Encoding);
+
+	//
+	// Params[0] is the return value, Params[i] the i-th parameter (1-based).
+	// Pointers not used by the direction may be nullptr.
+	// Returns bytes written/read, or 0 if buffer is too small (or a varint is malformed).
+	//
+
+	size_t Encode(RpcMarshalDirection Direction, const void * const *Params, uint8_t *Buffer, size_t Size) const;
+	size_t Decode(RpcMarshalDirection Direction, void * const *Params, const uint8_t *Buffer, size_t Size) const;
+
+	// Params for Decode() in Arena: ParamsCount() + 1 pointers, native storage for fields used by the direction.
+	void **AllocateParams(RpcMarshalDirection Direction, RpcCallArena& Arena) const;
+
+	// Views[FieldId] into Buffer, {nullptr, 0} if not used by the direction. Cost does not depend on array sizes.
+	size_t View(RpcMarshalDirection Direction, RpcArgumentView *Views, const uint8_t *Buffer, size_t Size) const;
+	bool IsViewable(uint32_t FieldId) const;
+	bool IsViewable(RpcMarshalDirection Direction, uint32_t FieldId) const;
+
+	size_t WireSize(RpcMarshalDirection Direction) const;
+	RpcIntegerEncoding IntegerEncoding() const;
+	uint32_t ParamsCount() const;
+	uint32_t NativeSize(uint32_t FieldId) const;
+	const std::vector<RpcMarshalOp>& Ops() const;
+
+private:
+	struct FieldOps
+	{
+		uint32_t FirstOp;
+		uint32_t OpsCount;
+		uint32_t WireSize;
+		bool Viewable;			// Wire bytes are the native bytes (one copy of NativeSize)
+	};
+
+	struct FieldPlan
+	{
+		uint32_t NativeSize;
+		bool Used[2];			// <RpcMarshalDirection, bool>
+		FieldOps Ops[2];		// <RpcMarshalDirection, FieldOps>, the same unless only part of it is Out
+	};
+
+	bool EmitFieldOps(RpcTypeRecords& Records, const RpcTypeBaseInfo& Field, uint32_t NativeSize, bool OutOnly, FieldOps *Ops);
+	bool EmitType(RpcTypeRecords& Records, uint16_t TypeId, uint32_t Offset);
+	bool EmitField(RpcTypeRecords& Records, const RpcTypeBaseInfo& Field, uint32_t Offset);
+	static bool IsOut(RpcTypeRecords& Records, const RpcTypeBaseInfo& Field);
+	void EmitCopy(uint32_t Offset, uint32_t Size);
+	void EmitPrimitive(uint16_t TypeId, uint32_t Offset);
+
+	static size_t GetWireSize(const RpcMarshalOp *Op, const RpcMarshalOp *End);
+
+	template <bool Encoding>
+	static bool Execute(const RpcMarshalOp *Op, const RpcMarshalOp *End, uint8_t *Native, uint8_t *& Wire, const uint8_t *WireEnd);
+	static bool Skip(const RpcMarshalOp *Op, const RpcMarshalOp *End, const uint8_t *& Wire, const uint8_t *WireEnd);
+	static bool EncodeVarint(const RpcMarshalOp *Op, const uint8_t *Native, uint8_t *& Wire, const uint8_t *WireEnd);
+	static bool DecodeVarint(const RpcMarshalOp *Op, uint8_t *Native, uint8_t *& Wire, const uint8_t *WireEnd);
+
+	std::vector<RpcMarshalOp> Ops_;
+	std::vector<FieldPlan> Fields_;
+	size_t WireSize_[2];						// <RpcMarshalDirection, size_t>
+	size_t FuseBarrier_;						// Ops before this index are not fused
+	bool OutOnly_;								// Emitting only Out fields (Return of a partly Out parameter)
+	RpcIntegerEncoding Encoding_;
+};
+
+}
@@ -0,0 +1,211 @@
+
+#include "RpcPendingCallTable.h"
+
+namespace SRPC
+{
+
+RpcPendingCallTable::RpcPendingCallTable(uint32_t CapacityShift) :
+	CapacityShift_(CapacityShift),
+	Mask_((1u << CapacityShift) - 1),
+	Slots_(std::make_unique<Slot[]>(static_cast<size_t>(1) << CapacityShift)),
+	NextIndex_(0),
+	PendingCount_(0),
+	DeadlineCount_(0)
+{
+	Assert(CapacityShift > 0 && CapacityShift < 24); // at least 8 bits of generation
+
+	for (uint32_t i = 0; i <= Mask_; i++)
+	{
+		Slots_[i].Tag.store(MakeTag(i, SlotFree), std::memory_order_relaxed);
+		Slots_[i].Deadline.store(0, std::memory_order_relaxed);
+	}
+}
+
+RpcPendingCallTable::~RpcPendingCallTable()
+{
+	AbandonAll(RpcCallStatus::Disconnected);
+}
+
+bool RpcPendingCallTable::Insert(CompletionRoutine&& Completion, uint32_t * Rsn)
+{
+	return Insert(std::move(Completion), Clock::time_point(), Rsn);
+}
+
+bool RpcPendingCallTable::Insert(CompletionRoutine&& Completion, Clock::time_point Deadline, uint32_t * Rsn)
+{
+	for (uint32_t Probe = 0; Probe <= Mask_; Probe++)
+	{
+		uint32_t Index = NextIndex_.fetch_add(1, std::memory_order_relaxed) & Mask_;
+		auto& Target = Slots_[Index];
+
+		uint64_t Tag = Target.Tag.load(std::memory_order_acquire);
+		if (static_cast<SlotState>(Tag & 0xffffffff) != SlotFree)
+			continue;
+
+		uint32_t NewRsn = NextRsn(static_cast<uint32_t>(Tag >> 0x20));
+		if (!Target.Tag.compare_exchange_strong(Tag, MakeTag(NewRsn, SlotReserved), std::memory_order_acq_rel))
+			continue;
+
+		// Slot is exclusively ours until published as pending. Its completion is empty since Release().
+		Target.Completion.swap(Completion);
+		PendingCount_++;
+
+		if (Deadline != Clock::time_point())
+		{
+			Target.Deadline.store(Deadline.time_since_epoch().count(), std::memory_order_relaxed);
+			DeadlineCount_++;
+		}
+
+		Target.Tag.store(MakeTag(NewRsn, SlotPending), std::memory_order_release);
+
+		*Rsn = NewRsn;
+		return true;
+	}
+
+	// Table full.
+	return false;
+}
+
+bool RpcPendingCallTable::Deliver(uint32_t Rsn, uint64_t Offset, const uint8_t * Chunk, uint32_t Size, bool EoR)
+{
+	auto& Target = Slots_[Rsn & Mask_];
+
+	uint64_t Expected = MakeTag(Rsn, SlotPending);
+	if (!Target.Tag.compare_exchange_strong(Expected, MakeTag(Rsn, SlotBusy), std::memory_order_acq_rel))
+		return false; // Unknown, stale or abandoned Rsn
+
+	if (Target.Completion)
+		Target.Completion(RpcCallStatus::Success, Offset, Chunk, Size, EoR);
+
+	if (EoR)
+		Release(Target, Rsn);
+	else
+		Target.Tag.store(MakeTag(Rsn, SlotPending), std::memory_order_release);
+
+	return true;
+}
+
+bool RpcPendingCallTable::Abandon(uint32_t Rsn, RpcCallStatus Status)
+{
+	auto& Target = Slots_[Rsn & Mask_];
+
+	uint64_t Expected = MakeTag(Rsn, SlotPending);
+	if (!Target.Tag.compare_exchange_strong(Expected, MakeTag(Rsn, SlotBusy), std::memory_order_acq_rel))
+		return false;
+
+	if (Target.Completion)
+		Target.Completion(Status, 0, nullptr, 0, true);
+
+	Release(Target, Rsn);
+
+	return true;
+}
+
+uint32_t RpcPendingCallTable::AbandonAll(RpcCallStatus Status)
+{
+	uint32_t Count = 0;
+
+	for (uint32_t i = 0; i <= Mask_; i++)
+	{
+		auto& Target = Slots_[i];
+
+		while (true)
+		{
+			uint64_t Tag = Target.Tag.load(std::memory_order_acquire);
+			SlotState State = static_cast<SlotState>(Tag & 0xffffffff);
+
+			if (State == SlotFree)
+				break;
+
+			if (State == SlotPending)
+			{
+				if (Abandon(static_cast<uint32_t>(Tag >> 0x20), Status))
+				{
+					Count++;
+					break;
+				}
+			}
+
+			// Insert or completion in progress.
+			std::this_thread::yield();
+		}
+	}
+
+	return Count;
+}
+
+uint32_t RpcPendingCallTable::ExpireDue(Clock::time_point Now)
+{
+	if (!DeadlineCount_)
+		return 0;
+
+	uint32_t Count = 0;
+	auto NowTicks = Now.time_since_epoch().count();
+
+	for (uint32_t i = 0; i <= Mask_; i++)
+	{
+		auto& Target = Slots_[i];
+
+		uint64_t Tag = Target.Tag.load(std::memory_order_acquire);
+		if (static_cast<SlotState>(Tag & 0xffffffff) != SlotPending)
+			continue;
+
+		// Slot may be reused meanwhile, Abandon() then fails on the Rsn of the tag.
+		auto Deadline = Target.Deadline.load(std::memory_order_relaxed);
+		if (!Deadline || Deadline > NowTicks)
+			continue;
+
+		if (Abandon(static_cast<uint32_t>(Tag >> 0x20), RpcCallStatus::TimedOut))
+			Count++;
+	}
+
+	return Count;
+}
+
+bool RpcPendingCallTable::IsPending(uint32_t Rsn) const
+{
+	uint64_t Tag = Slots_[Rsn & Mask_].Tag.load(std::memory_order_acquire);
+
+	return
+		static_cast<uint32_t>(Tag >> 0x20) == Rsn &&
+		static_cast<SlotState>(Tag & 0xffffffff) != SlotFree;
+}
+
+uint32_t RpcPendingCallTable::PendingCount() const
+{
+	return PendingCount_;
+}
+
+uint32_t RpcPendingCallTable::Capacity() const
+{
+	return Mask_ + 1;
+}
+
+uint64_t RpcPendingCallTable::MakeTag(uint32_t Rsn, SlotState State)
+{
+	return (static_cast<uint64_t>(Rsn) << 0x20) | State;
+}
+
+uint32_t RpcPendingCallTable::NextRsn(uint32_t Rsn) const
+{
+	// Advance generation, skipping generation 0 (Rsn 0..Mask_ are never handed out).
+	uint32_t Next = Rsn + (1u << CapacityShift_);
+	if (!(Next >> CapacityShift_))
+		Next += (1u << CapacityShift_);
+
+	return Next;
+}
+
+void RpcPendingCallTable::Release(Slot & Target, uint32_t Rsn)
+{
+	Target.Completion = nullptr;
+	PendingCount_--;
+
+	if (Target.Deadline.exchange(0, std::memory_order_relaxed))
+		DeadlineCount_--;
+
+	Target.Tag.store(MakeTag(Rsn, SlotFree), std::memory_order_release);
+}
+
+}
+
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "SRPCBase.h"
+
+namespace SRPC
+{
+
+enum class RpcCallStatus : uint32_t
+{
+	Success = 0,		// CallReturn chunk received
+	Cancelled,			// Call abandoned by caller
+	Disconnected,		// Connection closed before CallReturn
+	SchemaMissing,		// Peer did not know the schema fingerprint, call was not run
+	TimedOut,			// Deadline passed before CallReturn (see ExpireDue)
+	Malformed,			// CallReturn did not decode by the marshal plan of the call
+};
+
+// 
+// Calls in flight on a connection, indexed by Rsn.
+// 
+// Table has (1 << CapacityShift) slots. Rsn = (Generation << CapacityShift) | SlotIndex,
+// so lookup is a single array access and a response for a reused slot (stale generation) 
+// is rejected. Slot ownership changes by CAS on a tag word (Rsn, State), no lock is taken.
+// A call inserted with a deadline is abandoned with TimedOut by the first ExpireDue() after it.
+// 
+
+class RpcPendingCallTable
+{
+public:
+	using CompletionRoutine = std::function<void(RpcCallStatus Status, uint64_t Offset, const uint8_t *Chunk, uint32_t Size, bool EoR)>;
+	using Clock = std::chrono::steady_clock;
+
+	RpcPendingCallTable(uint32_t CapacityShift);
+	~RpcPendingCallTable();
+
+	// Completion is taken (left empty) only if the call is inserted.
+	bool Insert(CompletionRoutine&& Completion, uint32_t *Rsn);
+	bool Insert(CompletionRoutine&& Completion, Clock::time_point Deadline, uint32_t *Rsn);
+	bool Deliver(uint32_t Rsn, uint64_t Offset, const uint8_t *Chunk, uint32_t Size, bool EoR);
+	bool Abandon(uint32_t Rsn, RpcCallStatus Status);
+	uint32_t AbandonAll(RpcCallStatus Status);
+	uint32_t ExpireDue(Clock::time_point Now);
+
+	bool IsPending(uint32_t Rsn) const;
+	uint32_t PendingCount() const;
+	uint32_t Capacity() const;
+	// Rsn the slot of Rsn hands out after it: next generation, never generation 0.
+	uint32_t NextRsn(uint32_t Rsn) const;
+
+private:
+	enum SlotState : uint32_t
+	{
+		SlotFree = 0,		// Tag holds last Rsn used by this slot
+		SlotReserved,		// Insert in progress
+		SlotPending,		// Waiting for CallReturn
+		SlotBusy,			// Completion routine running
+	};
+
+	struct Slot
+	{
+		std::atomic<uint64_t> Tag;		// [63:32] Rsn, [31:0] SlotState
+		std::atomic<Clock::rep> Deadline;	// Clock ticks, 0 if none
+		CompletionRoutine Completion;
+	};
+
+	static uint64_t MakeTag(uint32_t Rsn, SlotState State);
+	void Release(Slot& Target, uint32_t Rsn);
+
+	uint32_t CapacityShift_;
+	uint32_t Mask_;
+	std::unique_ptr<Slot[]> Slots_;
+	std::atomic<uint32_t> NextIndex_;
+	std::atomic<uint32_t> PendingCount_;
+	std::atomic<uint32_t> DeadlineCount_;	// Pending calls with deadline, ExpireDue() scans only if any
+};
+
+}
+
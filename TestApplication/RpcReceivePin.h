@@ -0,0 +1,38 @@
+#pragma once
+
+#include "SRPCBase.h"
+#include "IOCPConnection.h"
+
+namespace SRPC
+{
+
+// 
+// Keeps a received frame in the receive ring buffer of the connection until destroyed, 
+// so that argument views into it stay valid after the chunk handler returned
+// (see SRPCFrameHandler::PinChunk). Holds a reference to the connection, which may be 
+// closed meanwhile, its ring buffer then goes away with the last pin.
+// 
+
+class RpcReceivePin
+{
+public:
+	RpcReceivePin(std::shared_ptr<IOCP::IOCPConnection> Connection, uint64_t Position) :
+		Connection_(std::move(Connection)),
+		Position_(Position)
+	{
+	}
+
+	~RpcReceivePin()
+	{
+		Connection_->UnpinReceived(Position_);
+	}
+
+	RpcReceivePin(const RpcReceivePin&) = delete;
+	RpcReceivePin& operator=(const RpcReceivePin&) = delete;
+
+private:
+	std::shared_ptr<IOCP::IOCPConnection> Connection_;
+	uint64_t Position_;		// Receive stream position of the pinned byte
+};
+
+}
@@ -0,0 +1,126 @@
+
+#include "RpcSchemaCache.h"
+#include "RpcTypeRecords.h"
+
+namespace SRPC
+{
+
+RpcSchemaCache::RpcSchemaCache()
+{
+}
+
+RpcSchemaCache::~RpcSchemaCache()
+{
+}
+
+uint64_t RpcSchemaCache::Fingerprint(const uint8_t * Record, uint32_t Size)
+{
+	RpcDigestHash128 Hash;
+	Hash.Update(Record, Size);
+	RpcDigestValue Value = Hash.Finalize();
+
+	return (static_cast<uint64_t>(Value.Value[1]) << 0x20) | Value.Value[0];
+}
+
+bool RpcSchemaCache::AddLocal(uint64_t Id, const uint8_t * Record, uint32_t Size)
+{
+	if (!Size || Size > MaxRecordSize)
+		return false;
+
+	uint64_t Key = Fingerprint(Record, Size);
+
+	std::lock_guard<decltype(Mutex_)> Lock(Mutex_);
+
+	auto ResultPair = LocalIds_.try_emplace(Id, Key);
+	if (!ResultPair.second)
+		return ResultPair.first->second == Key;
+
+	auto& Schema = Local_[Key];
+	if (Schema.Record.empty())
+	{
+		Schema.Record.assign(Record, Record + Size);
+		Schema.Acknowledged = false;
+	}
+
+	return true;
+}
+
+bool RpcSchemaCache::GetLocal(uint64_t Id, uint64_t * Fingerprint, std::vector<uint8_t>* Record)
+{
+	std::lock_guard<decltype(Mutex_)> Lock(Mutex_);
+
+	auto it = LocalIds_.find(Id);
+	if (it == LocalIds_.end())
+		return false;
+
+	auto& Schema = Local_[it->second];
+
+	*Fingerprint = it->second;
+
+	if (Schema.Acknowledged)
+		Record->clear();
+	else
+		*Record = Schema.Record;
+
+	return true;
+}
+
+void RpcSchemaCache::Acknowledge(uint64_t Fingerprint)
+{
+	std::lock_guard<decltype(Mutex_)> Lock(Mutex_);
+
+	auto it = Local_.find(Fingerprint);
+	if (it != Local_.end())
+		it->second.Acknowledged = true;
+}
+
+void RpcSchemaCache::Reject(uint64_t Fingerprint)
+{
+	// Peer does not have it (anymore), send the record again.
+	std::lock_guard<decltype(Mutex_)> Lock(Mutex_);
+
+	auto it = Local_.find(Fingerprint);
+	if (it != Local_.end())
+		it->second.Acknowledged = false;
+}
+
+bool RpcSchemaCache::AddPeer(uint64_t Fingerprint, const uint8_t * Record, uint32_t Size, bool * Added)
+{
+	*Added = false;
+
+	if (!Size || Size > MaxRecordSize || RpcSchemaCache::Fingerprint(Record, Size) != Fingerprint)
+		return false;
+
+	// Only well-formed records within RpcTypeRecordLimits are cached.
+	if (!RpcTypeRecords::Deserialize(Record, Size))
+		return false;
+
+	std::lock_guard<decltype(Mutex_)> Lock(Mutex_);
+
+	if (Peer_.find(Fingerprint) != Peer_.end())
+		return true;
+
+	if (Peer_.size() >= MaxPeerSchemas)
+		return false;
+
+	Peer_.try_emplace(Fingerprint, Record, Record + Size);
+	*Added = true;
+
+	return true;
+}
+
+bool RpcSchemaCache::FindPeer(uint64_t Fingerprint, std::vector<uint8_t>* Record)
+{
+	std::lock_guard<decltype(Mutex_)> Lock(Mutex_);
+
+	auto it = Peer_.find(Fingerprint);
+	if (it == Peer_.end())
+		return false;
+
+	if (Record)
+		*Record = it->second;
+
+	return true;
+}
+
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "RpcDigest.h"
+
+namespace SRPC
+{
+
+// 
+// Type records negotiated on a connection, keyed by fingerprint (64 bits of Hash128 over 
+// the record as written by RpcTypeRecords::Serialize). A call carries its record until the peer
+// acknowledges the fingerprint, then only the fingerprint. Calls with the same signature share one entry.
+// 
+
+class RpcSchemaCache
+{
+public:
+	constexpr static const uint32_t MaxRecordSize = 0x4000;
+	constexpr static const size_t MaxPeerSchemas = 0x400;
+
+	RpcSchemaCache();
+	~RpcSchemaCache();
+
+	static uint64_t Fingerprint(const uint8_t *Record, uint32_t Size);
+
+	// Schemas of calls we make. Record is left empty once the peer acknowledged it.
+	bool AddLocal(uint64_t Id, const uint8_t *Record, uint32_t Size);
+	bool GetLocal(uint64_t Id, uint64_t *Fingerprint, std::vector<uint8_t> *Record);
+	void Acknowledge(uint64_t Fingerprint);
+	void Reject(uint64_t Fingerprint);
+
+	// Schemas of calls the peer makes. Returns false if record is malformed, does not match fingerprint or cache is full.
+	bool AddPeer(uint64_t Fingerprint, const uint8_t *Record, uint32_t Size, bool *Added);
+	bool FindPeer(uint64_t Fingerprint, std::vector<uint8_t> *Record);
+
+private:
+	struct LocalSchema
+	{
+		std::vector<uint8_t> Record;
+		bool Acknowledged;
+	};
+
+	std::mutex Mutex_;
+	std::map<uint64_t, uint64_t> LocalIds_;				// <Id, Fingerprint>
+	std::map<uint64_t, LocalSchema> Local_;				// <Fingerprint, LocalSchema>
+	std::map<uint64_t, std::vector<uint8_t>> Peer_;		// <Fingerprint, Record>
+};
+
+}
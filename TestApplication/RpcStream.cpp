@@ -0,0 +1,384 @@
+
+#include "RpcStream.h"
+
+namespace SRPC
+{
+
+RpcStreamWriter::RpcStreamWriter(uint32_t ChunkSize, FrameSink Sink) :
+	ChunkSize_(ChunkSize),
+	Sink_(Sink),
+	NextFsn_(0),
+	PumpRequested_(false),
+	Digest_(nullptr)
+{
+	Assert(ChunkSize_ > 0);
+
+	for (auto& Lane : Lanes_)
+	{
+		Lane.Frame = std::make_unique<uint8_t[]>(RpcFrame::HeaderSize + ChunkSize);
+		Lane.FrameSize = 0;
+	}
+}
+
+RpcStreamWriter::~RpcStreamWriter()
+{
+}
+
+bool RpcStreamWriter::Queue(RpcFrameType Type, uint32_t Rsn, bool Response, uint64_t MessageSize, ChunkSource Source)
+{
+	return Queue(Type, Rsn, Response, MessageSize, Source, 0);
+}
+
+bool RpcStreamWriter::Queue(RpcFrameType Type, uint32_t Rsn, bool Response, uint64_t MessageSize, ChunkSource Source, uint16_t Flags)
+{
+	// Flags must not overlap with those set by the writer.
+	if (Flags & ~(RpcFrameHeaderLayout::FlagsDeadline | RpcFrameHeaderLayout::FlagsSchema | RpcFrameHeaderLayout::FlagsCompact))
+		return false;
+
+	if (!RpcFrame::IsValidType(static_cast<uint16_t>(Type)))
+		return false;
+
+	if (MessageSize && !Source)
+		return false;
+
+	std::lock_guard<decltype(Mutex_)> Lock(Mutex_);
+
+	auto& Lane = Lanes_[Response ? LaneResponse : LaneRequest];
+
+	for (auto& it : Lane.Streams)
+	{
+		if (it.Rsn == Rsn)
+			return false; // already streaming
+	}
+
+	StreamState State;
+	State.Type = Type;
+	State.Rsn = Rsn;
+	State.Response = Response;
+	State.Flags = Flags;
+	State.MessageSize = MessageSize;
+	State.Offset = 0;
+	State.Source = Source;
+
+	Lane.Streams.push_back(std::move(State));
+
+	return true;
+}
+
+bool RpcStreamWriter::Queue(RpcFrameType Type, uint32_t Rsn, bool Response, const uint8_t * Message, uint64_t MessageSize)
+{
+	return Queue(Type, Rsn, Response, Message, MessageSize, 0);
+}
+
+bool RpcStreamWriter::Queue(RpcFrameType Type, uint32_t Rsn, bool Response, const uint8_t * Message, uint64_t MessageSize, uint16_t Flags)
+{
+	// Message must remain valid until the last chunk is accepted by the sink.
+	uint64_t Offset = 0;
+
+	return Queue(Type, Rsn, Response, MessageSize, [Message, MessageSize, Offset](uint8_t *Buffer, uint32_t Size) mutable
+	{
+		uint32_t Count = static_cast<uint32_t>(std::min<uint64_t>(Size, MessageSize - Offset));
+		memcpy(Buffer, Message + Offset, Count);
+		Offset += Count;
+		return Count;
+	}, Flags);
+}
+
+uint32_t RpcStreamWriter::Pump()
+{
+	// 
+	// Emit chunk frames round-robin (responses first) until sink refuses or nothing remains.
+	// Returns number of frames accepted by the sink.
+	// 
+	// Sink is called under Mutex_ and typically takes the connection send lock, while
+	// send completion calls Pump() with that lock held. So Pump() never blocks on Mutex_:
+	// if another thread is pumping, the request is left in PumpRequested_ for it to pick up.
+	// 
+
+	uint32_t FramesSent = 0;
+
+	PumpRequested_ = true;
+
+	while (PumpRequested_)
+	{
+		std::unique_lock<decltype(Mutex_)> Lock(Mutex_, std::try_to_lock);
+		if (!Lock.owns_lock())
+			break; // Owner rechecks PumpRequested_ after unlock.
+
+		PumpRequested_ = false;
+		FramesSent += PumpFrames();
+	}
+
+	return FramesSent;
+}
+
+bool RpcStreamWriter::SendControl(RpcFrameType Type, uint32_t Rsn, bool Response, const uint8_t * Body, uint32_t Size)
+{
+	// 
+	// Single-frame control message sent ahead of queued streams, so that it cannot be 
+	// held up behind a frame the sink refuses (e.g. flow control stall).
+	// It may overtake such a frame, so Fsn on the wire is not strictly increasing.
+	// Never blocks on Mutex_, may be called from send completion.
+	// 
+
+	if (!RpcFrame::IsValidType(static_cast<uint16_t>(Type)) || Size > MaxControlBodySize)
+		return false;
+
+	ControlMessage Message;
+	Message.Type = Type;
+	Message.Rsn = Rsn;
+	Message.Response = Response;
+	Message.Size = Size;
+	if (Size)
+		memcpy(Message.Body, Body, Size);
+
+	{
+		std::lock_guard<decltype(ControlMutex_)> Lock(ControlMutex_);
+		Controls_.push_back(Message);
+	}
+
+	Pump();
+
+	return true;
+}
+
+uint32_t RpcStreamWriter::PendingCount()
+{
+	std::lock_guard<decltype(Mutex_)> Lock(Mutex_);
+
+	size_t Count = 0;
+	for (auto& Lane : Lanes_)
+		Count += Lane.Streams.size() + (Lane.FrameSize ? 1 : 0);
+
+	Assert(!(Count & 0xffffffff00000000ull));
+	return static_cast<uint32_t>(Count);
+}
+
+uint32_t RpcStreamWriter::ChunkSize() const
+{
+	return ChunkSize_;
+}
+
+void RpcStreamWriter::SetDigestType(RpcDigestType Type)
+{
+	std::lock_guard<decltype(Mutex_)> Lock(Mutex_);
+	Digest_ = Digests_.Select(Type);
+}
+
+uint32_t RpcStreamWriter::PumpFrames()
+{
+	uint32_t FramesSent = 0;
+
+	while (true)
+	{
+		ControlMessage Message;
+		bool HasControl = false;
+		{
+			std::lock_guard<decltype(ControlMutex_)> Lock(ControlMutex_);
+			if (!Controls_.empty())
+			{
+				Message = Controls_.front();
+				Controls_.pop_front();
+				HasControl = true;
+			}
+		}
+
+		if (HasControl)
+		{
+			uint8_t Frame[RpcFrame::HeaderSize + MaxControlBodySize];
+			memcpy(Frame + RpcFrame::HeaderSize, Message.Body, Message.Size);
+
+			uint32_t FrameSize = WriteFrameHeader(Frame, Message.Type, Message.Rsn, Message.Response, true, 0, Message.Size);
+
+			if (!Sink_(Frame, FrameSize))
+			{
+				NextFsn_--; // Not sent, keep Fsn contiguous.
+
+				std::lock_guard<decltype(ControlMutex_)> Lock(ControlMutex_);
+				Controls_.push_front(Message);
+				break;
+			}
+
+			FramesSent++;
+			continue;
+		}
+
+		// One frame at a time, control messages and higher lanes are rechecked after each.
+		bool FrameSent = false;
+		for (auto& Lane : Lanes_)
+		{
+			if (PumpLane(Lane))
+			{
+				FrameSent = true;
+				break;
+			}
+		}
+
+		if (!FrameSent)
+			break;
+
+		FramesSent++;
+	}
+
+	return FramesSent;
+}
+
+bool RpcStreamWriter::PumpLane(LaneState & Lane)
+{
+	// Returns true if a frame was accepted by the sink.
+
+	while (!Lane.FrameSize)
+	{
+		if (Lane.Streams.empty())
+			return false;
+
+		auto State = std::move(Lane.Streams.front());
+		Lane.Streams.pop_front();
+
+		if (!BuildFrame(State, Lane.Frame.get(), &Lane.FrameSize))
+		{
+			Trace("!! Chunk source failed [Rsn %u, offset %llu]\n", State.Rsn, State.Offset);
+			continue; // drop the stream
+		}
+
+		// Move to back of the queue if more chunks remain.
+		if (State.Offset < State.MessageSize)
+			Lane.Streams.push_back(std::move(State));
+	}
+
+	if (!Sink_(Lane.Frame.get(), Lane.FrameSize))
+		return false;
+
+	Lane.FrameSize = 0;
+
+	return true;
+}
+
+bool RpcStreamWriter::BuildFrame(StreamState & State, uint8_t * Frame, uint32_t * FrameSize)
+{
+	uint32_t Count = static_cast<uint32_t>(
+		std::min<uint64_t>(ChunkSize_, State.MessageSize - State.Offset));
+
+	uint8_t *Body = Frame + RpcFrame::HeaderSize;
+	if (Count && State.Source(Body, Count) != Count)
+		return false;
+
+	State.Offset += Count;
+
+	*FrameSize = WriteFrameHeader(Frame, State.Type, State.Rsn, State.Response, 
+		State.Offset >= State.MessageSize, State.Flags, Count);
+
+	return true;
+}
+
+uint32_t RpcStreamWriter::WriteFrameHeader(uint8_t * Frame, RpcFrameType Type, uint32_t Rsn, bool Response, bool EoR, uint16_t Flags, uint32_t BodySize)
+{
+	// Body is already in place after the header.
+	const uint8_t *Body = Frame + RpcFrame::HeaderSize;
+
+	RpcFrameHeader Header;
+	RpcFrame::InitializeHeader(Header, Type, Rsn, Response, EoR);
+	Header.u.Flags |= Flags;
+	Header.Fsn = NextFsn_++;
+	Header.Length = BodySize;
+
+	if (Digest_)
+	{
+		Header.u.Bitfields.Digest = static_cast<uint16_t>(Digest_->Type());
+
+		Digest_->Reset();
+		RpcFrame::UpdateDigestHeader(Digest_, Header);
+		Digest_->Update(Body, BodySize);
+		RpcFrame::SetDigest(Header, Digest_->Finalize());
+	}
+
+	size_t HeaderSize = RpcFrame::WriteHeader(Header, Frame, RpcFrame::HeaderSize);
+	Assert(HeaderSize == RpcFrame::HeaderSize);
+
+	return static_cast<uint32_t>(HeaderSize) + BodySize;
+}
+
+RpcStreamReader::RpcStreamReader(uint32_t MaxStreams, ChunkHandler Handler) :
+	MaxStreams_(MaxStreams),
+	Handler_(Handler)
+{
+}
+
+RpcStreamReader::~RpcStreamReader()
+{
+}
+
+bool RpcStreamReader::ReceiveFrame(const RpcFrameHeader & Header, const uint8_t * Body, uint32_t Size)
+{
+	return DeliverChunk(Header, Body, Size, true);
+}
+
+bool RpcStreamReader::ReceiveFrame(const RpcFrameHeader & Header, const RpcFrameSegment * Body, uint32_t BodyCount)
+{
+	// Frame body may be split (e.g. ring buffer wraparound), each part is delivered as a chunk.
+	if (!BodyCount)
+		return DeliverChunk(Header, nullptr, 0, true);
+
+	for (uint32_t i = 0; i < BodyCount; i++)
+	{
+		if (!DeliverChunk(Header, Body[i].Pointer, Body[i].Size, i + 1 == BodyCount))
+			return false;
+	}
+
+	return true;
+}
+
+uint32_t RpcStreamReader::ActiveCount() const
+{
+	size_t Count = Streams_.size();
+	Assert(!(Count & 0xffffffff00000000ull));
+	return static_cast<uint32_t>(Count);
+}
+
+uint64_t RpcStreamReader::StreamKey(const RpcFrameHeader & Header)
+{
+	return (static_cast<uint64_t>(Header.Rsn) << 1) | Header.u.Bitfields.Response;
+}
+
+bool RpcStreamReader::DeliverChunk(const RpcFrameHeader & Header, const uint8_t * Chunk, uint32_t Size, bool LastChunk)
+{
+	uint64_t Key = StreamKey(Header);
+	bool EoR = LastChunk && !!Header.u.Bitfields.EoR;
+
+	auto it = Streams_.find(Key);
+	if (it == Streams_.end())
+	{
+		if (Streams_.size() >= MaxStreams_)
+		{
+			Trace("!! Too many streams in progress [Rsn %u]\n", Header.Rsn);
+			return false;
+		}
+
+		StreamState State;
+		State.Type = Header.Type;
+		State.Offset = 0;
+
+		it = Streams_.emplace(Key, State).first;
+	}
+	else if (it->second.Type != Header.Type)
+	{
+		// Frame type must not change within a message.
+		Trace("!! Frame type mismatch in stream [Rsn %u, %hu != %hu]\n", Header.Rsn, Header.Type, it->second.Type);
+		Streams_.erase(it);
+		return false;
+	}
+
+	uint64_t Offset = it->second.Offset;
+	it->second.Offset += Size;
+
+	if (EoR)
+		Streams_.erase(it);
+
+	if (Handler_)
+		return Handler_(Header, Offset, Chunk, Size, EoR);
+
+	return true;
+}
+
+}
+
@@ -0,0 +1,130 @@
+#pragma once
+
+#include "Rpc.h"
+#include "RpcFrame.h"
+
+namespace SRPC
+{
+
+// 
+// Multi-frame message streaming.
+// A message is split into chunk frames of at most ChunkSize bytes, 
+// the last one marked with EoR. Chunks from different Rsn are interleaved 
+// round-robin so that one large call cannot starve the others.
+// Responses have their own lane, served ahead of requests, so that a small CallReturn 
+// is not queued behind a bulk call.
+// 
+
+class RpcStreamWriter
+{
+public:
+	// Fills Buffer with next Size bytes of the message. Returns bytes filled.
+	using ChunkSource = std::function<uint32_t(uint8_t *Buffer, uint32_t Size)>;
+
+	// Sends one complete frame. Returns false if frame cannot be queued now (retried later).
+	using FrameSink = std::function<bool(uint8_t *Frame, uint32_t Size)>;
+
+	constexpr static const uint32_t MaxControlBodySize = 0x40;
+
+	RpcStreamWriter(uint32_t ChunkSize, FrameSink Sink);
+	~RpcStreamWriter();
+
+	bool Queue(RpcFrameType Type, uint32_t Rsn, bool Response, uint64_t MessageSize, ChunkSource Source);
+	bool Queue(RpcFrameType Type, uint32_t Rsn, bool Response, uint64_t MessageSize, ChunkSource Source, uint16_t Flags);
+	bool Queue(RpcFrameType Type, uint32_t Rsn, bool Response, const uint8_t *Message, uint64_t MessageSize);
+	bool Queue(RpcFrameType Type, uint32_t Rsn, bool Response, const uint8_t *Message, uint64_t MessageSize, uint16_t Flags);
+
+	uint32_t Pump();
+	bool SendControl(RpcFrameType Type, uint32_t Rsn, bool Response, const uint8_t *Body, uint32_t Size);
+
+	uint32_t PendingCount();
+	uint32_t ChunkSize() const;
+
+	void SetDigestType(RpcDigestType Type);
+
+private:
+	struct StreamState
+	{
+		RpcFrameType Type;
+		uint32_t Rsn;
+		bool Response;
+		uint16_t Flags;			// Extra header flags of every frame (e.g. Deadline)
+		uint64_t MessageSize;
+		uint64_t Offset;		// Bytes already framed
+		ChunkSource Source;
+	};
+
+	enum StreamLane : uint32_t
+	{
+		LaneResponse = 0,
+		LaneRequest,
+		LaneMax,
+	};
+
+	struct LaneState
+	{
+		std::deque<StreamState> Streams;	// Round-robin order
+		std::unique_ptr<uint8_t[]> Frame;	// Frame built but not yet accepted by sink
+		uint32_t FrameSize;
+	};
+
+	struct ControlMessage
+	{
+		RpcFrameType Type;
+		uint32_t Rsn;
+		bool Response;
+		uint32_t Size;
+		uint8_t Body[MaxControlBodySize];
+	};
+
+	uint32_t PumpFrames();
+	bool PumpLane(LaneState& Lane);
+	bool BuildFrame(StreamState& State, uint8_t *Frame, uint32_t *FrameSize);
+	uint32_t WriteFrameHeader(uint8_t *Frame, RpcFrameType Type, uint32_t Rsn, bool Response, bool EoR, uint16_t Flags, uint32_t BodySize);
+
+	std::recursive_mutex Mutex_;
+	uint32_t ChunkSize_;
+	FrameSink Sink_;
+	LaneState Lanes_[LaneMax];
+	uint64_t NextFsn_;
+	std::atomic<bool> PumpRequested_;
+
+	std::mutex ControlMutex_;				// Never held while calling sink
+	std::deque<ControlMessage> Controls_;	// Sent before stream frames
+
+	RpcDigestSet Digests_;
+	RpcDigestEngine *Digest_;				// nullptr if digest is off
+};
+
+class RpcStreamReader
+{
+public:
+	// Receives message chunks in order. Offset is position of chunk in the message.
+	using ChunkHandler = std::function<bool(const RpcFrameHeader& Header, uint64_t Offset, const uint8_t *Chunk, uint32_t Size, bool EoR)>;
+
+	RpcStreamReader(uint32_t MaxStreams, ChunkHandler Handler);
+	~RpcStreamReader();
+
+	bool ReceiveFrame(const RpcFrameHeader& Header, const uint8_t *Body, uint32_t Size);
+	bool ReceiveFrame(const RpcFrameHeader& Header, const RpcFrameSegment *Body, uint32_t BodyCount);
+
+	uint32_t ActiveCount() const;
+
+private:
+	static uint64_t StreamKey(const RpcFrameHeader& Header);
+
+	bool DeliverChunk(const RpcFrameHeader& Header, const uint8_t *Chunk, uint32_t Size, bool LastChunk);
+
+	struct StreamState
+	{
+		uint16_t Type;
+		uint64_t Offset;		// Bytes delivered so far
+	};
+
+	uint32_t MaxStreams_;
+	ChunkHandler Handler_;
+	std::map<uint64_t, StreamState> Streams_;	// <(Rsn << 1) | Response, StreamState>
+};
+
+}
+
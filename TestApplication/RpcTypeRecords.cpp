@@ -3,7 +3,7 @@
 namespace SRPC
 {
 
-RpcTypeRecords::RpcTypeRecords() : UDT_{}
+RpcTypeRecords::RpcTypeRecords() : UDTIndex_{}, Names_(1, 0)
 {
 }
 
@@ -17,12 +17,9 @@ uint16_t RpcTypeRecords::AddUDT(uint16_t TypeId, uint8_t PackingShift, const cha
 	if (!NewTypeId)
 		return 0;
 
-	auto& TypeInfo = UDT_[NewTypeId];
+	auto& TypeInfo = *FindTypeInfo(NewTypeId);
 	TypeInfo.Struct.PackingShift = PackingShift;
-	if (Name)
-		strcpy_s(TypeInfo.Struct.Name, Name);
-	else
-		TypeInfo.Struct.Name[0] = 0;
+	TypeInfo.Struct.NameOffset = InternName(Name);
 
 	return NewTypeId;
 }
@@ -32,18 +29,43 @@ uint8_t RpcTypeRecords::AddField(uint16_t TypeId, uint16_t FieldTypeId)
 	if (!IsTypeIdInUDTRange(TypeId))
 		return ~0; // we accept only UDT
 
-	if (!IsTypeIdInUDTRange(FieldTypeId) && !IsTypeIdPrimitive(FieldTypeId))
-		return ~0; // neither UDT nor primitive type
-
 	if (TypeId == FieldTypeId)
 		return ~0; // typeid circular reference
 
-	auto& TypeInfo = UDT_[TypeId];
-	if (TypeInfo.Struct.FieldsCount >= std::size(TypeInfo.Struct.FieldTypes))
+	auto Info = FindTypeInfo(TypeId);
+	if (!Info || Info->Struct.FieldsCount >= MaxFieldsCount)
 		return ~0;
 
+	auto& TypeInfo = *Info;
+	if (!IsFieldTypeIdValid(TypeId, TypeInfo.Struct.FieldsCount, FieldTypeId))
+		return ~0; // neither UDT nor primitive type
+
+	if (TypeInfo.Struct.FieldsCount == TypeInfo.Struct.FieldsCapacity)
+	{
+		uint32_t End = TypeInfo.Struct.FieldsIndex + TypeInfo.Struct.FieldsCapacity;
+		uint32_t Capacity = std::min<uint32_t>(std::max<uint32_t>(TypeInfo.Struct.FieldsCapacity * 2, 4), MaxFieldsCount);
+
+		if (End != FieldTypes_.size() || !TypeInfo.Struct.FieldsCapacity)
+		{
+			// Not the last run, move it to the end of the pool (its old slots are left unused).
+			uint32_t Index = static_cast<uint32_t>(FieldTypes_.size());
+			FieldTypes_.resize(Index + Capacity);
+			std::copy_n(FieldTypes_.begin() + TypeInfo.Struct.FieldsIndex, TypeInfo.Struct.FieldsCount, FieldTypes_.begin() + Index);
+			TypeInfo.Struct.FieldsIndex = Index;
+		}
+		else
+		{
+			// Last run grows in place.
+			FieldTypes_.resize(TypeInfo.Struct.FieldsIndex + Capacity);
+		}
+
+		TypeInfo.Struct.FieldsCapacity = static_cast<uint8_t>(Capacity);
+	}
+
 	uint8_t FieldId = TypeInfo.Struct.FieldsCount++;
-	TypeInfo.Struct.FieldTypes[FieldId].TypeId = FieldTypeId;
+	auto& FieldTypeInfo = FieldTypes_[TypeInfo.Struct.FieldsIndex + FieldId];
+	FieldTypeInfo = RpcTypeBaseInfo{};
+	FieldTypeInfo.TypeId = FieldTypeId;
 
 	return FieldId;
 }
@@ -57,12 +79,12 @@ bool RpcTypeRecords::SetArrayAttribute(uint16_t TypeId, uint32_t ArrayCount)
 {
 	// Set array attribute for UDT.
 
-	if (!IsTypeIdInUDTRange(TypeId))
+	auto TypeInfo = FindTypeInfo(TypeId);
+	if (!TypeInfo)
 		return false;
 
-	auto& TypeInfo = UDT_[TypeId];
-	TypeInfo.Base.Attributes |= RpcTypeAttributes::Array;
-	TypeInfo.Base.Array.Count = ArrayCount;
+	TypeInfo->Base.Attributes |= RpcTypeAttributes::Array;
+	TypeInfo->Base.Array.Count = ArrayCount;
 
 	return true;
 }
@@ -71,16 +93,12 @@ bool RpcTypeRecords::SetArrayAttribute(uint16_t TypeId, uint8_t FieldId, uint32_
 {
 	// Set array attribute for field.
 
-	if (!IsTypeIdInUDTRange(TypeId))
-		return false;
-
-	auto& TypeInfo = UDT_[TypeId];
-	if (FieldId >= std::size(TypeInfo.Struct.FieldTypes))
+	auto FieldInfo = FindFieldType(TypeId, FieldId);
+	if (!FieldInfo)
 		return false;
 
-	auto& FieldInfo = TypeInfo.Struct.FieldTypes[FieldId];
-	FieldInfo.Attributes |= RpcTypeAttributes::Array;
-	FieldInfo.Array.Count = ArrayCount;
+	FieldInfo->Attributes |= RpcTypeAttributes::Array;
+	FieldInfo->Array.Count = ArrayCount;
 
 	return true;
 }
@@ -89,11 +107,11 @@ bool RpcTypeRecords::SetOutAttribute(uint16_t TypeId)
 {
 	// Set output attribute for UDT.
 
-	if (!IsTypeIdInUDTRange(TypeId))
+	auto TypeInfo = FindTypeInfo(TypeId);
+	if (!TypeInfo)
 		return false;
 
-	auto& TypeInfo = UDT_[TypeId];
-	TypeInfo.Base.Attributes |= RpcTypeAttributes::OutAttribute;
+	TypeInfo->Base.Attributes |= RpcTypeAttributes::OutAttribute;
 
 	return true;
 }
@@ -102,19 +120,235 @@ bool RpcTypeRecords::SetOutAttribute(uint16_t TypeId, uint8_t FieldId)
 {
 	// Set output attribute for field.
 
-	if (!IsTypeIdInUDTRange(TypeId))
+	auto FieldInfo = FindFieldType(TypeId, FieldId);
+	if (!FieldInfo)
+		return false;
+
+	FieldInfo->Attributes |= RpcTypeAttributes::OutAttribute;
+
+	return true;
+}
+
+const RpcTypeInfo * RpcTypeRecords::GetTypeInfo(uint16_t TypeId) const
+{
+	// UDT only, nullptr if not defined.
+	return const_cast<RpcTypeRecords *>(this)->FindTypeInfo(TypeId);
+}
+
+const RpcTypeBaseInfo * RpcTypeRecords::GetFieldTypes(uint16_t TypeId) const
+{
+	// Valid until next AddUDT()/AddField().
+	auto Info = GetTypeInfo(TypeId);
+	if (!Info || !Info->Struct.FieldsCount)
+		return nullptr;
+
+	return FieldTypes_.data() + Info->Struct.FieldsIndex;
+}
+
+const char * RpcTypeRecords::GetName(uint16_t TypeId) const
+{
+	auto Info = GetTypeInfo(TypeId);
+	return Info ? Names_.data() + Info->Struct.NameOffset : nullptr;
+}
+
+bool RpcTypeRecords::GetLayout(uint16_t TypeId, RpcTypeLayout * Layout) const
+{
+	LayoutMap Layouts;
+	return GetLayout(TypeId, Layouts, Layout);
+}
+
+bool RpcTypeRecords::GetFieldLayout(const RpcTypeBaseInfo & Field, RpcTypeLayout * Layout) const
+{
+	LayoutMap Layouts;
+	return GetFieldLayout(Field, Layouts, Layout);
+}
+
+bool RpcTypeRecords::IsWireIdentical(uint16_t TypeId) const
+{
+	RpcTypeLayout Layout;
+	return GetLayout(TypeId, &Layout) && Layout.WireIdentical;
+}
+
+uint32_t RpcTypeRecords::GetPrimitiveSize(uint16_t TypeId)
+{
+	switch (static_cast<RpcTypeId>(TypeId))
+	{
+	case RpcTypeId::INT_8:
+	case RpcTypeId::INT_8U:
+	case RpcTypeId::CP_8:
+		return 1;
+
+	case RpcTypeId::INT_16:
+	case RpcTypeId::INT_16U:
+	case RpcTypeId::CP_16:
+		return 2;
+
+	case RpcTypeId::INT_32:
+	case RpcTypeId::INT_32U:
+	case RpcTypeId::FLOAT_32:
+	case RpcTypeId::CP_32:
+	case RpcTypeId::PTR_32:
+		return 4;
+
+	case RpcTypeId::INT_64:
+	case RpcTypeId::INT_64U:
+	case RpcTypeId::FLOAT_64:
+	case RpcTypeId::PTR_64:
+		return 8;
+
+	default:
+		return 0;
+	}
+}
+
+bool RpcTypeRecords::GetLayout(uint16_t TypeId, LayoutMap & Layouts, RpcTypeLayout * Layout) const
+{
+	if (IsTypeIdPrimitive(TypeId))
+	{
+		Layout->Size = GetPrimitiveSize(TypeId);
+		Layout->Alignment = Layout->Size;
+
+		// Pointers are meaningless to the peer, they are never part of a block.
+		Layout->WireIdentical = SRPC_LITTLE_ENDIAN &&
+			TypeId != static_cast<uint16_t>(RpcTypeId::PTR_32) &&
+			TypeId != static_cast<uint16_t>(RpcTypeId::PTR_64);
+
+		return !!Layout->Size;
+	}
+
+	auto it = Layouts.find(TypeId);
+	if (it != Layouts.end())
+	{
+		*Layout = it->second;
+		return Layout->Size != LayoutInProgress; // Circular reference otherwise
+	}
+
+	auto Info = GetTypeInfo(TypeId);
+	if (!Info ||
+		TypeId == static_cast<uint16_t>(RpcTypeId::PARAM_LIST) ||
+		Info->Struct.PackingShift > 4)
 		return false;
 
-	auto& TypeInfo = UDT_[TypeId];
-	if (FieldId >= std::size(TypeInfo.Struct.FieldTypes))
+	Layouts[TypeId] = RpcTypeLayout{ LayoutInProgress, 0, false };
+
+	auto FieldTypes = GetFieldTypes(TypeId);
+	uint32_t Packing = 1u << Info->Struct.PackingShift;
+	uint64_t Offset = 0;
+	uint64_t FieldsSize = 0;
+	uint32_t Alignment = 1;
+	bool WireIdentical = true;
+
+	for (uint8_t FieldId = 0; FieldId < Info->Struct.FieldsCount; FieldId++)
+	{
+		RpcTypeLayout FieldLayout;
+		if (!GetFieldLayout(FieldTypes[FieldId], Layouts, &FieldLayout))
+			return false;
+
+		uint32_t FieldAlignment = std::min(FieldLayout.Alignment, Packing);
+		Offset = (Offset + FieldAlignment - 1) / FieldAlignment * FieldAlignment + FieldLayout.Size;
+		FieldsSize += FieldLayout.Size;
+		Alignment = std::max(Alignment, FieldAlignment);
+		WireIdentical &= FieldLayout.WireIdentical;
+	}
+
+	Offset = (Offset + Alignment - 1) / Alignment * Alignment;
+	if (Offset >= LayoutInProgress)
+		return false;
+
+	Layout->Size = static_cast<uint32_t>(Offset);
+	Layout->Alignment = Alignment;
+	Layout->WireIdentical = WireIdentical && FieldsSize == Offset; // No padding between or after fields
+	Layouts[TypeId] = *Layout;
+
+	return true;
+}
+
+bool RpcTypeRecords::GetFieldLayout(const RpcTypeBaseInfo & Field, LayoutMap & Layouts, RpcTypeLayout * Layout) const
+{
+	if (!GetLayout(Field.TypeId, Layouts, Layout))
+		return false;
+
+	if (Field.Attributes & RpcTypeAttributes::Array)
+	{
+		uint64_t Size = static_cast<uint64_t>(Layout->Size) * Field.Array.Count;
+		if (Size >= LayoutInProgress)
+			return false;
+
+		Layout->Size = static_cast<uint32_t>(Size);
+	}
+
+	return true;
+}
+
+bool RpcTypeRecords::GetDepth(uint16_t TypeId, std::map<uint16_t, uint32_t>& Depths, uint32_t * Depth) const
+{
+	// Types are known to be defined and not circular (see Validate).
+	if (IsTypeIdPrimitive(TypeId))
+	{
+		*Depth = 0;
+		return true;
+	}
+
+	auto it = Depths.find(TypeId);
+	if (it != Depths.end())
+	{
+		*Depth = it->second;
+		return true;
+	}
+
+	auto Info = GetTypeInfo(TypeId);
+	if (!Info)
 		return false;
 
-	auto& FieldInfo = TypeInfo.Struct.FieldTypes[FieldId];
-	FieldInfo.Attributes |= RpcTypeAttributes::OutAttribute;
+	auto FieldTypes = GetFieldTypes(TypeId);
+	uint32_t FieldsDepth = 0;
+
+	for (uint8_t FieldId = 0; FieldId < Info->Struct.FieldsCount; FieldId++)
+	{
+		uint32_t FieldDepth = 0;
+		if (!GetDepth(FieldTypes[FieldId].TypeId, Depths, &FieldDepth))
+			return false;
+
+		FieldsDepth = std::max(FieldsDepth, FieldDepth);
+	}
 
+	*Depth = Depths[TypeId] = FieldsDepth + 1;
 	return true;
 }
 
+bool RpcTypeRecords::Validate(const RpcTypeRecordLimits & Limits) const
+{
+	const uint16_t ParamListTypeId = static_cast<uint16_t>(RpcTypeId::PARAM_LIST);
+
+	auto Info = GetTypeInfo(ParamListTypeId);
+	if (!Info)
+		return false;
+
+	auto FieldTypes = GetFieldTypes(ParamListTypeId);
+	LayoutMap Layouts;
+	std::map<uint16_t, uint32_t> Depths;
+	uint64_t NativeSize = 0;
+
+	for (uint8_t FieldId = 0; FieldId < Info->Struct.FieldsCount; FieldId++)
+	{
+		auto& Field = FieldTypes[FieldId];
+		if (Field.TypeId == static_cast<uint16_t>(RpcTypeId::Undefined))
+			continue; // void return
+
+		// Layout first, it rejects undefined and circular types.
+		RpcTypeLayout Layout;
+		uint32_t Depth = 0;
+		if (!GetFieldLayout(Field, Layouts, &Layout) ||
+			!GetDepth(Field.TypeId, Depths, &Depth) ||
+			Depth > Limits.MaxDepth)
+			return false;
+
+		NativeSize += Layout.Size;
+	}
+
+	return NativeSize <= Limits.MaxNativeSize;
+}
+
 size_t RpcTypeRecords::Serialize(uint8_t * Buffer, size_t Size)
 {
 	// FunctionCallTypeRecord: <LEN1><PARAM_LIST> <LEN2><REF_TYPE_LIST>
@@ -152,74 +386,81 @@ size_t RpcTypeRecords::Serialize(uint8_t * Buffer, size_t Size)
 	return Stream.Current();
 }
 
-RpcTypeRecords * RpcTypeRecords::Deserialize(uint8_t * Buffer, size_t Size)
+std::unique_ptr<RpcTypeRecords> RpcTypeRecords::Deserialize(const uint8_t * Buffer, size_t Size)
 {
+	return Deserialize(Buffer, Size, RpcTypeRecordLimits{});
+}
+
+std::unique_ptr<RpcTypeRecords> RpcTypeRecords::Deserialize(const uint8_t * Buffer, size_t Size, const RpcTypeRecordLimits & Limits)
+{
+	// Record layout is in Serialize(). A UDT record takes at least 5 bytes and a field 3,
+	// so both pools are sized once from Size and fields are written in place, one run per UDT.
+
 	auto TypeRecords = std::make_unique<RpcTypeRecords>();
+	auto& UDT = TypeRecords->UDT_;
+	auto& FieldTypes = TypeRecords->FieldTypes_;
 
-	ByteStream Stream(Buffer, Size);
-	bool Result = true;
+	UDT.reserve(std::min<size_t>(std::min<size_t>(Limits.MaxTypes, UDTCount), Size / 5));
+	FieldTypes.reserve(std::min<size_t>(Limits.MaxFields, Size / 3));
 
-	uint16_t TypeId = 0;
-	RpcTypeAttributes Attributes = RpcTypeAttributes::None;
-	uint32_t ArrayCount = 0;
-	uint8_t PackingShift = 0;
-	uint8_t FieldsCount = 0;
+	const RpcTypeAttributes KnownAttributes = RpcTypeAttributes::Array | RpcTypeAttributes::OutAttribute;
 
-	while (Result && Stream.Remaining())
-	{
-		// Read header.
-		Result &=
-			Stream.Read2(&TypeId) &&
-			Stream.Read1(reinterpret_cast<uint8_t *>(&Attributes));
+	ByteStream Stream(const_cast<uint8_t *>(Buffer), Size);
 
-		if (!Result ||
-			!IsTypeIdInUDTRange(TypeId))
+	while (Stream.Remaining())
+	{
+		RpcTypeInfo Info{};
+		uint8_t FieldsCount = 0;
+
+		if (!Stream.Read2(&Info.Base.TypeId) ||
+			!Stream.Read1(reinterpret_cast<uint8_t *>(&Info.Base.Attributes)) ||
+			!IsTypeIdInUDTRange(Info.Base.TypeId) ||
+			TypeRecords->FindTypeInfo(Info.Base.TypeId) ||
+			UDT.size() >= std::min<size_t>(Limits.MaxTypes, UDTCount) ||
+			(Info.Base.Attributes & ~KnownAttributes))
 			return nullptr;
 
-		if (Attributes & RpcTypeAttributes::Array)
-			Result &= !!Stream.Read4(&ArrayCount);
-
-		Result &=
-			Stream.Read1(&PackingShift) &&
-			Stream.Read1(&FieldsCount);
+		if ((Info.Base.Attributes & RpcTypeAttributes::Array) &&
+			(!Stream.Read4(&Info.Base.Array.Count) || Info.Base.Array.Count > Limits.MaxArrayCount))
+			return nullptr;
 
-		if (!Result ||
-			!TypeId ||
-			TypeRecords->AddUDT(TypeId, PackingShift, nullptr) != TypeId)
+		if (!Stream.Read1(&Info.Struct.PackingShift) ||
+			!Stream.Read1(&FieldsCount) ||
+			Info.Struct.PackingShift > 4 ||
+			FieldsCount >= MaxFieldsCount ||
+			FieldTypes.size() + FieldsCount > Limits.MaxFields)
 			return nullptr;
 
-		uint16_t FieldTypeId = 0;
-		RpcTypeAttributes FieldTypeAttributes = RpcTypeAttributes::None;
-		uint32_t FieldArrayCount = 0;
+		Info.Struct.FieldsCount = FieldsCount;
+		Info.Struct.FieldsCapacity = FieldsCount;
+		Info.Struct.FieldsIndex = static_cast<uint32_t>(FieldTypes.size());
 
-		for (uint8_t i = 0; i < FieldsCount; i++)
+		for (uint8_t FieldId = 0; FieldId < FieldsCount; FieldId++)
 		{
-			Result &=
-				Stream.Read2(&FieldTypeId) &&
-				Stream.Read1(reinterpret_cast<uint8_t *>(&FieldTypeAttributes));
+			RpcTypeBaseInfo Field{};
 
-			if (!Result)
+			if (!Stream.Read2(&Field.TypeId) ||
+				!Stream.Read1(reinterpret_cast<uint8_t *>(&Field.Attributes)) ||
+				Field.TypeId == Info.Base.TypeId ||
+				!IsFieldTypeIdValid(Info.Base.TypeId, FieldId, Field.TypeId) ||
+				(Field.Attributes & ~KnownAttributes))
 				return nullptr;
 
-			if (FieldTypeAttributes & RpcTypeAttributes::Array)
-				Result &= !!Stream.Read4(&ArrayCount);
-
-			uint8_t FieldId = TypeRecords->AddField(TypeId, FieldTypeId);
-			if (FieldId == 0xff)
+			if ((Field.Attributes & RpcTypeAttributes::Array) &&
+				(!Stream.Read4(&Field.Array.Count) || Field.Array.Count > Limits.MaxArrayCount))
 				return nullptr;
 
-			if (FieldTypeAttributes & RpcTypeAttributes::Array)
-				Result &= TypeRecords->SetArrayAttribute(TypeId, FieldId, FieldArrayCount);
-
-			if (FieldTypeAttributes & RpcTypeAttributes::OutAttribute)
-				Result &= TypeRecords->SetOutAttribute(TypeId, FieldId);
+			FieldTypes.push_back(Field);
 		}
+
+		UDT.push_back(Info);
+		TypeRecords->UDTIndex_[Info.Base.TypeId - static_cast<uint16_t>(RpcTypeId::UDT_START)] = static_cast<uint8_t>(UDT.size());
 	}
 
-	if (Result && !Stream.Remaining())
-		return TypeRecords.release();
+	if (!TypeRecords->Validate(Limits))
+		return nullptr;
 
-	return nullptr;
+	return TypeRecords;
 }
 
 void RpcTypeRecords::DebugDump()
@@ -252,10 +493,12 @@ void RpcTypeRecords::DebugDump()
 
 	for (uint16_t i = Start; i <= End; i++)
 	{
-		auto& TypeInfo = UDT_[i];
-		if (TypeInfo.Base.TypeId != i)
+		auto Info = GetTypeInfo(i);
+		if (!Info)
 			continue;
 
+		auto& TypeInfo = *Info;
+
 		// PrimitiveTypeMap.find()
 
 		printf("Type 0x%hx: ", TypeInfo.Base.TypeId);
@@ -272,13 +515,13 @@ void RpcTypeRecords::DebugDump()
 		printf("\n");
 
 		printf("Struct `%s' [Packing %hhu, %hhu Fields] {\n",
-			TypeInfo.Struct.Name,
+			Names_.data() + TypeInfo.Struct.NameOffset,
 			1 << TypeInfo.Struct.PackingShift,
 			TypeInfo.Struct.FieldsCount);
 
 		for (uint8_t j = 0; j < TypeInfo.Struct.FieldsCount; j++)
 		{
-			auto& FieldTypeInfo = TypeInfo.Struct.FieldTypes[j];
+			auto& FieldTypeInfo = FieldTypes_[TypeInfo.Struct.FieldsIndex + j];
 
 			printf("  Type 0x%hx: ", FieldTypeInfo.TypeId);
 
@@ -305,7 +548,7 @@ uint16_t RpcTypeRecords::AllocateTypeId(uint16_t TypeId)
 
 	if (IsTypeIdInUDTRange(TypeId))
 	{
-		if (UDT_[TypeId].Base.TypeId == 0)
+		if (!FindTypeInfo(TypeId))
 			TypeIdTarget = TypeId;
 	}
 	else
@@ -316,7 +559,7 @@ uint16_t RpcTypeRecords::AllocateTypeId(uint16_t TypeId)
 			if (i == static_cast<uint16_t>(RpcTypeId::PARAM_LIST))
 				continue;
 
-			if (UDT_[i].Base.TypeId == 0)
+			if (!FindTypeInfo(i))
 			{
 				Assert(i <= 0xffff);
 				TypeIdTarget = i;
@@ -327,9 +570,12 @@ uint16_t RpcTypeRecords::AllocateTypeId(uint16_t TypeId)
 
 	if (TypeIdTarget)
 	{
-		auto& TypeInfo = UDT_[TypeIdTarget];
-		memset(&TypeInfo, 0, sizeof(TypeInfo));
+		RpcTypeInfo TypeInfo{};
 		TypeInfo.Base.TypeId = TypeIdTarget;
+
+		UDT_.push_back(TypeInfo);
+		UDTIndex_[TypeIdTarget - static_cast<uint16_t>(RpcTypeId::UDT_START)] = static_cast<uint8_t>(UDT_.size());
+
 		return TypeIdTarget;
 	}
 
@@ -338,16 +584,58 @@ uint16_t RpcTypeRecords::AllocateTypeId(uint16_t TypeId)
 
 bool RpcTypeRecords::FreeTypeId(uint16_t TypeId)
 {
-	if (!IsTypeIdInUDTRange(TypeId))
+	auto TypeInfo = FindTypeInfo(TypeId);
+	if (!TypeInfo)
 		return false;
 
-	auto& TypeInfo = UDT_[TypeId];
-	Assert(TypeInfo.Base.TypeId == TypeId);
+	// Last one takes its place (its fields stay in the pool).
+	uint8_t& Index = UDTIndex_[TypeId - static_cast<uint16_t>(RpcTypeId::UDT_START)];
+	*TypeInfo = UDT_.back();
+	UDTIndex_[TypeInfo->Base.TypeId - static_cast<uint16_t>(RpcTypeId::UDT_START)] = Index;
+	Index = 0;
+	UDT_.pop_back();
 
-	TypeInfo.Base.TypeId = 0;
 	return true;
 }
 
+RpcTypeInfo * RpcTypeRecords::FindTypeInfo(uint16_t TypeId)
+{
+	if (!IsTypeIdInUDTRange(TypeId))
+		return nullptr;
+
+	uint8_t Index = UDTIndex_[TypeId - static_cast<uint16_t>(RpcTypeId::UDT_START)];
+	return Index ? &UDT_[Index - 1] : nullptr;
+}
+
+RpcTypeBaseInfo * RpcTypeRecords::FindFieldType(uint16_t TypeId, uint8_t FieldId)
+{
+	auto TypeInfo = FindTypeInfo(TypeId);
+	if (!TypeInfo || FieldId >= TypeInfo->Struct.FieldsCount)
+		return nullptr;
+
+	return &FieldTypes_[TypeInfo->Struct.FieldsIndex + FieldId];
+}
+
+uint32_t RpcTypeRecords::InternName(const char * Name)
+{
+	// Offset 0 is the empty name.
+	if (!Name || !*Name)
+		return 0;
+
+	size_t Length = strlen(Name);
+
+	for (size_t Offset = 1; Offset < Names_.size(); Offset += strlen(Names_.data() + Offset) + 1)
+	{
+		if (!strcmp(Names_.data() + Offset, Name))
+			return static_cast<uint32_t>(Offset);
+	}
+
+	uint32_t Offset = static_cast<uint32_t>(Names_.size());
+	Names_.insert(Names_.end(), Name, Name + Length + 1);
+
+	return Offset;
+}
+
 bool RpcTypeRecords::IsTypeIdInUDTRange(uint16_t TypeId)
 {
 	if (static_cast<uint16_t>(RpcTypeId::UDT_START) <= TypeId &&
@@ -366,7 +654,19 @@ bool RpcTypeRecords::IsTypeIdPrimitive(uint16_t TypeId)
 	return false;
 }
 
-size_t RpcTypeRecords::GetTypeRecordSize(RpcTypeInfo & Info)
+bool RpcTypeRecords::IsFieldTypeIdValid(uint16_t TypeId, uint8_t FieldId, uint16_t FieldTypeId)
+{
+	if (IsTypeIdInUDTRange(FieldTypeId) || IsTypeIdPrimitive(FieldTypeId))
+		return true;
+
+	// Return type (first field of PARAM_LIST) of a function returning void.
+	return
+		TypeId == static_cast<uint16_t>(RpcTypeId::PARAM_LIST) &&
+		FieldId == 0 &&
+		FieldTypeId == static_cast<uint16_t>(RpcTypeId::Undefined);
+}
+
+size_t RpcTypeRecords::GetTypeRecordSize(const RpcTypeInfo & Info)
 {
 	size_t Size =
 		sizeof(Info.Base.TypeId) +
@@ -381,10 +681,8 @@ size_t RpcTypeRecords::GetTypeRecordSize(RpcTypeInfo & Info)
 
 		for (uint8_t FieldId = 0; FieldId < Info.Struct.FieldsCount; FieldId++)
 		{
-			auto& FieldTypeInfo = Info.Struct.FieldTypes[FieldId];
-			Assert(
-				IsTypeIdPrimitive(FieldTypeInfo.TypeId) ||
-				IsTypeIdInUDTRange(FieldTypeInfo.TypeId));
+			auto& FieldTypeInfo = FieldTypes_[Info.Struct.FieldsIndex + FieldId];
+			Assert(IsFieldTypeIdValid(Info.Base.TypeId, FieldId, FieldTypeInfo.TypeId));
 
 			size_t FieldTypeRecordSize = sizeof(FieldTypeInfo.TypeId) + sizeof(FieldTypeInfo.Attributes);
 
@@ -400,13 +698,11 @@ size_t RpcTypeRecords::GetTypeRecordSize(RpcTypeInfo & Info)
 
 size_t RpcTypeRecords::GetTypeRecordSize(uint16_t TypeId)
 {
-	if (IsTypeIdInUDTRange(TypeId))
-		return GetTypeRecordSize(UDT_[TypeId]);
-
-	return 0;
+	auto Info = GetTypeInfo(TypeId);
+	return Info ? GetTypeRecordSize(*Info) : 0;
 }
 
-size_t RpcTypeRecords::WriteTypeRecord(RpcTypeInfo & Info, uint8_t *Buffer, size_t Size)
+size_t RpcTypeRecords::WriteTypeRecord(const RpcTypeInfo & Info, uint8_t *Buffer, size_t Size)
 {
 	ByteStream Stream(Buffer, Size);
 
@@ -422,10 +718,8 @@ size_t RpcTypeRecords::WriteTypeRecord(RpcTypeInfo & Info, uint8_t *Buffer, size
 
 		for (uint8_t FieldId = 0; FieldId < Info.Struct.FieldsCount; FieldId++)
 		{
-			auto& FieldTypeInfo = Info.Struct.FieldTypes[FieldId];
-			Assert(
-				IsTypeIdPrimitive(FieldTypeInfo.TypeId) ||
-				IsTypeIdInUDTRange(FieldTypeInfo.TypeId));
+			auto& FieldTypeInfo = FieldTypes_[Info.Struct.FieldsIndex + FieldId];
+			Assert(IsFieldTypeIdValid(Info.Base.TypeId, FieldId, FieldTypeInfo.TypeId));
 
 			SizeWritten += Stream.Write2(FieldTypeInfo.TypeId) + Stream.Write1(FieldTypeInfo.Attributes);
 
@@ -439,10 +733,8 @@ size_t RpcTypeRecords::WriteTypeRecord(RpcTypeInfo & Info, uint8_t *Buffer, size
 
 size_t RpcTypeRecords::WriteTypeRecord(uint16_t TypeId, uint8_t *Buffer, size_t Size)
 {
-	if (IsTypeIdInUDTRange(TypeId))
-		return WriteTypeRecord(UDT_[TypeId], Buffer, Size);
-
-	return 0;
+	auto Info = GetTypeInfo(TypeId);
+	return Info ? WriteTypeRecord(*Info, Buffer, Size) : 0;
 }
 
 std::vector<uint16_t> RpcTypeRecords::GetReferencedTypeIdList(uint16_t RootTypeId)
@@ -457,10 +749,10 @@ std::vector<uint16_t> RpcTypeRecords::GetReferencedTypeIdList(uint16_t RootTypeI
 		uint16_t TypeIdCurrent = Queue.front();
 		Queue.pop();
 
-		RpcTypeInfo *Info = nullptr;
+		const RpcTypeInfo *Info = nullptr;
 
 		if (IsTypeIdInUDTRange(TypeIdCurrent))
-			Info = &UDT_[TypeIdCurrent];
+			Info = GetTypeInfo(TypeIdCurrent); // nullptr if not defined
 		else if (IsTypeIdPrimitive(TypeIdCurrent))
 			; // primitive type, nothing to do
 		else
@@ -471,7 +763,7 @@ std::vector<uint16_t> RpcTypeRecords::GetReferencedTypeIdList(uint16_t RootTypeI
 
 		for (uint8_t FieldId = 0; FieldId < Info->Struct.FieldsCount; FieldId++)
 		{
-			uint16_t TypeIdNext = Info->Struct.FieldTypes[FieldId].TypeId;
+			uint16_t TypeIdNext = FieldTypes_[Info->Struct.FieldsIndex + FieldId].TypeId;
 
 			if (!IsTypeIdInUDTRange(TypeIdNext))
 				continue;
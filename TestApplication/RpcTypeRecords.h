@@ -24,12 +24,32 @@ struct RpcTypeInfo
 	{
 		uint8_t FieldsCount;	// Number of fields
 		uint8_t PackingShift;	// structure packing (1 << Packing)
-
-		RpcTypeBaseInfo FieldTypes[0xff];
-		char Name[0x100];
+		uint8_t FieldsCapacity;	// Slots reserved in field pool
+		uint32_t FieldsIndex;	// First field in field pool (see RpcTypeRecords::GetFieldTypes)
+		uint32_t NameOffset;	// Name in name pool (0 if no name)
 	} Struct;
 };
 
+struct RpcTypeLayout
+{
+	uint32_t Size;			// Native size, UDT padded as by its PackingShift
+	uint32_t Alignment;
+	bool WireIdentical;		// Native bytes are the wire bytes (see RpcTypeRecords::IsWireIdentical)
+};
+
+// 
+// Bounds on a type record from the peer, checked by RpcTypeRecords::Deserialize.
+// 
+
+struct RpcTypeRecordLimits
+{
+	uint32_t MaxTypes = 0x40;				// UDTs, PARAM_LIST included
+	uint32_t MaxFields = 0x400;				// Fields of all UDTs
+	uint32_t MaxDepth = 0x10;				// UDT nesting under a parameter (a UDT parameter is 1)
+	uint32_t MaxArrayCount = 0x1000000;		// Elements of one array
+	uint32_t MaxNativeSize = 0x4000000;		// Native size of all parameters together
+};
+
 class RpcTypeRecords
 {
 public:
@@ -49,9 +69,38 @@ public:
 	bool SetParamsTypeFieldArrayAttribute(uint8_t FieldId, uint32_t ArrayCount);
 	bool SetParamsTypeFieldOutAttribute(uint8_t FieldId);
 
+	const RpcTypeInfo *GetTypeInfo(uint16_t TypeId) const;
+	const RpcTypeBaseInfo *GetFieldTypes(uint16_t TypeId) const;
+	const char *GetName(uint16_t TypeId) const;
+	std::vector<uint16_t> GetReferencedTypeIdList(uint16_t RootTypeId);
+
+	static bool IsTypeIdInUDTRange(uint16_t TypeId);
+	static bool IsTypeIdPrimitive(uint16_t TypeId);
+
+	// 
+	// Native layout. Fails for undefined or circular types and for sizes of 4GB or more.
+	// A UDT is wire-identical if it has no padding, no pointers and only wire-identical fields 
+	// on a little-endian host: its array can be sent and received as one block in Fixed encoding.
+	// 
+
+	bool GetLayout(uint16_t TypeId, RpcTypeLayout *Layout) const;
+	bool GetFieldLayout(const RpcTypeBaseInfo& Field, RpcTypeLayout *Layout) const;
+	bool IsWireIdentical(uint16_t TypeId) const;
+	static uint32_t GetPrimitiveSize(uint16_t TypeId);
+
 	// Serialization
+	// Records are always written with fixed-width fields, also on connections using 
+	// RpcIntegerEncoding::Compact: a record is sent once per connection and its fingerprint 
+	// (see RpcSchemaCache) must not depend on the encoding.
 	size_t Serialize(uint8_t *Buffer, size_t Size);
-	static RpcTypeRecords *Deserialize(uint8_t *Buffer, size_t Size);
+
+	// 
+	// One pass over the record, nullptr unless it is complete, has a PARAM_LIST, references only 
+	// defined and non-circular types and is within Limits (default RpcTypeRecordLimits otherwise).
+	// 
+
+	static std::unique_ptr<RpcTypeRecords> Deserialize(const uint8_t *Buffer, size_t Size);
+	static std::unique_ptr<RpcTypeRecords> Deserialize(const uint8_t *Buffer, size_t Size, const RpcTypeRecordLimits& Limits);
 
 	void DebugDump();
 
@@ -59,20 +108,38 @@ private:
 	uint16_t AllocateTypeId(uint16_t TypeId = 0);
 	bool FreeTypeId(uint16_t TypeId);
 
-	static bool IsTypeIdInUDTRange(uint16_t TypeId);
-	static bool IsTypeIdPrimitive(uint16_t TypeId);
+	RpcTypeInfo *FindTypeInfo(uint16_t TypeId);
+	RpcTypeBaseInfo *FindFieldType(uint16_t TypeId, uint8_t FieldId);
+	uint32_t InternName(const char *Name);
 
-	size_t GetTypeRecordSize(RpcTypeInfo& Info);
-	size_t GetTypeRecordSize(uint16_t TypeId);
-	size_t WriteTypeRecord(uint16_t TypeId, uint8_t * Buffer, size_t Size);
-	size_t WriteTypeRecord(RpcTypeInfo & Info, uint8_t * Buffer, size_t Size);
-	std::vector<uint16_t> GetReferencedTypeIdList(uint16_t RootTypeId);
+	static bool IsFieldTypeIdValid(uint16_t TypeId, uint8_t FieldId, uint16_t FieldTypeId);
 
-	// Contains only UDTs (user-defined type).
-	constexpr static const size_t TypeInfoCount = 0x100;
-	static_assert(static_cast<size_t>(RpcTypeId::UDT_END) < RpcTypeRecords::TypeInfoCount, "TypeInfoCount <= UDT_END !!");
+	using LayoutMap = std::map<uint16_t, RpcTypeLayout>;	// <UDT TypeId, RpcTypeLayout>
 
-	std::array<RpcTypeInfo, RpcTypeRecords::TypeInfoCount> UDT_; // <TypeId, RpcTypeInfo>
+	bool GetLayout(uint16_t TypeId, LayoutMap& Layouts, RpcTypeLayout *Layout) const;
+	bool GetFieldLayout(const RpcTypeBaseInfo& Field, LayoutMap& Layouts, RpcTypeLayout *Layout) const;
+	bool GetDepth(uint16_t TypeId, std::map<uint16_t, uint32_t>& Depths, uint32_t *Depth) const;
+	bool Validate(const RpcTypeRecordLimits& Limits) const;
+
+	size_t GetTypeRecordSize(const RpcTypeInfo& Info);
+	size_t GetTypeRecordSize(uint16_t TypeId);
+	size_t WriteTypeRecord(uint16_t TypeId, uint8_t * Buffer, size_t Size);
+	size_t WriteTypeRecord(const RpcTypeInfo & Info, uint8_t * Buffer, size_t Size);
+
+	// 
+	// Sized by the schema: only defined UDTs are stored, fields of each UDT are a contiguous run
+	// in one pool (moved to the end when it outgrows its slots), and names are interned.
+	// 
+
+	constexpr static const size_t UDTCount =
+		static_cast<size_t>(RpcTypeId::UDT_END) - static_cast<size_t>(RpcTypeId::UDT_START) + 1;
+	constexpr static const uint8_t MaxFieldsCount = 0xff;	// FieldId 0xff is reserved for errors
+	constexpr static const uint32_t LayoutInProgress = ~0u;	// RpcTypeLayout::Size while fields are walked
+
+	std::vector<RpcTypeInfo> UDT_;				// Defined UDTs (user-defined type)
+	std::array<uint8_t, UDTCount> UDTIndex_;	// <TypeId - UDT_START, Index in UDT_ + 1> (0 if not defined)
+	std::vector<RpcTypeBaseInfo> FieldTypes_;	// Field pool
+	std::vector<char> Names_;					// Name pool, NUL-terminated names
 };
 
 
@@ -0,0 +1,417 @@
+#pragma once
+
+#include "Rpc.h"
+
+namespace SRPC
+{
+
+/*
+	Compile-time Type Records
+
+	RpcFunctionTypeRecord<F> is the serialized PARAM_LIST record of signature F followed
+	by the records of referenced UDTs, byte for byte what RpcTypeRecords::Serialize() writes
+	for the same description (PackingShift of PARAM_LIST is 0).
+
+	Type mapping:
+		Integers	INT_8..INT_64U by size and signedness, bool as INT_8U, enum as underlying type
+		Floats		FLOAT_32, FLOAT_64
+		Characters	char as CP_8, wchar_t/char16_t/char32_t as CP_16/CP_32 by size
+		Pointers	PTR_32/PTR_64
+		Arrays		std::array<T, N> and T[N] as T with Array attribute, ArrayCount N
+		Parameters	T& as T with OutAttribute, const T& and T&& as T, void return as Undefined
+
+	C++ cannot enumerate fields of an aggregate, so structure is described once:
+
+		#pragma pack(push, 4)
+		struct Point { int16_t x; int16_t y; };
+		#pragma pack(pop)
+
+		template <> struct RpcTypeOf<Point> : RpcStructTypeOf<Point, 0x81, 2, int16_t, int16_t> {};
+
+	Size of described fields (with packing) must match sizeof(Point) or compilation fails.
+	A field described as T& is Out, like a parameter: it is returned even if the parameter is not.
+*/
+
+template <uint8_t... Bytes>
+struct RpcRecordBytes
+{
+	constexpr static const size_t Size = sizeof...(Bytes);
+	constexpr static const std::array<uint8_t, sizeof...(Bytes)> Data = { { Bytes... } };
+};
+
+template <uint8_t... Bytes>
+constexpr const std::array<uint8_t, sizeof...(Bytes)> RpcRecordBytes<Bytes...>::Data;
+
+template <uint16_t Value>
+using RpcRecordBytes2 = RpcRecordBytes<
+	static_cast<uint8_t>(Value),
+	static_cast<uint8_t>(Value >> 0x08)>;
+
+template <uint32_t Value>
+using RpcRecordBytes4 = RpcRecordBytes<
+	static_cast<uint8_t>(Value),
+	static_cast<uint8_t>(Value >> 0x08),
+	static_cast<uint8_t>(Value >> 0x10),
+	static_cast<uint8_t>(Value >> 0x18)>;
+
+template <typename... TRecords>
+struct RpcRecordConcat;
+
+template <>
+struct RpcRecordConcat<>
+{
+	using Type = RpcRecordBytes<>;
+};
+
+template <uint8_t... Bytes>
+struct RpcRecordConcat<RpcRecordBytes<Bytes...>>
+{
+	using Type = RpcRecordBytes<Bytes...>;
+};
+
+template <uint8_t... Bytes1, uint8_t... Bytes2, typename... TRest>
+struct RpcRecordConcat<RpcRecordBytes<Bytes1...>, RpcRecordBytes<Bytes2...>, TRest...>
+{
+	using Type = typename RpcRecordConcat<RpcRecordBytes<Bytes1..., Bytes2...>, TRest...>::Type;
+};
+
+// TypeId(2)/Attributes(1) [/ArrayCount(4)]
+template <uint16_t TypeId, uint8_t Attributes, uint32_t ArrayCount>
+struct RpcFieldRecord
+{
+	using Type = typename RpcRecordConcat<
+		RpcRecordBytes2<TypeId>,
+		RpcRecordBytes<Attributes>,
+		typename std::conditional<!!(Attributes & RpcTypeAttributes::Array), RpcRecordBytes4<ArrayCount>, RpcRecordBytes<>>::type
+	>::Type;
+};
+
+template <typename TTypeOf>
+using RpcFieldRecordOf = typename RpcFieldRecord<TTypeOf::TypeId, TTypeOf::Attributes, TTypeOf::ArrayCount>::Type;
+
+
+//
+// UDT definitions referenced by a type, ordered by TypeId without duplicates.
+//
+
+template <typename TStruct, uint16_t Id, typename TRecord>
+struct RpcStructDefinition
+{
+	using Struct = TStruct;
+	using Record = TRecord;
+	constexpr static const uint16_t TypeId = Id;
+};
+
+template <typename... TDefinitions>
+struct RpcTypeList
+{
+};
+
+template <typename TDefinition, typename TList>
+struct RpcTypeListPrepend;
+
+template <typename TDefinition, typename... TDefinitions>
+struct RpcTypeListPrepend<TDefinition, RpcTypeList<TDefinitions...>>
+{
+	using Type = RpcTypeList<TDefinition, TDefinitions...>;
+};
+
+template <typename TList, typename TDefinition>
+struct RpcTypeListInsert;
+
+template <typename TList, typename TDefinition, bool Before, bool Same>
+struct RpcTypeListInsertAt;
+
+template <typename TDefinition>
+struct RpcTypeListInsert<RpcTypeList<>, TDefinition>
+{
+	using Type = RpcTypeList<TDefinition>;
+};
+
+template <typename THead, typename... TTail, typename TDefinition>
+struct RpcTypeListInsert<RpcTypeList<THead, TTail...>, TDefinition>
+{
+	using Type = typename RpcTypeListInsertAt<
+		RpcTypeList<THead, TTail...>,
+		TDefinition,
+		(TDefinition::TypeId < THead::TypeId),
+		(TDefinition::TypeId == THead::TypeId)>::Type;
+};
+
+template <typename THead, typename... TTail, typename TDefinition>
+struct RpcTypeListInsertAt<RpcTypeList<THead, TTail...>, TDefinition, true, false>
+{
+	using Type = RpcTypeList<TDefinition, THead, TTail...>;
+};
+
+template <typename THead, typename... TTail, typename TDefinition>
+struct RpcTypeListInsertAt<RpcTypeList<THead, TTail...>, TDefinition, false, true>
+{
+	static_assert(std::is_same<typename THead::Struct, typename TDefinition::Struct>::value, "UDT TypeId is used by two structures !!");
+	using Type = RpcTypeList<THead, TTail...>;
+};
+
+template <typename THead, typename... TTail, typename TDefinition>
+struct RpcTypeListInsertAt<RpcTypeList<THead, TTail...>, TDefinition, false, false>
+{
+	using Type = typename RpcTypeListPrepend<THead, typename RpcTypeListInsert<RpcTypeList<TTail...>, TDefinition>::Type>::Type;
+};
+
+template <typename... TLists>
+struct RpcTypeListMerge;
+
+template <>
+struct RpcTypeListMerge<>
+{
+	using Type = RpcTypeList<>;
+};
+
+template <typename TList>
+struct RpcTypeListMerge<TList>
+{
+	using Type = TList;
+};
+
+template <typename TList>
+struct RpcTypeListMerge<TList, RpcTypeList<>>
+{
+	using Type = TList;
+};
+
+template <typename TList, typename TDefinition, typename... TDefinitions>
+struct RpcTypeListMerge<TList, RpcTypeList<TDefinition, TDefinitions...>>
+{
+	using Type = typename RpcTypeListMerge<typename RpcTypeListInsert<TList, TDefinition>::Type, RpcTypeList<TDefinitions...>>::Type;
+};
+
+template <typename TList1, typename TList2, typename TList3, typename... TRest>
+struct RpcTypeListMerge<TList1, TList2, TList3, TRest...>
+{
+	using Type = typename RpcTypeListMerge<typename RpcTypeListMerge<TList1, TList2>::Type, TList3, TRest...>::Type;
+};
+
+template <typename TList>
+struct RpcTypeListRecords;
+
+template <typename... TDefinitions>
+struct RpcTypeListRecords<RpcTypeList<TDefinitions...>>
+{
+	using Type = typename RpcRecordConcat<typename TDefinitions::Record...>::Type;
+};
+
+
+//
+// Type of C++ type T (TypeId, Attributes, ArrayCount, Definitions).
+//
+
+template <typename T, typename = void>
+struct RpcTypeOf
+{
+	static_assert(!std::is_same<T, T>::value, "Type has no type record (specialize RpcTypeOf) !!");
+};
+
+template <RpcTypeId Id>
+struct RpcPrimitiveTypeOf
+{
+	constexpr static const uint16_t TypeId = static_cast<uint16_t>(Id);
+	constexpr static const uint8_t Attributes = RpcTypeAttributes::None;
+	constexpr static const uint32_t ArrayCount = 0;
+	using Definitions = RpcTypeList<>;
+};
+
+template <size_t Size, bool Signed>
+struct RpcIntegerTypeId;
+
+template <> struct RpcIntegerTypeId<1, true> { constexpr static const RpcTypeId Value = RpcTypeId::INT_8; };
+template <> struct RpcIntegerTypeId<2, true> { constexpr static const RpcTypeId Value = RpcTypeId::INT_16; };
+template <> struct RpcIntegerTypeId<4, true> { constexpr static const RpcTypeId Value = RpcTypeId::INT_32; };
+template <> struct RpcIntegerTypeId<8, true> { constexpr static const RpcTypeId Value = RpcTypeId::INT_64; };
+template <> struct RpcIntegerTypeId<1, false> { constexpr static const RpcTypeId Value = RpcTypeId::INT_8U; };
+template <> struct RpcIntegerTypeId<2, false> { constexpr static const RpcTypeId Value = RpcTypeId::INT_16U; };
+template <> struct RpcIntegerTypeId<4, false> { constexpr static const RpcTypeId Value = RpcTypeId::INT_32U; };
+template <> struct RpcIntegerTypeId<8, false> { constexpr static const RpcTypeId Value = RpcTypeId::INT_64U; };
+
+template <size_t Size>
+struct RpcCharTypeId;
+
+template <> struct RpcCharTypeId<1> { constexpr static const RpcTypeId Value = RpcTypeId::CP_8; };
+template <> struct RpcCharTypeId<2> { constexpr static const RpcTypeId Value = RpcTypeId::CP_16; };
+template <> struct RpcCharTypeId<4> { constexpr static const RpcTypeId Value = RpcTypeId::CP_32; };
+
+template <typename T>
+struct RpcTypeOf<T, typename std::enable_if<std::is_integral<T>::value>::type> :
+	RpcPrimitiveTypeOf<RpcIntegerTypeId<sizeof(T), std::is_signed<T>::value>::Value>
+{
+};
+
+template <typename T>
+struct RpcTypeOf<T, typename std::enable_if<std::is_enum<T>::value>::type> :
+	RpcTypeOf<typename std::underlying_type<T>::type>
+{
+};
+
+template <> struct RpcTypeOf<bool> : RpcPrimitiveTypeOf<RpcTypeId::INT_8U> {};
+template <> struct RpcTypeOf<char> : RpcPrimitiveTypeOf<RpcCharTypeId<sizeof(char)>::Value> {};
+template <> struct RpcTypeOf<wchar_t> : RpcPrimitiveTypeOf<RpcCharTypeId<sizeof(wchar_t)>::Value> {};
+template <> struct RpcTypeOf<char16_t> : RpcPrimitiveTypeOf<RpcCharTypeId<sizeof(char16_t)>::Value> {};
+template <> struct RpcTypeOf<char32_t> : RpcPrimitiveTypeOf<RpcCharTypeId<sizeof(char32_t)>::Value> {};
+template <> struct RpcTypeOf<float> : RpcPrimitiveTypeOf<RpcTypeId::FLOAT_32> {};
+template <> struct RpcTypeOf<double> : RpcPrimitiveTypeOf<RpcTypeId::FLOAT_64> {};
+
+template <typename T>
+struct RpcTypeOf<T *, void> :
+	RpcPrimitiveTypeOf<sizeof(T *) == sizeof(uint64_t) ? RpcTypeId::PTR_64 : RpcTypeId::PTR_32>
+{
+};
+
+template <typename T, size_t Count>
+struct RpcTypeOf<std::array<T, Count>, void>
+{
+	using ElementTypeOf = RpcTypeOf<typename std::remove_cv<T>::type>;
+
+	static_assert(!(ElementTypeOf::Attributes & RpcTypeAttributes::Array), "Array of array has no type record !!");
+	static_assert(Count <= 0xffffffff, "ArrayCount must fit in 32 bits !!");
+
+	constexpr static const uint16_t TypeId = ElementTypeOf::TypeId;
+	constexpr static const uint8_t Attributes = ElementTypeOf::Attributes | RpcTypeAttributes::Array;
+	constexpr static const uint32_t ArrayCount = static_cast<uint32_t>(Count);
+	using Definitions = typename ElementTypeOf::Definitions;
+};
+
+template <typename T, size_t Count>
+struct RpcTypeOf<T[Count], void> : RpcTypeOf<std::array<T, Count>>
+{
+};
+
+
+//
+// Structure layout with #pragma pack(1 << PackingShift), to check a description against sizeof.
+//
+
+constexpr size_t RpcAlignUp(size_t Offset, size_t Alignment)
+{
+	return (Offset + Alignment - 1) / Alignment * Alignment;
+}
+
+constexpr size_t RpcFieldAlignment(size_t Alignment, size_t Packing)
+{
+	return Alignment < Packing ? Alignment : Packing;
+}
+
+template <size_t Packing, size_t Offset, size_t Alignment, typename... TFields>
+struct RpcStructLayout
+{
+	constexpr static const size_t Size = RpcAlignUp(Offset, Alignment);
+};
+
+template <size_t Packing, size_t Offset, size_t Alignment, typename TField, typename... TFields>
+struct RpcStructLayout<Packing, Offset, Alignment, TField, TFields...> :
+	RpcStructLayout<
+		Packing,
+		RpcAlignUp(Offset, RpcFieldAlignment(alignof(TField), Packing)) + sizeof(TField),
+		(Alignment > RpcFieldAlignment(alignof(TField), Packing)) ? Alignment : RpcFieldAlignment(alignof(TField), Packing),
+		TFields...>
+{
+};
+
+template <typename T>
+struct RpcParamTypeOf;
+
+template <typename TStruct, uint16_t Id, uint8_t PackingShift, typename... TFields>
+struct RpcStructTypeOf
+{
+	static_assert(static_cast<uint16_t>(RpcTypeId::PARAM_LIST) < Id && Id <= static_cast<uint16_t>(RpcTypeId::UDT_END), "UDT TypeId out of range !!");
+	static_assert(sizeof...(TFields) < 0xff, "Too many fields !!");
+	static_assert(PackingShift <= 4, "Packing must be 1, 2, 4, 8 or 16 !!");
+	static_assert(RpcStructLayout<static_cast<size_t>(1) << PackingShift, 0, 1, TFields...>::Size == sizeof(TStruct),
+		"Fields do not match structure layout !!");
+
+	constexpr static const uint16_t TypeId = Id;
+	constexpr static const uint8_t Attributes = RpcTypeAttributes::None;
+	constexpr static const uint32_t ArrayCount = 0;
+
+	// TypeId(2)/Attributes(1) / Packing(1)/FieldsCount(1) { Fields }
+	using Record = typename RpcRecordConcat<
+		typename RpcFieldRecord<Id, RpcTypeAttributes::None, 0>::Type,
+		RpcRecordBytes<PackingShift, static_cast<uint8_t>(sizeof...(TFields))>,
+		RpcFieldRecordOf<RpcParamTypeOf<TFields>>...
+	>::Type;
+
+	using Definitions = typename RpcTypeListInsert<
+		typename RpcTypeListMerge<RpcTypeList<>, typename RpcParamTypeOf<TFields>::Definitions...>::Type,
+		RpcStructDefinition<TStruct, Id, Record>
+	>::Type;
+};
+
+
+//
+// Parameter (or return, or structure field) type: references are resolved here.
+//
+
+template <typename T>
+struct RpcParamTypeOf : RpcTypeOf<typename std::remove_cv<T>::type>
+{
+};
+
+template <typename T>
+struct RpcParamTypeOf<const T&> : RpcParamTypeOf<T>
+{
+};
+
+template <typename T>
+struct RpcParamTypeOf<T&&> : RpcParamTypeOf<T>
+{
+};
+
+template <typename T>
+struct RpcParamTypeOf<T&> : RpcParamTypeOf<T>
+{
+	constexpr static const uint8_t Attributes = RpcParamTypeOf<T>::Attributes | RpcTypeAttributes::OutAttribute;
+};
+
+template <>
+struct RpcParamTypeOf<void> : RpcPrimitiveTypeOf<RpcTypeId::Undefined>
+{
+};
+
+
+//
+// PARAM_LIST: [TypeRecord_Return][TypeRecord_Param1]...[TypeRecord_ParamN], then referenced UDTs.
+//
+
+template <typename TFunction>
+struct RpcFunctionTypeRecord;
+
+template <typename TReturn, typename... TArgs>
+struct RpcFunctionTypeRecord<TReturn(TArgs...)>
+{
+	static_assert(sizeof...(TArgs) < 0xff, "Too many parameters !!");
+
+	using ParamList = typename RpcRecordConcat<
+		typename RpcFieldRecord<static_cast<uint16_t>(RpcTypeId::PARAM_LIST), RpcTypeAttributes::None, 0>::Type,
+		RpcRecordBytes<0, static_cast<uint8_t>(1 + sizeof...(TArgs))>,
+		RpcFieldRecordOf<RpcParamTypeOf<TReturn>>,
+		RpcFieldRecordOf<RpcParamTypeOf<TArgs>>...
+	>::Type;
+
+	using Definitions = typename RpcTypeListMerge<
+		typename RpcParamTypeOf<TReturn>::Definitions,
+		typename RpcParamTypeOf<TArgs>::Definitions...
+	>::Type;
+
+	using Record = typename RpcRecordConcat<ParamList, typename RpcTypeListRecords<Definitions>::Type>::Type;
+
+	constexpr static const size_t Size = Record::Size;
+
+	static const uint8_t *Data()
+	{
+		return Record::Data.data();
+	}
+};
+
+template <typename TReturn, typename... TArgs>
+struct RpcFunctionTypeRecord<TReturn(*)(TArgs...)> : RpcFunctionTypeRecord<TReturn(TArgs...)>
+{
+};
+
+}
@@ -8,11 +8,14 @@
 #include <chrono>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
 #include <atomic>
 #include <array>
 //nclude <shared_mutex>
 
 #include <queue>
+#include <deque>
+#include <functional>
 #include <future>
 
 #ifndef WIN32_LEAN_AND_MEAN
@@ -20,6 +23,12 @@
 #endif
 #include <Windows.h>
 
+#if defined(_M_X64) || defined(_M_IX86) || defined(_M_ARM) || defined(_M_ARM64) || \
+	(defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__))
+#define SRPC_LITTLE_ENDIAN 1
+#else
+#define SRPC_LITTLE_ENDIAN 0
+#endif
 
 namespace SRPC
 {
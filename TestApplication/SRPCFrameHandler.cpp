@@ -1,24 +1,1465 @@
+
 #include "SRPCFrameHandler.h"
+#include "RpcMarshalPlan.h"
 
 
 namespace SRPC
 {
 
-SRPCFrameHandler::SRPCFrameHandler()
+SRPCFrameHandler::SRPCFrameHandler() : SRPCFrameHandler(nullptr)
+{
+}
+
+SRPCFrameHandler::SRPCFrameHandler(RpcStreamReader::ChunkHandler Handler) :
+	Connection_(nullptr),
+	Handler_(Handler),
+	PendingCalls_(DefaultPendingCallsShift),
+	StreamWriter_(DefaultMaxBodySize, [this](uint8_t *Frame, uint32_t Size)
+	{
+		return SendFrame(Frame, Size);
+	}),
+	StreamReader_(DefaultMaxStreams, [this](const RpcFrameHeader& Header, uint64_t Offset, const uint8_t *Chunk, uint32_t Size, bool EoR)
+	{
+		return ReceiveChunk(Header, Offset, Chunk, Size, EoR);
+	}),
+	Parser_(DefaultMaxBodySize, [this](const RpcFrameHeader& Header, const RpcFrameSegment *Body, uint32_t BodyCount)
+	{
+		// Any frame shows the peer is alive.
+		Keepalive_.FrameReceived(RpcKeepalive::Clock::now());
+
+		// Hand the complete frame to the RPC layer.
+		switch (static_cast<RpcFrameType>(Header.Type))
+		{
+		case RpcFrameType::Credit:
+			return ReceiveCredit(Header, Body, BodyCount);
+
+		case RpcFrameType::Cancel:
+			return ReceiveCancel(Header);
+
+		case RpcFrameType::Ping:
+			return ReceivePing(Header, Body, BodyCount);
+
+		case RpcFrameType::Settings:
+			return ReceiveSettings(Header, Body, BodyCount);
+
+		case RpcFrameType::Register:
+		case RpcFrameType::Unregister:
+			if (Header.u.Bitfields.Response)
+				return ReceiveSchemaReply(Header, Body, BodyCount);
+
+			return StreamReader_.ReceiveFrame(Header, Body, BodyCount);
+
+		case RpcFrameType::CallBatch:
+			return ReceiveBatch(Header, Body, BodyCount);
+
+		default:
+			return StreamReader_.ReceiveFrame(Header, Body, BodyCount);
+		}
+	}),
+	SendCredit_(DefaultInitialCredit),
+	RecvUngranted_(0),
+	CreditStalls_(0),
+	Keepalive_(std::chrono::milliseconds(DefaultIdleThresholdMs), std::chrono::milliseconds(DefaultPongTimeoutMs)),
+	LocalFeatures_(FeatureCompactIntegers),
+	PeerFeatures_(FeatureNone),
+	DigestAcceptMask_(~0u),
+	PeerDigestAcceptMask_(~0u),
+	PreferredDigest_(static_cast<uint16_t>(RpcDigestType::None)),
+	SelectedDigest_(static_cast<uint16_t>(RpcDigestType::None)),
+	ActiveCallCount_(0),
+	CallsCancelled_(0),
+	CallsQueued_(0),
+	CallsExpired_(0),
+	SchemaRetriesDue_(false),
+	ReplyBatchHolds_(0)
 {
+	ActiveCalls_.fill(nullptr);
 }
 
 SRPCFrameHandler::~SRPCFrameHandler()
 {
+	PendingCalls_.AbandonAll(RpcCallStatus::Disconnected);
+
+	// Work items refer to us, wait for running ones.
+	CancelActiveCalls();
+
+	{
+		std::unique_lock<decltype(ActiveCallsMutex_)> Lock(ActiveCallsMutex_);
+		ActiveCallsDone_.wait(Lock, [this]() { return ActiveCallCount_ == 0; });
+	}
+
+	FlushReplies();
+}
+
+void SRPCFrameHandler::Attach(IOCP::IOCPConnection * Connection)
+{
+	Connection_ = Connection;
+
+	SendSettings();
+}
+
+void SRPCFrameHandler::SetDigestAcceptMask(uint32_t AcceptMask)
+{
+	DigestAcceptMask_ = AcceptMask;
+	Parser_.SetDigestAcceptMask(AcceptMask);
+
+	if (Connection_)
+		SendSettings();
+}
+
+void SRPCFrameHandler::SetDigestType(RpcDigestType Preferred)
+{
+	PreferredDigest_ = static_cast<uint16_t>(Preferred);
+	SelectDigest();
+}
+
+RpcDigestType SRPCFrameHandler::DigestType() const
+{
+	return static_cast<RpcDigestType>(SelectedDigest_.load());
+}
+
+void SRPCFrameHandler::SelectDigest()
+{
+	uint32_t PeerMask = PeerDigestAcceptMask_;
+	auto Selected = static_cast<RpcDigestType>(PreferredDigest_.load());
+
+	if (!RpcDigestSet::IsAccepted(PeerMask, Selected))
+	{
+		// Strongest one the peer accepts.
+		Selected = RpcDigestType::None;
+		for (uint16_t Type = static_cast<uint16_t>(RpcDigestType::DigestTypeMax); Type-- > 0; )
+		{
+			if (RpcDigestSet::IsAccepted(PeerMask, static_cast<RpcDigestType>(Type)))
+			{
+				Selected = static_cast<RpcDigestType>(Type);
+				break;
+			}
+		}
+
+		if (!RpcDigestSet::IsAccepted(PeerMask, Selected))
+			Trace("!! Peer accepts no known digest type [mask 0x%x]\n", PeerMask);
+	}
+
+	SelectedDigest_ = static_cast<uint16_t>(Selected);
+	StreamWriter_.SetDigestType(Selected);
+}
+
+bool SRPCFrameHandler::Call(uint64_t Id, const uint8_t * Parameters, uint32_t ParametersSize, 
+	RpcPendingCallTable::CompletionRoutine Completion, uint32_t * Rsn)
+{
+	return Call(Id, Parameters, ParametersSize, 0, std::move(Completion), Rsn);
+}
+
+bool SRPCFrameHandler::Call(uint64_t Id, const uint8_t * Parameters, uint32_t ParametersSize, uint32_t DeadlineMs,
+	RpcPendingCallTable::CompletionRoutine Completion, uint32_t * Rsn)
+{
+	return Call(Id, Parameters, ParametersSize, DeadlineMs, RpcIntegerEncoding::Fixed, std::move(Completion), Rsn);
+}
+
+bool SRPCFrameHandler::Call(uint64_t Id, const uint8_t * Parameters, uint32_t ParametersSize, uint32_t DeadlineMs, RpcIntegerEncoding Encoding,
+	RpcPendingCallTable::CompletionRoutine Completion, uint32_t * Rsn)
+{
+	return StartCall(Id, Parameters, ParametersSize, DeadlineMs, Encoding, Completion, Rsn);
+}
+
+bool SRPCFrameHandler::StartCall(uint64_t Id, const uint8_t * Parameters, uint32_t ParametersSize, uint32_t DeadlineMs, RpcIntegerEncoding Encoding,
+	RpcPendingCallTable::CompletionRoutine & Completion, uint32_t * Rsn)
+{
+	if (Encoding == RpcIntegerEncoding::Compact && IntegerEncoding() != RpcIntegerEncoding::Compact)
+	{
+		Trace("!! Compact integers not negotiated with peer [Id 0x%llx]\n", Id);
+		return false;
+	}
+
+	uint16_t Flags = Encoding == RpcIntegerEncoding::Compact ? RpcFrameHeaderLayout::FlagsCompact : 0;
+	bool Referenced = false;
+	auto Message = MakeCallMessage(Id, Parameters, ParametersSize, DeadlineMs, &Flags, &Referenced);
+
+	// Completes with TimedOut on the first Tick() past the deadline, the peer sends nothing then.
+	auto Deadline = DeadlineMs ? 
+		RpcPendingCallTable::Clock::now() + std::chrono::milliseconds(DeadlineMs) : RpcPendingCallTable::Clock::time_point();
+
+	uint32_t CallRsn = 0;
+	if (!PendingCalls_.Insert(std::move(Completion), Deadline, &CallRsn))
+	{
+		Trace("!! Pending call table full [%u calls]\n", PendingCalls_.PendingCount());
+		return false;
+	}
+
+	if (Referenced)
+	{
+		// Peer may have lost the schema, keep the call until its CallReturn to send it again.
+		std::lock_guard<decltype(SchemaRetriesMutex_)> Lock(SchemaRetriesMutex_);
+		SchemaRetries_[CallRsn] = SchemaRetry{ Id, DeadlineMs, ParametersSize, 
+			static_cast<uint16_t>(Flags & RpcFrameHeaderLayout::FlagsCompact), Message, false, false };
+	}
+
+	if (!QueueCall(CallRsn, Message, Flags))
+	{
+		if (Referenced)
+			DropSchemaRetry(CallRsn);
+
+		PendingCalls_.Abandon(CallRsn, RpcCallStatus::Cancelled);
+		return false;
+	}
+
+	if (Rsn)
+		*Rsn = CallRsn;
+
+	StreamWriter_.Pump();
+
+	return true;
+}
+
+bool SRPCFrameHandler::Call(uint64_t Id, std::shared_ptr<RpcMarshalPlan> Plan, void * const * Params, uint32_t DeadlineMs,
+	ReturnCompletion Completion, uint32_t * Rsn)
+{
+	std::vector<uint8_t> Parameters(Plan->WireSize(RpcMarshalDirection::Call));
+	size_t ParametersSize = Plan->Encode(RpcMarshalDirection::Call, Params, Parameters.data(), Parameters.size());
+	if (!ParametersSize && !Parameters.empty())
+	{
+		Trace("!! Parameters of call 0x%llx not encoded\n", Id);
+		return false;
+	}
+
+	// CallReturn chunks of one call arrive in order, collected until EoR and decoded at once.
+	struct ReturnMessage
+	{
+		std::vector<uint8_t> Bytes;
+		bool Overrun;		// More than the plan allows
+	};
+
+	auto Message = std::make_shared<ReturnMessage>();
+	Message->Bytes.reserve(Plan->WireSize(RpcMarshalDirection::Return));
+	Message->Overrun = false;
+
+	auto Decode = [Plan, Params, Message, Completion](RpcCallStatus Status, uint64_t Offset, const uint8_t *Chunk, uint32_t Size, bool EoR)
+	{
+		if (Status != RpcCallStatus::Success)
+		{
+			Completion(Status);
+			return;
+		}
+
+		auto& Bytes = Message->Bytes;
+		if (Offset != Bytes.size() || Size > Plan->WireSize(RpcMarshalDirection::Return) - Bytes.size())
+			Message->Overrun = true;
+		else
+			Bytes.insert(Bytes.end(), Chunk, Chunk + Size);
+
+		if (!EoR)
+			return;
+
+		// Nothing is read only if the plan returns nothing.
+		size_t Read = Plan->Decode(RpcMarshalDirection::Return, Params, Bytes.data(), Bytes.size());
+		if (Message->Overrun || Read != Bytes.size() || (!Read && Plan->WireSize(RpcMarshalDirection::Return)))
+		{
+			Trace("!! CallReturn does not decode by the plan of the call [%u bytes]\n", static_cast<uint32_t>(Bytes.size()));
+			Completion(RpcCallStatus::Malformed);
+			return;
+		}
+
+		Completion(RpcCallStatus::Success);
+	};
+
+	return Call(Id, Parameters.data(), static_cast<uint32_t>(ParametersSize), DeadlineMs, Plan->IntegerEncoding(), std::move(Decode), Rsn);
+}
+
+std::shared_ptr<std::vector<uint8_t>> SRPCFrameHandler::MakeCallMessage(uint64_t Id, const uint8_t * Parameters, uint32_t ParametersSize, 
+	uint32_t DeadlineMs, uint16_t * Flags, bool * Referenced)
+{
+	// Call body: [Deadline], [Schema], Id, Parameters.
+	uint64_t Fingerprint = 0;
+	std::vector<uint8_t> Record;
+	bool HasSchema = Schemas_.GetLocal(Id, &Fingerprint, &Record);
+
+	uint32_t DeadlineSize = DeadlineMs ? sizeof(DeadlineMs) : 0;
+	uint32_t SchemaSize = HasSchema ? SchemaBlockHeaderSize + static_cast<uint32_t>(Record.size()) : 0;
+
+	auto Message = std::make_shared<std::vector<uint8_t>>(DeadlineSize + SchemaSize + sizeof(Id) + ParametersSize);
+	uint8_t *Pointer = Message->data();
+
+	if (DeadlineSize)
+	{
+		memcpy(Pointer, &DeadlineMs, sizeof(DeadlineMs));
+		Pointer += sizeof(DeadlineMs);
+	}
+
+	if (SchemaSize)
+	{
+		// Record is empty once the peer acknowledged the fingerprint.
+		uint32_t RecordSize = static_cast<uint32_t>(Record.size());
+		memcpy(Pointer, &Fingerprint, sizeof(Fingerprint));
+		memcpy(Pointer + sizeof(Fingerprint), &RecordSize, sizeof(RecordSize));
+		if (RecordSize)
+			memcpy(Pointer + SchemaBlockHeaderSize, Record.data(), RecordSize);
+		Pointer += SchemaSize;
+	}
+
+	memcpy(Pointer, &Id, sizeof(Id));
+	if (ParametersSize)
+		memcpy(Pointer + sizeof(Id), Parameters, ParametersSize);
+
+	*Flags |= 
+		(DeadlineSize ? RpcFrameHeaderLayout::FlagsDeadline : 0) |
+		(SchemaSize ? RpcFrameHeaderLayout::FlagsSchema : 0);
+	*Referenced = HasSchema && Record.empty();
+
+	return Message;
+}
+
+bool SRPCFrameHandler::QueueCall(uint32_t Rsn, std::shared_ptr<std::vector<uint8_t>> Message, uint16_t Flags)
+{
+	// Message is owned by the chunk source until the last chunk is framed.
+	uint64_t Offset = 0;
+	return StreamWriter_.Queue(RpcFrameType::Call, Rsn, false, Message->size(), 
+		[Message, Offset](uint8_t *Buffer, uint32_t Size) mutable
+	{
+		uint32_t Count = static_cast<uint32_t>(std::min<uint64_t>(Size, Message->size() - Offset));
+		memcpy(Buffer, Message->data() + Offset, Count);
+		Offset += Count;
+		return Count;
+	}, Flags);
+}
+
+void SRPCFrameHandler::DropSchemaRetry(uint32_t Rsn)
+{
+	std::lock_guard<decltype(SchemaRetriesMutex_)> Lock(SchemaRetriesMutex_);
+	SchemaRetries_.erase(Rsn);
+}
+
+void SRPCFrameHandler::ResendRejectedCalls()
+{
+	{
+		std::lock_guard<decltype(SchemaRetriesMutex_)> Lock(SchemaRetriesMutex_);
+		SchemaRetriesDue_ = false;
+
+		for (auto it = SchemaRetries_.begin(); it != SchemaRetries_.end();)
+		{
+			// Cancelled, expired or abandoned.
+			if (!PendingCalls_.IsPending(it->first))
+			{
+				it = SchemaRetries_.erase(it);
+				continue;
+			}
+
+			auto& Retry = it->second;
+			if (!Retry.Rejected)
+			{
+				++it;
+				continue;
+			}
+
+			uint16_t Flags = Retry.Flags;
+			bool Referenced = false;
+			auto Parameters = Retry.Message->data() + Retry.Message->size() - Retry.ParametersSize;
+			auto Message = MakeCallMessage(Retry.Id, Parameters, Retry.ParametersSize, Retry.DeadlineMs, &Flags, &Referenced);
+
+			// Rsn is taken until the rejected message is streamed to its end, next Tick() tries again.
+			if (!QueueCall(it->first, Message, Flags))
+			{
+				SchemaRetriesDue_ = true;
+				++it;
+				continue;
+			}
+
+			// With the record the peer does not reject it, unless the fingerprint was acknowledged again meanwhile.
+			if (!Referenced)
+			{
+				it = SchemaRetries_.erase(it);
+				continue;
+			}
+
+			Retry.Message = std::move(Message);
+			Retry.Rejected = false;
+			Retry.Resent = true;
+			++it;
+		}
+	}
+
+	StreamWriter_.Pump();
+}
+
+bool SRPCFrameHandler::CallBatch(RpcBatchedCall * Calls, uint32_t Count, uint32_t * Rsns)
+{
+	auto Batch = std::make_shared<RpcCallBatch>(StreamWriter_.ChunkSize());
+	uint32_t BatchFirst = 0;	// Index of the first call in Batch
+
+	// Completion of a call is taken once it is pending, calls left with theirs were not sent.
+	bool Sent = true;
+	uint32_t i = 0;
+
+	for (; i < Count && Sent; i++)
+	{
+		auto& Entry = Calls[i];
+
+		if (!Batch->Fits(sizeof(Entry.Id) + Entry.ParametersSize))
+		{
+			if (Batch->Count())
+			{
+				if (!QueueBatch(Batch, false, 0))
+				{
+					// Calls of the batch were abandoned with Cancelled.
+					if (Rsns)
+						std::fill(Rsns + BatchFirst, Rsns + i, 0);
+
+					Batch->Clear();
+					Sent = false;
+					break;
+				}
+
+				Batch = std::make_shared<RpcCallBatch>(StreamWriter_.ChunkSize());
+			}
+
+			BatchFirst = i + 1;
+
+			if (!Batch->Fits(sizeof(Entry.Id) + Entry.ParametersSize))
+			{
+				// Too large for a batch, stream it as a regular call.
+				Sent = StartCall(Entry.Id, Entry.Parameters, Entry.ParametersSize, 0, RpcIntegerEncoding::Fixed, 
+					Entry.Completion, Rsns ? &Rsns[i] : nullptr);
+				continue;
+			}
+
+			BatchFirst = i;
+		}
+
+		uint32_t CallRsn = 0;
+		if (!PendingCalls_.Insert(std::move(Entry.Completion), &CallRsn))
+		{
+			Trace("!! Pending call table full [%u calls]\n", PendingCalls_.PendingCount());
+			Sent = false;
+			break;
+		}
+
+		Batch->AppendCall(CallRsn, Entry.Id, Entry.Parameters, Entry.ParametersSize);
+
+		if (Rsns)
+			Rsns[i] = CallRsn;
+	}
+
+	if (!QueueBatch(Batch, false, 0))
+	{
+		if (Rsns)
+			std::fill(Rsns + BatchFirst, Rsns + i, 0);
+
+		Sent = false;
+	}
+
+	if (Sent)
+		return true;
+
+	for (i = 0; i < Count; i++)
+	{
+		if (!Calls[i].Completion)
+			continue;
+
+		Calls[i].Completion(RpcCallStatus::Cancelled, 0, nullptr, 0, true);
+		Calls[i].Completion = nullptr;
+
+		if (Rsns)
+			Rsns[i] = 0;
+	}
+
+	return false;
+}
+
+bool SRPCFrameHandler::Cancel(uint32_t Rsn)
+{
+	// Late CallReturn chunks for this Rsn are dropped.
+	if (!PendingCalls_.Abandon(Rsn, RpcCallStatus::Cancelled))
+		return false;
+
+	DropSchemaRetry(Rsn);
+	StreamWriter_.SendControl(RpcFrameType::Cancel, Rsn, false, nullptr, 0);
+
+	return true;
+}
+
+bool SRPCFrameHandler::Reply(uint32_t Rsn, const uint8_t * Message, uint32_t MessageSize)
+{
+	return Reply(Rsn, Message, MessageSize, RpcIntegerEncoding::Fixed);
+}
+
+bool SRPCFrameHandler::Reply(uint32_t Rsn, const uint8_t * Message, uint32_t MessageSize, RpcIntegerEncoding Encoding)
+{
+	return Reply(Rsn, RpcCallArenaRef(), Message, MessageSize, Encoding);
+}
+
+bool SRPCFrameHandler::Reply(uint32_t Rsn, const RpcCallArenaRef & Arena, const uint8_t * Message, uint32_t MessageSize, RpcIntegerEncoding Encoding)
+{
+	if (IsCallCancelled(Rsn))
+		return false; // Caller is not waiting for it.
+
+	// Copied into the batch, the arena is not needed past this.
+	uint16_t Flags = (Encoding == RpcIntegerEncoding::Compact) ? RpcFrameHeaderLayout::FlagsCompact : 0;
+	bool Batchable = static_cast<uint64_t>(RpcCallBatch::CountSize) + RpcCallBatch::EntryHeaderSize + MessageSize <= StreamWriter_.ChunkSize();
+
+	if (Batchable)
+	{
+		std::lock_guard<decltype(ReplyBatchMutex_)> Lock(ReplyBatchMutex_);
+
+		auto& Batch = ReplyBatches_[static_cast<size_t>(Encoding)];
+		bool Idle = !ReplyBatchHolds_ && !CallsQueued_;
+
+		if (!Idle || (Batch && Batch->Count()))
+		{
+			if (Batch && !Batch->Fits(MessageSize))
+				FlushReplyBatch(Encoding);
+
+			if (!Batch)
+				Batch = std::make_shared<RpcCallBatch>(StreamWriter_.ChunkSize());
+
+			Batch->AppendReturn(Rsn, Message, MessageSize);
+
+			if (Idle)
+				FlushReplyBatch(Encoding);
+
+			return true;
+		}
+	}
+
+	// Message must remain valid until the last chunk is sent (see RpcStreamWriter::Queue), 
+	// the chunk source holds the arena until then.
+	uint32_t Offset = 0;
+	auto Source = [Arena, Message, MessageSize, Offset](uint8_t *Buffer, uint32_t Size) mutable
+	{
+		uint32_t Count = std::min<uint32_t>(Size, MessageSize - Offset);
+		memcpy(Buffer, Message + Offset, Count);
+		Offset += Count;
+		return Count;
+	};
+
+	if (!StreamWriter_.Queue(RpcFrameType::CallReturn, Rsn, true, MessageSize, Source, Flags))
+		return false;
+
+	StreamWriter_.Pump();
+
+	return true;
+}
+
+bool SRPCFrameHandler::DispatchCall(ThreadPool & Pool, uint32_t Rsn, CallWork Work)
+{
+	return DispatchCall(Pool, Rsn, std::move(Work), nullptr);
+}
+
+bool SRPCFrameHandler::DispatchCall(ThreadPool & Pool, uint32_t Rsn, ArenaCallWork Work)
+{
+	return DispatchCall(Pool, Rsn, nullptr, std::move(Work));
+}
+
+bool SRPCFrameHandler::DispatchCall(ThreadPool & Pool, uint32_t Rsn, CallWork Work, ArenaCallWork ArenaWork)
+{
+	// Released after the lock if the call is not queued.
+	auto Arena = RpcCallArenaPool::Acquire();
+
+	std::lock_guard<decltype(ActiveCallsMutex_)> Lock(ActiveCallsMutex_);
+
+	if (TakeEarlyCancel(Rsn))
+	{
+		CallsCancelled_++;
+		return false;
+	}
+
+	auto Deadline = RpcCancellationToken::Clock::time_point::max();
+
+	auto DeadlineIterator = CallDeadlines_.find(Rsn);
+	if (DeadlineIterator != CallDeadlines_.end())
+	{
+		Deadline = DeadlineIterator->second;
+		CallDeadlines_.erase(DeadlineIterator);
+	}
+
+	if (FindActiveCall(Rsn))
+		return false; // Rsn already active
+
+	RpcCancellationToken Token(Deadline, *Arena);
+	if (Token.IsExpired())
+	{
+		CallsExpired_++;
+		return false;
+	}
+
+	// Work item removes the task when done, which waits for us to release the lock.
+	// Task is destroyed with the arena, also if the work item is cancelled before it ran.
+	auto Task = Arena->New<CallTask>(CallTask{ this, Rsn, &Pool, 0, Token, std::move(Work), std::move(ArenaWork), Arena, nullptr });
+	InsertActiveCall(Task);
+
+	CallsQueued_++;
+	Pool.Post(&Task->WorkItemNumber, [Task]()
+	{
+		RunCall(Task);
+	});
+
+	return true;
+}
+
+void SRPCFrameHandler::RunCall(CallTask * Task)
+{
+	auto Handler = Task->Handler;
+	auto& Token = Task->Token;
+
+	Handler->CallsQueued_--;
+
+	// Caller gave up while the call was queued.
+	if (Token.IsExpired())
+		Handler->CallsExpired_++;
+	else if (!Token.IsCancelled() && Task->ArenaWork)
+		Task->ArenaWork(Token, Task->Arena);
+	else if (!Token.IsCancelled() && Task->Work)
+		Task->Work(Token);
+
+	// Task goes away with the arena, released after the lock (reply may still hold it).
+	RpcCallArenaRef Arena;
+
+	std::lock_guard<decltype(Handler->ActiveCallsMutex_)> Lock(Handler->ActiveCallsMutex_);
+	Handler->RemoveActiveCall(Task);
+
+	// Work may reply after it returned, the reply must still be suppressed.
+	if (Token.IsCancelled())
+		Handler->AddEarlyCancel(Task->Rsn);
+
+	Arena = std::move(Task->Arena);
+
+	if (Handler->ActiveCallCount_ == 0)
+		Handler->ActiveCallsDone_.notify_all();
+}
+
+uint32_t SRPCFrameHandler::CancelActiveCalls()
+{
+	// Arenas of calls removed from the pool queue, released after the lock.
+	std::vector<RpcCallArenaRef> Arenas;
+
+	std::lock_guard<decltype(ActiveCallsMutex_)> Lock(ActiveCallsMutex_);
+
+	uint32_t Count = 0;
+
+	for (auto& Bucket : ActiveCalls_)
+	{
+		for (auto Task = Bucket; Task;)
+		{
+			auto Next = Task->Next;
+
+			Task->Token.Cancel();
+			Count++;
+
+			if (Task->Pool->Cancel(Task->WorkItemNumber))
+			{
+				CallsQueued_--;
+				RemoveActiveCall(Task);
+				Arenas.push_back(std::move(Task->Arena));
+			}
+
+			Task = Next;
+		}
+	}
+
+	CallsCancelled_ += Count;
+
+	return Count;
+}
+
+uint32_t SRPCFrameHandler::ActiveCallCount()
+{
+	std::lock_guard<decltype(ActiveCallsMutex_)> Lock(ActiveCallsMutex_);
+	return ActiveCallCount_;
+}
+
+SRPCFrameHandler::CallTask * SRPCFrameHandler::FindActiveCall(uint32_t Rsn)
+{
+	for (auto Task = ActiveCalls_[Rsn & (DefaultMaxStreams - 1)]; Task; Task = Task->Next)
+	{
+		if (Task->Rsn == Rsn)
+			return Task;
+	}
+
+	return nullptr;
+}
+
+void SRPCFrameHandler::InsertActiveCall(CallTask * Task)
+{
+	auto& Bucket = ActiveCalls_[Task->Rsn & (DefaultMaxStreams - 1)];
+	Task->Next = Bucket;
+	Bucket = Task;
+
+	ActiveCallCount_++;
+}
+
+void SRPCFrameHandler::RemoveActiveCall(CallTask * Task)
+{
+	for (auto Link = &ActiveCalls_[Task->Rsn & (DefaultMaxStreams - 1)]; *Link; Link = &(*Link)->Next)
+	{
+		if (*Link != Task)
+			continue;
+
+		*Link = Task->Next;
+		ActiveCallCount_--;
+		return;
+	}
+
+	Assert(false);
+}
+
+uint64_t SRPCFrameHandler::CallsCancelled() const
+{
+	return CallsCancelled_;
+}
+
+uint64_t SRPCFrameHandler::CallsExpired() const
+{
+	return CallsExpired_;
+}
+
+uint32_t SRPCFrameHandler::PendingCallCount() const
+{
+	return PendingCalls_.PendingCount();
+}
+
+std::shared_ptr<RpcReceivePin> SRPCFrameHandler::PinChunk(const uint8_t * Chunk)
+{
+	// Connection must stay while pinned, one not owned by the manager is not pinned.
+	auto Connection = Connection_ ? Connection_->Reference() : nullptr;
+
+	uint64_t Position;
+	if (!Connection || !Connection->PinReceived(Chunk, &Position))
+		return nullptr;
+
+	return std::make_shared<RpcReceivePin>(std::move(Connection), Position);
+}
+
+uint32_t SRPCFrameHandler::SendCredit() const
+{
+	return static_cast<uint32_t>(std::max<int64_t>(SendCredit_, 0));
+}
+
+uint64_t SRPCFrameHandler::CreditStalls() const
+{
+	return CreditStalls_;
+}
+
+bool SRPCFrameHandler::ReceiveChunk(const RpcFrameHeader & Header, uint64_t Offset, const uint8_t * Chunk, uint32_t Size, bool EoR)
+{
+	if (Header.Type == static_cast<uint16_t>(RpcFrameType::CallReturn) && Header.u.Bitfields.Response)
+	{
+		// Peer ran the call, it is not sent again.
+		if (!Offset)
+			DropSchemaRetry(Header.Rsn);
+
+		if (!PendingCalls_.Deliver(Header.Rsn, Offset, Chunk, Size, EoR))
+			Trace("!! CallReturn for unknown call dropped [Fsn %llu, Rsn %u]\n", Header.Fsn, Header.Rsn);
+
+		return true;
+	}
+
+	if (Header.Type == static_cast<uint16_t>(RpcFrameType::Call))
+	{
+		if (Header.u.Bitfields.Deadline && !ReceiveDeadline(Header, &Offset, &Chunk, &Size) && !EoR)
+			return true; // Nothing but deadline in this chunk.
+
+		if (Header.u.Bitfields.Schema)
+		{
+			bool Remaining = ReceiveSchema(Header, &Offset, &Chunk, &Size);
+			bool Dropped = SchemaBlocks_[Header.Rsn].Dropped;
+
+			if (EoR)
+				SchemaBlocks_.erase(Header.Rsn);
+
+			if (Dropped || (!Remaining && !EoR))
+				return true; // Call dropped, or nothing but schema in this chunk.
+		}
+	}
+
+	return Handler_ ? Handler_(Header, Offset, Chunk, Size, EoR) : true;
+}
+
+bool SRPCFrameHandler::ReceiveDeadline(const RpcFrameHeader & Header, uint64_t * Offset, const uint8_t ** Chunk, uint32_t * Size)
+{
+	// 
+	// Strips deadline from the start of Call message, Offset is then relative to Id.
+	// Returns false if the chunk holds no more than deadline bytes.
+	// 
+
+	constexpr uint32_t DeadlineSize = sizeof(RpcFrameBody::Call.Deadline);
+
+	if (*Offset >= DeadlineSize)
+	{
+		*Offset -= DeadlineSize;
+		return true;
+	}
+
+	auto& Prefix = DeadlinePrefixes_[Header.Rsn];
+	if (!*Offset)
+		Prefix.Size = 0;
+
+	uint32_t Count = std::min<uint32_t>(*Size, DeadlineSize - static_cast<uint32_t>(*Offset));
+	memcpy(Prefix.Bytes + Prefix.Size, *Chunk, Count);
+	Prefix.Size += Count;
+
+	*Chunk += Count;
+	*Size -= Count;
+	*Offset = 0;
+
+	if (Prefix.Size == DeadlineSize)
+	{
+		uint32_t DeadlineMs = 0;
+		memcpy(&DeadlineMs, Prefix.Bytes, sizeof(DeadlineMs));
+		DeadlinePrefixes_.erase(Header.Rsn);
+
+		auto Now = RpcCancellationToken::Clock::now();
+
+		std::lock_guard<decltype(ActiveCallsMutex_)> Lock(ActiveCallsMutex_);
+
+		// Calls never dispatched leave their deadline behind, drop expired ones.
+		if (CallDeadlines_.size() >= DefaultMaxStreams)
+		{
+			for (auto it = CallDeadlines_.begin(); it != CallDeadlines_.end();)
+				it = (it->second <= Now) ? CallDeadlines_.erase(it) : std::next(it);
+		}
+
+		CallDeadlines_[Header.Rsn] = Now + std::chrono::milliseconds(DeadlineMs);
+	}
+
+	return *Size > 0;
+}
+
+bool SRPCFrameHandler::ReceiveSchema(const RpcFrameHeader & Header, uint64_t * Offset, const uint8_t ** Chunk, uint32_t * Size)
+{
+	// 
+	// Strips schema block from Call message (after deadline), Offset is then relative to Id.
+	// Block is collected across chunks, its size is known once RecordSize is received.
+	// Returns false if the chunk holds no more than schema bytes.
+	// 
+
+	auto& Block = SchemaBlocks_[Header.Rsn];
+	if (!Block.Size)
+		Block.Size = SchemaBlockHeaderSize;
+
+	while (*Size && !Block.Complete)
+	{
+		if (*Offset != Block.Bytes.size())
+		{
+			Trace("!! Schema block out of order [Fsn %llu, Rsn %u]\n", Header.Fsn, Header.Rsn);
+			Block.Complete = Block.Dropped = true;
+			return false;
+		}
+
+		uint32_t Count = std::min<uint32_t>(*Size, Block.Size - static_cast<uint32_t>(Block.Bytes.size()));
+		Block.Bytes.insert(Block.Bytes.end(), *Chunk, *Chunk + Count);
+
+		*Chunk += Count;
+		*Size -= Count;
+		*Offset += Count;
+
+		if (Block.Bytes.size() < Block.Size)
+			break;
+
+		if (Block.Size == SchemaBlockHeaderSize)
+		{
+			uint32_t RecordSize = 0;
+			memcpy(&RecordSize, Block.Bytes.data() + sizeof(RpcFrameBody::Schema.Fingerprint), sizeof(RecordSize));
+
+			if (RecordSize > RpcSchemaCache::MaxRecordSize)
+			{
+				Trace("!! Schema record too large [Fsn %llu, Rsn %u, size %u]\n", Header.Fsn, Header.Rsn, RecordSize);
+				Block.Complete = Block.Dropped = true;
+				return false;
+			}
+
+			Block.Size += RecordSize;
+			if (RecordSize)
+				continue;
+		}
+
+		Block.Complete = true;
+		ProcessSchema(Header.Rsn, Block);
+	}
+
+	if (!Block.Complete)
+		return false;
+
+	*Offset -= Block.Size;
+
+	return *Size > 0;
+}
+
+void SRPCFrameHandler::ProcessSchema(uint32_t Rsn, SchemaBlock & Block)
+{
+	uint64_t Fingerprint = 0;
+	uint32_t RecordSize = Block.Size - SchemaBlockHeaderSize;
+	memcpy(&Fingerprint, Block.Bytes.data(), sizeof(Fingerprint));
+
+	if (RecordSize)
+	{
+		// Acknowledge once, later calls then reference the fingerprint only.
+		bool Added = false;
+		if (!Schemas_.AddPeer(Fingerprint, Block.Bytes.data() + SchemaBlockHeaderSize, RecordSize, &Added))
+			Trace("!! Schema not cached [Rsn %u, fingerprint %016llx]\n", Rsn, Fingerprint);
+		else if (Added)
+			StreamWriter_.SendControl(RpcFrameType::Register, 0, true, reinterpret_cast<const uint8_t *>(&Fingerprint), sizeof(Fingerprint));
+	}
+	else if (!Schemas_.FindPeer(Fingerprint, nullptr))
+	{
+		// Caller believes we know it. Drop the call, caller completes it with SchemaMissing.
+		Trace("!! Unknown schema fingerprint [Rsn %u, fingerprint %016llx]\n", Rsn, Fingerprint);
+
+		Block.Dropped = true;
+		StreamWriter_.SendControl(RpcFrameType::Unregister, Rsn, true, reinterpret_cast<const uint8_t *>(&Fingerprint), sizeof(Fingerprint));
+		return;
+	}
+
+	std::lock_guard<decltype(ActiveCallsMutex_)> Lock(ActiveCallsMutex_);
+
+	// Calls never taken leave their fingerprint behind, drop the oldest.
+	if (CallFingerprints_.size() >= DefaultMaxStreams)
+		CallFingerprints_.pop_front();
+
+	CallFingerprints_.push_back(CallFingerprint{ Rsn, Fingerprint });
+}
+
+bool SRPCFrameHandler::ReceiveSchemaReply(const RpcFrameHeader & Header, const RpcFrameSegment * Body, uint32_t BodyCount)
+{
+	uint8_t Bytes[sizeof(RpcFrameBody::Schema.Fingerprint)] = {};
+	uint32_t Size = 0;
+
+	for (uint32_t i = 0; i < BodyCount && Size < sizeof(Bytes); i++)
+	{
+		uint32_t Count = std::min<uint32_t>(Body[i].Size, sizeof(Bytes) - Size);
+		memcpy(Bytes + Size, Body[i].Pointer, Count);
+		Size += Count;
+	}
+
+	if (Size < sizeof(Bytes))
+	{
+		Trace("!! Malformed schema reply [Fsn %llu, size %u]\n", Header.Fsn, Header.Length);
+		return true;
+	}
+
+	uint64_t Fingerprint = 0;
+	memcpy(&Fingerprint, Bytes, sizeof(Fingerprint));
+
+	if (Header.Type == static_cast<uint16_t>(RpcFrameType::Register))
+	{
+		Schemas_.Acknowledge(Fingerprint);
+		return true;
+	}
+
+	// Peer dropped call Rsn, it and next calls carry the record again.
+	Schemas_.Reject(Fingerprint);
+
+	bool Resend = false;
+	{
+		std::lock_guard<decltype(SchemaRetriesMutex_)> Lock(SchemaRetriesMutex_);
+
+		auto it = SchemaRetries_.find(Header.Rsn);
+		if (it != SchemaRetries_.end())
+		{
+			// Sent again once, give up if the peer still rejects it.
+			Resend = !it->second.Resent;
+			if (Resend)
+				it->second.Rejected = true;
+			else
+				SchemaRetries_.erase(it);
+		}
+	}
+
+	if (Resend)
+		ResendRejectedCalls();
+	else
+		PendingCalls_.Abandon(Header.Rsn, RpcCallStatus::SchemaMissing);
+
+	return true;
+}
+
+bool SRPCFrameHandler::SendFrame(uint8_t * Frame, uint32_t Size)
+{
+	if (!Connection_)
+		return false;
+
+	// Sink calls are serialized by the stream writer, only credit grants race with us.
+	uint16_t Type = 0;
+	uint16_t Flags = 0;
+	memcpy(&Type, Frame + RpcFrameHeaderLayout::Type.Offset, sizeof(Type));
+	memcpy(&Flags, Frame + RpcFrameHeaderLayout::Flags.Offset, sizeof(Flags));
+
+	bool Control = IsControlFrame(Type);
+
+	// Responses and control frames bypass queued calls (see IOCPConnection::ScheduleSend).
+	auto Priority = (Control || (Flags & RpcFrameHeaderLayout::FlagsResponse)) ?
+		IOCP::IOCPSendPriority::Control : IOCP::IOCPSendPriority::Bulk;
+
+	if (!Control && Size > SendCredit_)
+	{
+		// Resumed by Pump() when Credit frame arrives.
+		CreditStalls_++;
+		return false;
+	}
+
+	if (Connection_->Send(Frame, Size, nullptr, Priority) != IOCP::IOCPResultCode::Successful)
+		return false;
+
+	// Receiver grants back every byte, control frames included.
+	SendCredit_ -= Size;
+
+	return true;
+}
+
+bool SRPCFrameHandler::IsControlFrame(uint16_t Type)
+{
+	// Control frames are sent without waiting for flow control credit.
+	// Register/Unregister are only sent as schema replies.
+	return
+		Type == static_cast<uint16_t>(RpcFrameType::Register) ||
+		Type == static_cast<uint16_t>(RpcFrameType::Unregister) ||
+		Type == static_cast<uint16_t>(RpcFrameType::Credit) ||
+		Type == static_cast<uint16_t>(RpcFrameType::Cancel) ||
+		Type == static_cast<uint16_t>(RpcFrameType::Ping) ||
+		Type == static_cast<uint16_t>(RpcFrameType::Settings);
+}
+
+bool SRPCFrameHandler::ReceiveCancel(const RpcFrameHeader & Header)
+{
+	// Arena of a call removed from the pool queue, released after the lock.
+	RpcCallArenaRef Arena;
+
+	std::lock_guard<decltype(ActiveCallsMutex_)> Lock(ActiveCallsMutex_);
+
+	auto Task = FindActiveCall(Header.Rsn);
+	if (!Task)
+	{
+		// Call not dispatched yet (or already done), remember it for a while.
+		AddEarlyCancel(Header.Rsn);
+		return true;
+	}
+
+	Task->Token.Cancel();
+	CallsCancelled_++;
+
+	// Not started yet, remove it from the pool queue.
+	if (Task->Pool->Cancel(Task->WorkItemNumber))
+	{
+		CallsQueued_--;
+		RemoveActiveCall(Task);
+		Arena = std::move(Task->Arena);
+	}
+
+	return true;
+}
+
+bool SRPCFrameHandler::IsCallCancelled(uint32_t Rsn)
+{
+	std::lock_guard<decltype(ActiveCallsMutex_)> Lock(ActiveCallsMutex_);
+
+	auto Task = FindActiveCall(Rsn);
+	if (Task)
+		return Task->Token.IsCancelled();
+
+	// Work already done (reply made after it returned).
+	return TakeEarlyCancel(Rsn);
+}
+
+void SRPCFrameHandler::AddEarlyCancel(uint32_t Rsn)
+{
+	// Called with ActiveCallsMutex_ held.
+	auto Now = RpcCancellationToken::Clock::now();
+	auto Expired = Now - std::chrono::milliseconds(CancelRetentionMs);
+
+	while (!EarlyCancels_.empty() && 
+		(EarlyCancels_.front().Received < Expired || EarlyCancels_.size() >= MaxEarlyCancels))
+	{
+		EarlyCancels_.pop_front();
+	}
+
+	EarlyCancels_.push_back(EarlyCancel{ Rsn, Now });
+}
+
+bool SRPCFrameHandler::TakeEarlyCancel(uint32_t Rsn)
+{
+	// Called with ActiveCallsMutex_ held.
+	auto Expired = RpcCancellationToken::Clock::now() - std::chrono::milliseconds(CancelRetentionMs);
+
+	for (auto it = EarlyCancels_.begin(); it != EarlyCancels_.end(); ++it)
+	{
+		if (it->Rsn != Rsn)
+			continue;
+
+		bool Current = it->Received >= Expired;
+		EarlyCancels_.erase(it);
+
+		return Current;
+	}
+
+	return false;
+}
+
+bool SRPCFrameHandler::Keepalive()
+{
+	uint64_t Timestamp = 0;
+
+	switch (Keepalive_.Poll(RpcKeepalive::Clock::now(), &Timestamp))
+	{
+	case RpcKeepalive::Action::SendPing:
+		StreamWriter_.SendControl(RpcFrameType::Ping, 0, false, reinterpret_cast<const uint8_t *>(&Timestamp), sizeof(Timestamp));
+		break;
+
+	case RpcKeepalive::Action::PeerDead:
+		Trace("!! Peer not responding [%u ms without pong]\n", DefaultPongTimeoutMs);
+		return false;
+
+	default:
+		break;
+	}
+
+	return true;
+}
+
+RpcKeepaliveStats SRPCFrameHandler::KeepaliveStats()
+{
+	return Keepalive_.Stats();
+}
+
+bool SRPCFrameHandler::RegisterSchema(uint64_t Id, const uint8_t * TypeRecord, uint32_t Size)
+{
+	return Schemas_.AddLocal(Id, TypeRecord, Size);
+}
+
+bool SRPCFrameHandler::GetCallFingerprint(uint32_t Rsn, uint64_t * Fingerprint)
+{
+	std::lock_guard<decltype(ActiveCallsMutex_)> Lock(ActiveCallsMutex_);
+
+	// Calls are mostly taken in the order received, oldest first.
+	for (auto it = CallFingerprints_.begin(); it != CallFingerprints_.end(); ++it)
+	{
+		if (it->Rsn != Rsn)
+			continue;
+
+		*Fingerprint = it->Fingerprint;
+		CallFingerprints_.erase(it);
+
+		return true;
+	}
+
+	return false;
+}
+
+bool SRPCFrameHandler::GetPeerSchema(uint64_t Fingerprint, std::vector<uint8_t>* TypeRecord)
+{
+	return Schemas_.FindPeer(Fingerprint, TypeRecord);
+}
+
+void SRPCFrameHandler::SetFeatures(uint32_t Features)
+{
+	LocalFeatures_ = Features;
+
+	if (Connection_)
+		SendSettings();
+}
+
+uint32_t SRPCFrameHandler::PeerFeatures() const
+{
+	return PeerFeatures_;
+}
+
+RpcIntegerEncoding SRPCFrameHandler::IntegerEncoding() const
+{
+	return (LocalFeatures_ & PeerFeatures_ & FeatureCompactIntegers) ? 
+		RpcIntegerEncoding::Compact : RpcIntegerEncoding::Fixed;
+}
+
+void SRPCFrameHandler::SendSettings()
+{
+	RpcFrameBody Body;
+	Body.Settings.Features = LocalFeatures_;
+	Body.Settings.DigestAcceptMask = DigestAcceptMask_;
+
+	StreamWriter_.SendControl(RpcFrameType::Settings, 0, false, reinterpret_cast<const uint8_t *>(&Body.Settings), sizeof(Body.Settings));
+}
+
+bool SRPCFrameHandler::ReceiveSettings(const RpcFrameHeader & Header, const RpcFrameSegment * Body, uint32_t BodyCount)
+{
+	uint8_t Bytes[sizeof(RpcFrameBody::Settings)] = {};
+	uint32_t Size = 0;
+
+	for (uint32_t i = 0; i < BodyCount && Size < sizeof(Bytes); i++)
+	{
+		uint32_t Count = std::min<uint32_t>(Body[i].Size, sizeof(Bytes) - Size);
+		memcpy(Bytes + Size, Body[i].Pointer, Count);
+		Size += Count;
+	}
+
+	if (Size < sizeof(Bytes))
+	{
+		Trace("!! Malformed Settings frame [Fsn %llu, size %u]\n", Header.Fsn, Header.Length);
+		return true;
+	}
+
+	RpcFrameBody Received;
+	memcpy(&Received.Settings, Bytes, sizeof(Received.Settings));
+	PeerFeatures_ = Received.Settings.Features;
+
+	if (PeerDigestAcceptMask_.exchange(Received.Settings.DigestAcceptMask) != Received.Settings.DigestAcceptMask)
+		SelectDigest();
+
+	return true;
+}
+
+bool SRPCFrameHandler::ReceivePing(const RpcFrameHeader & Header, const RpcFrameSegment * Body, uint32_t BodyCount)
+{
+	uint8_t Bytes[sizeof(RpcFrameBody::Ping)] = {};
+	uint32_t Size = 0;
+
+	for (uint32_t i = 0; i < BodyCount && Size < sizeof(Bytes); i++)
+	{
+		uint32_t Count = std::min<uint32_t>(Body[i].Size, sizeof(Bytes) - Size);
+		memcpy(Bytes + Size, Body[i].Pointer, Count);
+		Size += Count;
+	}
+
+	if (Size < sizeof(Bytes))
+	{
+		Trace("!! Malformed Ping frame [Fsn %llu, size %u]\n", Header.Fsn, Header.Length);
+		return true;
+	}
+
+	if (!Header.u.Bitfields.Response)
+	{
+		// Echo the timestamp.
+		StreamWriter_.SendControl(RpcFrameType::Ping, Header.Rsn, true, Bytes, sizeof(Bytes));
+		return true;
+	}
+
+	uint64_t Timestamp = 0;
+	memcpy(&Timestamp, Bytes, sizeof(Timestamp));
+
+	Keepalive_.PongReceived(Timestamp, RpcKeepalive::Clock::now());
+
+	return true;
+}
+
+bool SRPCFrameHandler::ReceiveCredit(const RpcFrameHeader & Header, const RpcFrameSegment * Body, uint32_t BodyCount)
+{
+	uint8_t Bytes[sizeof(RpcFrameBody::Credit)] = {};
+	uint32_t Size = 0;
+
+	for (uint32_t i = 0; i < BodyCount && Size < sizeof(Bytes); i++)
+	{
+		uint32_t Count = std::min<uint32_t>(Body[i].Size, sizeof(Bytes) - Size);
+		memcpy(Bytes + Size, Body[i].Pointer, Count);
+		Size += Count;
+	}
+
+	if (Size < sizeof(Bytes))
+	{
+		Trace("!! Malformed Credit frame [Fsn %llu, size %u]\n", Header.Fsn, Header.Length);
+		return true;
+	}
+
+	uint32_t Increment = 0;
+	memcpy(&Increment, Bytes, sizeof(Increment));
+
+	SendCredit_ += Increment;
+
+	// Continue frames stalled on credit.
+	StreamWriter_.Pump();
+
+	return true;
+}
+
+void SRPCFrameHandler::GrantCredit()
+{
+	// Grant in large increments, one Credit frame per quarter of the window.
+	if (RecvUngranted_ < CreditGrantThreshold)
+		return;
+
+	// Queued ahead of stream frames, sent by the writer as soon as send ring buffer has space.
+	uint32_t Increment = RecvUngranted_.exchange(0);
+
+	if (!StreamWriter_.SendControl(RpcFrameType::Credit, 0, false, reinterpret_cast<const uint8_t *>(&Increment), sizeof(Increment)))
+		RecvUngranted_ += Increment;
+}
+
+bool SRPCFrameHandler::ReceiveBatch(const RpcFrameHeader & Header, const RpcFrameSegment * Body, uint32_t BodyCount)
+{
+	// 
+	// Batch is always a single frame. Body split by ring buffer wrap is joined 
+	// in scratch buffer so that entries can be parsed in place.
+	// 
+
+	const uint8_t *Pointer = BodyCount ? Body[0].Pointer : nullptr;
+	uint32_t Size = BodyCount ? Body[0].Size : 0;
+
+	if (BodyCount > 1)
+	{
+		BatchScratch_.clear();
+		for (uint32_t i = 0; i < BodyCount; i++)
+			BatchScratch_.insert(BatchScratch_.end(), Body[i].Pointer, Body[i].Pointer + Body[i].Size);
+
+		Pointer = BatchScratch_.data();
+		Size = static_cast<uint32_t>(BatchScratch_.size());
+	}
+
+	bool Result = false;
+
+	if (Header.u.Bitfields.Response)
+	{
+		Result = RpcCallBatch::Parse(Pointer, Size, [this, &Header](uint32_t Rsn, const uint8_t *Entry, uint32_t EntrySize)
+		{
+			DropSchemaRetry(Rsn);
+
+			if (!PendingCalls_.Deliver(Rsn, 0, Entry, EntrySize, true))
+				Trace("!! Batched CallReturn for unknown call dropped [Fsn %llu, Rsn %u]\n", Header.Fsn, Rsn);
+
+			return true;
+		});
+	}
+	else
+	{
+		{
+			std::lock_guard<decltype(ReplyBatchMutex_)> Lock(ReplyBatchMutex_);
+			ReplyBatchHolds_++;
+		}
+
+		// Dispatch the batch as a group, each entry as a complete Call.
+		RpcFrameHeader CallHeader = Header;
+		CallHeader.Type = static_cast<uint16_t>(RpcFrameType::Call);
+		CallHeader.Length = 0;
+		CallHeader.u.Bitfields.EoR = 1;
+
+		Result = RpcCallBatch::Parse(Pointer, Size, [this, &CallHeader](uint32_t Rsn, const uint8_t *Entry, uint32_t EntrySize)
+		{
+			CallHeader.Rsn = Rsn;
+			CallHeader.Length = EntrySize;
+
+			if (Handler_ && !Handler_(CallHeader, 0, Entry, EntrySize, true))
+				Trace("!! Batched call handler failed [Fsn %llu, Rsn %u]\n", CallHeader.Fsn, Rsn);
+
+			return true;
+		});
+
+		{
+			std::lock_guard<decltype(ReplyBatchMutex_)> Lock(ReplyBatchMutex_);
+
+			// Replies made inline by the handler, work still queued sends its own.
+			if (!--ReplyBatchHolds_ && !CallsQueued_)
+				FlushReplies();
+		}
+	}
+
+	if (!Result)
+		Trace("!! Malformed CallBatch frame [Fsn %llu, size %u]\n", Header.Fsn, Size);
+
+	// Frame is consumed either way, it is never dispatched twice.
+	return true;
+}
+
+bool SRPCFrameHandler::QueueBatch(std::shared_ptr<RpcCallBatch> Batch, bool Response, uint16_t Flags)
+{
+	if (!Batch->Count())
+		return true;
+
+	// Frame Rsn is that of the first entry, which is unique among queued streams.
+	uint32_t Rsn = 0;
+	memcpy(&Rsn, Batch->Data() + RpcCallBatch::CountSize, sizeof(Rsn));
+
+	uint64_t Offset = 0;
+	bool Queued = StreamWriter_.Queue(RpcFrameType::CallBatch, Rsn, Response, Batch->Size(), 
+		[Batch, Offset](uint8_t *Buffer, uint32_t Size) mutable
+	{
+		uint32_t Count = static_cast<uint32_t>(std::min<uint64_t>(Size, Batch->Size() - Offset));
+		memcpy(Buffer, Batch->Data() + Offset, Count);
+		Offset += Count;
+		return Count;
+	}, Flags);
+
+	if (!Queued)
+	{
+		Trace("!! CallBatch not queued [Rsn %u, %u entries]\n", Rsn, Batch->Count());
+
+		if (!Response)
+		{
+			RpcCallBatch::Parse(Batch->Data(), Batch->Size(), [this](uint32_t Rsn, const uint8_t *Entry, uint32_t EntrySize)
+			{
+				PendingCalls_.Abandon(Rsn, RpcCallStatus::Cancelled);
+				return true;
+			});
+		}
+
+		return false;
+	}
+
+	StreamWriter_.Pump();
+
+	return true;
+}
+
+void SRPCFrameHandler::FlushReplies()
+{
+	std::lock_guard<decltype(ReplyBatchMutex_)> Lock(ReplyBatchMutex_);
+
+	FlushReplyBatch(RpcIntegerEncoding::Fixed);
+	FlushReplyBatch(RpcIntegerEncoding::Compact);
+}
+
+void SRPCFrameHandler::FlushReplyBatch(RpcIntegerEncoding Encoding)
+{
+	// Called with ReplyBatchMutex_ held.
+	auto& Batch = ReplyBatches_[static_cast<size_t>(Encoding)];
+	if (!Batch)
+		return;
+
+	uint16_t Flags = (Encoding == RpcIntegerEncoding::Compact) ? RpcFrameHeaderLayout::FlagsCompact : 0;
+
+	QueueBatch(std::move(Batch), true, Flags);
+	Batch = nullptr;
 }
 
 bool SRPCFrameHandler::SendComplete(const uint8_t * BufferSent, uint32_t Size) noexcept
 {
+	// Send ring buffer space was released, continue frames refused by the sink.
+	StreamWriter_.Pump();
+
 	return true;
 }
 
-bool SRPCFrameHandler::ReceiveComplete(const uint8_t * BufferReceived, uint32_t Size) noexcept
+bool SRPCFrameHandler::ReceiveComplete(const IOCP::IODispatchBuffer * Buffers, uint32_t BuffersCount, uint32_t * SizeConsumed) noexcept
 {
+	RpcFrameSegment Segments[2] = {};
+	Assert(BuffersCount <= std::size(Segments));
+
+	for (uint32_t i = 0; i < BuffersCount; i++)
+	{
+		Segments[i].Pointer = Buffers[i].Pointer;
+		Segments[i].Size = Buffers[i].Size;
+	}
+
+	*SizeConsumed = Parser_.Parse(Segments, BuffersCount);
+
+	// Dropped frames and skipped bytes were charged by the sender too.
+	RecvUngranted_ += *SizeConsumed;
+	GrantCredit();
+
+	// Corrupted data is skipped by parser resynchronization.
+	return true;
+}
+
+bool SRPCFrameHandler::Tick() noexcept
+{
+	// Replies held back for a batch that did not fill.
+	FlushReplies();
+
+	// Calls whose deadline passed, the server drops them without reply.
+	uint32_t Expired = PendingCalls_.ExpireDue(RpcPendingCallTable::Clock::now());
+
+	// Rejected calls still being streamed, and calls kept for a resend that expired.
+	if (Expired || SchemaRetriesDue_)
+		ResendRejectedCalls();
+
+	if (!Keepalive())
+	{
+		// Connection is closed, no CallReturn is coming.
+		PendingCalls_.AbandonAll(RpcCallStatus::Disconnected);
+		return false;
+	}
+
 	return true;
 }
 
@@ -2,22 +2,359 @@
 
 #include "SRPCBase.h"
 #include "IODispatchHandler.h"
+#include "IOCPConnection.h"
+#include "RpcCallArena.h"
+#include "RpcCallBatch.h"
+#include "RpcCancellation.h"
+#include "RpcFrameParser.h"
+#include "RpcKeepalive.h"
+#include "RpcPendingCallTable.h"
+#include "RpcReceivePin.h"
+#include "RpcSchemaCache.h"
+#include "RpcStream.h"
 
 namespace SRPC
 {
 
+struct RpcBatchedCall
+{
+	uint64_t Id;
+	const uint8_t *Parameters;
+	uint32_t ParametersSize;
+	RpcPendingCallTable::CompletionRoutine Completion;
+};
+
 class SRPCFrameHandler : public IOCP::IODispatchHandler
 {
 public:
+	constexpr static const uint32_t DefaultMaxBodySize = 0x10000;
+	constexpr static const uint32_t DefaultMaxStreams = 0x400;
+	constexpr static const uint32_t DefaultPendingCallsShift = 12;	// 4096 calls in flight
+
+	// Bytes of frames each side may send before the first Credit frame.
+	// Must not exceed receive ring buffer size of the peer connection.
+	constexpr static const uint32_t DefaultInitialCredit = 0x80000;
+	constexpr static const uint32_t CreditGrantThreshold = DefaultInitialCredit / 4;
+
+	constexpr static const uint32_t DefaultIdleThresholdMs = 1000;
+	constexpr static const uint32_t DefaultPongTimeoutMs = 3000;
+
 	SRPCFrameHandler();
+	SRPCFrameHandler(RpcStreamReader::ChunkHandler Handler);
 	~SRPCFrameHandler();
 
+	// Connection used to send frames. Must be set before Call() or Reply().
+	void Attach(IOCP::IOCPConnection *Connection);
+
+	// 
+	// Digest types accepted from peer (see RpcFrameParser::SetDigestAcceptMask) are sent to it in 
+	// Settings. Frames to the peer carry the preferred digest type if the peer accepts it, else the 
+	// strongest one it accepts, so digest is off only when both sides agree (None preferred and accepted).
+	// 
+
+	void SetDigestAcceptMask(uint32_t AcceptMask);
+	void SetDigestType(RpcDigestType Preferred);
+	RpcDigestType DigestType() const;
+
+	// 
+	// Calls are multiplexed on the connection: each one gets an Rsn from the pending-call table,
+	// CallReturn chunks are routed to its completion routine in whatever order they arrive.
+	// 
+
+	bool Call(uint64_t Id, const uint8_t *Parameters, uint32_t ParametersSize, 
+		RpcPendingCallTable::CompletionRoutine Completion, uint32_t *Rsn);
+
+	// DeadlineMs is how long the caller waits (0 if no deadline). Work still queued on the 
+	// server when it passes is dropped without execution (see DispatchCall), the call then 
+	// completes with RpcCallStatus::TimedOut on the next Tick().
+	bool Call(uint64_t Id, const uint8_t *Parameters, uint32_t ParametersSize, uint32_t DeadlineMs,
+		RpcPendingCallTable::CompletionRoutine Completion, uint32_t *Rsn);
+	// Parameters encoded with Encoding (see RpcMarshalPlan), Compact only if IntegerEncoding() allows it.
+	// The CallReturn message is encoded the same way.
+	bool Call(uint64_t Id, const uint8_t *Parameters, uint32_t ParametersSize, uint32_t DeadlineMs, RpcIntegerEncoding Encoding,
+		RpcPendingCallTable::CompletionRoutine Completion, uint32_t *Rsn);
+
+	// 
+	// Parameters are encoded from Params by Plan (Call direction, in the encoding of Plan). The CallReturn
+	// is decoded back into Params by the same plan before Completion runs with Success: the return value 
+	// and Out fields are written, the rest of caller storage is left as is. Params and what they point to
+	// must stay valid until Completion runs. A CallReturn that does not decode by the plan completes
+	// with RpcCallStatus::Malformed, caller storage may be partly written then.
+	// 
+
+	using ReturnCompletion = std::function<void(RpcCallStatus Status)>;
+
+	bool Call(uint64_t Id, std::shared_ptr<RpcMarshalPlan> Plan, void * const *Params, uint32_t DeadlineMs,
+		ReturnCompletion Completion, uint32_t *Rsn);
+
+	// Sends calls in as few CallBatch frames as fit in DefaultMaxBodySize. Rsns is optional (Count entries).
+	// Returns false if not every call was sent (pending call table full, stream not queued). Calls not
+	// sent complete with RpcCallStatus::Cancelled before it returns and their Rsns entry is 0, 
+	// the others complete as usual. The completion of every entry is taken.
+	bool CallBatch(RpcBatchedCall *Calls, uint32_t Count, uint32_t *Rsns);
+	// Abandons the call and asks the peer to stop its work (Cancel frame).
+	bool Cancel(uint32_t Rsn);
+
+	// Returns false without sending if the call was cancelled by the peer.
+	bool Reply(uint32_t Rsn, const uint8_t *Message, uint32_t MessageSize);
+	// Encoding must be that of the call (Compact flag of its header).
+	bool Reply(uint32_t Rsn, const uint8_t *Message, uint32_t MessageSize, RpcIntegerEncoding Encoding);
+	// Message is in Arena (see ArenaCallWork), which is kept until the last chunk of the CallReturn is sent.
+	bool Reply(uint32_t Rsn, const RpcCallArenaRef& Arena, const uint8_t *Message, uint32_t MessageSize, RpcIntegerEncoding Encoding);
+
+	// 
+	// Replies are collected per connection, one CallBatch per encoding, whichever thread makes them.
+	// A batch is sent when the next reply does not fit, when no dispatched call is left waiting 
+	// in the pool queue (no other reply is coming soon), and at the latest on the next Tick().
+	// A reply with nothing to batch it with goes in its own CallReturn frame.
+	// 
+
+	void FlushReplies();
+
+	// 
+	// Features (see RpcFeatures) are exchanged by Settings frames when attached, a feature is 
+	// used toward the peer once both sides have it. Received messages are decoded by their flags, 
+	// so nothing is lost while Settings frames cross.
+	// 
+
+	void SetFeatures(uint32_t Features);
+	uint32_t PeerFeatures() const;
+	RpcIntegerEncoding IntegerEncoding() const;
+
+	// 
+	// Server side: runs work of call Rsn on Pool. On Cancel frame, work not yet started is 
+	// removed from the pool queue, running work sees Token cancelled, and its CallReturn is suppressed.
+	// Work whose deadline passed while queued is dropped at dequeue, Token.Deadline() tells the rest.
+	// Token state is in the arena of the call, copies of Token must not outlive the work.
+	// 
+
+	using CallWork = std::function<void(const RpcCancellationToken& Token)>;
+
+	// Work of the call and what it makes live in Arena, taken from the pool of the dispatching thread: 
+	// decoded arguments (see RpcMarshalPlan::AllocateParams) and the reply message (see Reply). 
+	// Arena is released in one step once the work is done and its CallReturn sent.
+	using ArenaCallWork = std::function<void(const RpcCancellationToken& Token, const RpcCallArenaRef& Arena)>;
+
+	bool DispatchCall(ThreadPool& Pool, uint32_t Rsn, CallWork Work);
+	bool DispatchCall(ThreadPool& Pool, uint32_t Rsn, ArenaCallWork Work);
+	uint32_t CancelActiveCalls();
+	uint32_t ActiveCallCount();
+	uint64_t CallsCancelled() const;
+	uint64_t CallsExpired() const;
+
+	uint32_t PendingCallCount() const;
+
+	// 
+	// Zero-copy arguments: chunk handler may pin Chunk and pass RpcArgumentView into it 
+	// (see RpcMarshalPlan::View) to the work of DispatchCall, the frame stays in the receive ring 
+	// buffer until the last copy of the pin is destroyed. Views are contiguous only within a chunk,
+	// i.e. a call that arrives as one chunk (Offset 0 and EoR). Returns nullptr if Chunk is not 
+	// in the receive ring buffer (e.g. CallBatch split by wraparound) or older pins already hold back 
+	// half of it (see IOCPConnection::PinReceived), the arguments must be copied then.
+	// 
+
+	std::shared_ptr<RpcReceivePin> PinChunk(const uint8_t *Chunk);
+
+	// 
+	// Flow control: frames are charged against credit granted by the receiver, 
+	// which returns credit by Credit frames for every byte it consumes, also bytes of dropped 
+	// frames and bytes skipped by resync. Sender stops at zero credit (frames stay queued in 
+	// the stream writer) instead of overrunning the receive ring buffer. Control frames 
+	// (e.g. Credit, Cancel) are charged too but never wait, credit may go below zero for them.
+	// 
+
+	uint32_t SendCredit() const;
+	uint64_t CreditStalls() const;
+
+	// 
+	// Called on every Tick() of the connection. Pings an idle peer. Returns false if the peer 
+	// is dead, Tick() then fails pending calls with Disconnected and the connection is closed.
+	// 
+
+	bool Keepalive();
+	RpcKeepaliveStats KeepaliveStats();
+
+	// 
+	// Schema negotiation: calls to Id carry TypeRecord (see RpcTypeTraits.h, Rpc::Attach) until the peer 
+	// acknowledges its fingerprint, then only the fingerprint. A call whose fingerprint the peer 
+	// does not know is sent again with the record, it completes with RpcCallStatus::SchemaMissing 
+	// only if the peer rejects that too. Batched calls carry no schema.
+	// 
+
+	bool RegisterSchema(uint64_t Id, const uint8_t *TypeRecord, uint32_t Size);
+
+	// Fingerprint received with call Rsn (once, the entry is removed).
+	bool GetCallFingerprint(uint32_t Rsn, uint64_t *Fingerprint);
+	bool GetPeerSchema(uint64_t Fingerprint, std::vector<uint8_t> *TypeRecord);
+
 private:
 	bool SendComplete(const uint8_t *BufferSent, uint32_t Size) noexcept;
-	bool ReceiveComplete(const uint8_t *BufferReceived, uint32_t Size) noexcept;
+	bool ReceiveComplete(const IOCP::IODispatchBuffer *Buffers, uint32_t BuffersCount, uint32_t *SizeConsumed) noexcept;
+	bool Tick() noexcept;
+
+	bool ReceiveChunk(const RpcFrameHeader& Header, uint64_t Offset, const uint8_t *Chunk, uint32_t Size, bool EoR);
+	bool ReceiveDeadline(const RpcFrameHeader& Header, uint64_t *Offset, const uint8_t **Chunk, uint32_t *Size);
+	bool SendFrame(uint8_t *Frame, uint32_t Size);
+
+	std::shared_ptr<std::vector<uint8_t>> MakeCallMessage(uint64_t Id, const uint8_t *Parameters, uint32_t ParametersSize, 
+		uint32_t DeadlineMs, uint16_t *Flags, bool *Referenced);
+	bool QueueCall(uint32_t Rsn, std::shared_ptr<std::vector<uint8_t>> Message, uint16_t Flags);
+	// Call() that leaves Completion with the caller if the call is not made before it is pending.
+	bool StartCall(uint64_t Id, const uint8_t *Parameters, uint32_t ParametersSize, uint32_t DeadlineMs, RpcIntegerEncoding Encoding,
+		RpcPendingCallTable::CompletionRoutine& Completion, uint32_t *Rsn);
+
+	static bool IsControlFrame(uint16_t Type);
+
+	bool ReceiveCancel(const RpcFrameHeader& Header);
+	bool IsCallCancelled(uint32_t Rsn);
+
+	bool ReceivePing(const RpcFrameHeader& Header, const RpcFrameSegment *Body, uint32_t BodyCount);
+	bool ReceiveSettings(const RpcFrameHeader& Header, const RpcFrameSegment *Body, uint32_t BodyCount);
+	void SendSettings();
+	void SelectDigest();
+
+	struct SchemaBlock
+	{
+		std::vector<uint8_t> Bytes;
+		uint32_t Size;		// Whole block, known once RecordSize is received
+		bool Complete;
+		bool Dropped;		// Fingerprint unknown, rest of the call is dropped
+	};
+
+	constexpr static const uint32_t SchemaBlockHeaderSize = 
+		sizeof(RpcFrameBody::Schema.Fingerprint) + sizeof(RpcFrameBody::Schema.RecordSize);
+
+	bool ReceiveSchema(const RpcFrameHeader& Header, uint64_t *Offset, const uint8_t **Chunk, uint32_t *Size);
+	void ProcessSchema(uint32_t Rsn, SchemaBlock& Block);
+	bool ReceiveSchemaReply(const RpcFrameHeader& Header, const RpcFrameSegment *Body, uint32_t BodyCount);
+
+	// Call sent with fingerprint only, kept until its CallReturn (or until abandoned).
+	struct SchemaRetry
+	{
+		uint64_t Id;
+		uint32_t DeadlineMs;
+		uint32_t ParametersSize;
+		uint16_t Flags;				// Compact only, the rest is set by MakeCallMessage
+		std::shared_ptr<std::vector<uint8_t>> Message;	// As sent, parameters at its end
+		bool Rejected;				// Peer dropped it, to be sent again with the record
+		bool Resent;
+	};
+
+	struct CallFingerprint
+	{
+		uint32_t Rsn;
+		uint64_t Fingerprint;
+	};
+
+	void DropSchemaRetry(uint32_t Rsn);
+	void ResendRejectedCalls();
+
+	bool ReceiveCredit(const RpcFrameHeader& Header, const RpcFrameSegment *Body, uint32_t BodyCount);
+	void GrantCredit();
+
+	bool ReceiveBatch(const RpcFrameHeader& Header, const RpcFrameSegment *Body, uint32_t BodyCount);
+	bool QueueBatch(std::shared_ptr<RpcCallBatch> Batch, bool Response, uint16_t Flags);
+	void FlushReplyBatch(RpcIntegerEncoding Encoding);
+
+	IOCP::IOCPConnection *Connection_;
+	RpcStreamReader::ChunkHandler Handler_;		// Frames other than CallReturn
+	RpcPendingCallTable PendingCalls_;
+	RpcStreamWriter StreamWriter_;
+	RpcStreamReader StreamReader_;
+	RpcFrameParser Parser_;
+
+	std::atomic<int64_t> SendCredit_;		// Bytes of frames we may send
+	std::atomic<uint32_t> RecvUngranted_;	// Bytes of frames consumed but not yet granted back
+	std::atomic<uint64_t> CreditStalls_;
+
+	RpcKeepalive Keepalive_;
 
+	std::atomic<uint32_t> LocalFeatures_;
+	std::atomic<uint32_t> PeerFeatures_;	// FeatureNone until Settings frame is received
+
+	std::atomic<uint32_t> DigestAcceptMask_;
+	std::atomic<uint32_t> PeerDigestAcceptMask_;	// All until Settings frame is received
+	std::atomic<uint16_t> PreferredDigest_;
+	std::atomic<uint16_t> SelectedDigest_;
+
+	// 
+	// Queued or running call. Task, its token state and the work live in the arena of the call,
+	// the task holds the arena until it is done or removed from the pool queue, so the queued
+	// function is a single pointer and a call allocates nothing once the pools are warm.
+	// 
+
+	struct CallTask
+	{
+		SRPCFrameHandler *Handler;
+		uint32_t Rsn;
+		ThreadPool *Pool;
+		uint64_t WorkItemNumber;
+		RpcCancellationToken Token;		// Copies must not outlive the work, the state is in Arena
+		CallWork Work;
+		ArenaCallWork ArenaWork;
+		RpcCallArenaRef Arena;			// Moved out by whoever ends the task
+		CallTask *Next;					// In the ActiveCalls_ bucket
+	};
+
+	bool DispatchCall(ThreadPool& Pool, uint32_t Rsn, CallWork Work, ArenaCallWork ArenaWork);
+	static void RunCall(CallTask *Task);
+
+	// Called with ActiveCallsMutex_ held.
+	CallTask *FindActiveCall(uint32_t Rsn);
+	void InsertActiveCall(CallTask *Task);
+	void RemoveActiveCall(CallTask *Task);
+
+	// 
+	// Cancels not matched to an active call: the Cancel overtook its call (control lane), 
+	// or the work is done but its reply may still be made. Matched by DispatchCall() and Reply(),
+	// kept for CancelRetentionMs at most so that a Cancel for a completed call does not hit 
+	// a later call reusing the Rsn.
+	// 
+
+	constexpr static const uint32_t MaxEarlyCancels = 0x100;
+	constexpr static const uint32_t CancelRetentionMs = 5000;
+
+	struct EarlyCancel
+	{
+		uint32_t Rsn;
+		RpcCancellationToken::Clock::time_point Received;
+	};
+
+	void AddEarlyCancel(uint32_t Rsn);
+	bool TakeEarlyCancel(uint32_t Rsn);
+
+	std::mutex ActiveCallsMutex_;
+	std::condition_variable ActiveCallsDone_;		// ActiveCallCount_ became 0
+	std::array<CallTask *, DefaultMaxStreams> ActiveCalls_;	// Queued or running, chained by Rsn % DefaultMaxStreams
+	uint32_t ActiveCallCount_;
+	std::atomic<uint32_t> CallsQueued_;				// Work not started yet
+	std::deque<EarlyCancel> EarlyCancels_;			// Oldest first
+	std::atomic<uint64_t> CallsCancelled_;
+	std::atomic<uint64_t> CallsExpired_;
+
+	struct DeadlinePrefix
+	{
+		uint8_t Bytes[sizeof(RpcFrameBody::Call.Deadline)];
+		uint32_t Size;
+	};
+
+	std::map<uint32_t, DeadlinePrefix> DeadlinePrefixes_;	// Deadline split across chunks (receive path only)
+	std::map<uint32_t, RpcCancellationToken::Clock::time_point> CallDeadlines_;	// Received, not yet dispatched
+
+	RpcSchemaCache Schemas_;
+	std::map<uint32_t, SchemaBlock> SchemaBlocks_;		// Call messages being received (receive path only)
+	std::deque<CallFingerprint> CallFingerprints_;		// Received, not yet taken, oldest first
+
+	std::mutex SchemaRetriesMutex_;
+	std::map<uint32_t, SchemaRetry> SchemaRetries_;		// <Rsn, SchemaRetry> outstanding calls only
+	std::atomic<bool> SchemaRetriesDue_;				// Rejected call not sent again yet
+
+	// Replies not sent yet (see FlushReplies), indexed by RpcIntegerEncoding.
+	std::recursive_mutex ReplyBatchMutex_;
+	std::shared_ptr<RpcCallBatch> ReplyBatches_[2];
+	uint32_t ReplyBatchHolds_;				// Received CallBatch being dispatched, replies wait for its end
+	std::vector<uint8_t> BatchScratch_;		// Batch body split by receive ring buffer wrap
 };
 
 }
 
-
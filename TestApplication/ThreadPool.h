@@ -9,10 +9,13 @@ class ThreadPool
 {
 public:
 	using ThreadInfo = std::tuple<std::thread, uint64_t>;
-	using ThreadWorkItem = std::tuple<std::function<void()>>;
+	using ThreadWorkItem = std::function<void()>;
 
 	ThreadPool(uint32_t ThreadsCount) : 
 		ThreadsCount_(ThreadsCount),
+		WorkItemsFront_(0),
+		WorkItemsCount_(0),
+		WorkItemsPending_(0),
 		NextWorkItemNumber_(0),
 		ThreadsMustStop_(false)
 	{
@@ -29,27 +32,20 @@ public:
 					std::unique_lock<decltype(Mutex_)> Lock(Mutex_);
 
 					ConditionVariable_.wait(Lock, [&]() {
-						return ThreadsMustStop_ || WorkItemMap_.size() > 0;
+						return ThreadsMustStop_ || WorkItemsPending_ > 0;
 					});
 
 					if (ThreadsMustStop_)
 						break;
 
-					Assert(WorkItemMap_.size() > 0);
-
-					auto& it = WorkItemMap_.begin();
-					auto WorkItemNumber = it->first;
-					auto Values = std::move(it->second);
-					WorkItemMap_.erase(it);
+					uint64_t WorkItemNumber = 0;
+					auto Function = PopWorkItem(&WorkItemNumber);
 
 					Lock.unlock();
 
 					Trace("[%5d] Dispatch item %llu\n", GetCurrentThreadId(), WorkItemNumber);
 
-					auto Function = std::get<0>(Values);
-
-					if (Function)
-						Function();
+					Function();
 
 					Trace("[%5d] Item %llu done\n", GetCurrentThreadId(), WorkItemNumber);
 				}
@@ -75,16 +71,21 @@ public:
 				Thread.join();
 		}
 
-		// FIXME: Cancel remaining items
-		// std::lock_guard<decltype(Mutex_)> Lock(Mutex_);
-		// for (auto& it : WorkItemMap_)
-		// {
-		//   ...
-		// }
+		// Cancel remaining items, waiters get std::future_error (broken_promise).
+		std::lock_guard<decltype(Mutex_)> Lock(Mutex_);
+		WorkItems_.clear();
+		WorkItemsCount_ = WorkItemsPending_ = 0;
 	}
 
 	template <class TFunction, class... TArg>
 	auto Queue(TFunction&& Fn, TArg&&... Args)
+	{
+		return QueueCancellable(nullptr, std::forward<TFunction>(Fn), std::forward<TArg>(Args)...);
+	}
+
+	// Same as Queue(), WorkItemNumber receives the number to pass to Cancel().
+	template <class TFunction, class... TArg>
+	auto QueueCancellable(uint64_t *WorkItemNumber, TFunction&& Fn, TArg&&... Args)
 	{
 		using TReturn = std::result_of<TFunction(TArg...)>::type;
 
@@ -94,27 +95,107 @@ public:
 
 		std::lock_guard<decltype(Mutex_)> Lock(Mutex_);
 
-		uint64_t WorkItemNumber = NextWorkItemNumber_;
-
-		auto ResultTuple = WorkItemMap_.try_emplace(WorkItemNumber, [Task]()
+		uint64_t Number = PushWorkItem([Task]()
 		{
 			(*Task)();
 		});
-		Assert(ResultTuple.second);
-		NextWorkItemNumber_++;
+
+		if (WorkItemNumber)
+			*WorkItemNumber = Number;
 
 		ConditionVariable_.notify_one();
 
 		return std::move(Future);
 	}
 
+	// Same as QueueCancellable() for a function returning nothing and with no future:
+	// Fn is queued as is, without task object (it does not allocate if Fn fits in std::function).
+	void Post(uint64_t *WorkItemNumber, std::function<void()> Fn)
+	{
+		std::lock_guard<decltype(Mutex_)> Lock(Mutex_);
+
+		uint64_t Number = PushWorkItem(std::move(Fn));
+
+		if (WorkItemNumber)
+			*WorkItemNumber = Number;
+
+		ConditionVariable_.notify_one();
+	}
+
+	// Removes a work item not yet started. Its future gets std::future_error (broken_promise).
+	bool Cancel(uint64_t WorkItemNumber)
+	{
+		ThreadWorkItem Function;	// Destroyed after the lock is released
+
+		std::lock_guard<decltype(Mutex_)> Lock(Mutex_);
+
+		// Items in the ring are numbered consecutively, the last one is NextWorkItemNumber_ - 1.
+		uint64_t FrontNumber = NextWorkItemNumber_ - WorkItemsCount_;
+		if (WorkItemNumber < FrontNumber || WorkItemNumber >= NextWorkItemNumber_)
+			return false;
+
+		auto& Item = WorkItems_[(WorkItemsFront_ + (WorkItemNumber - FrontNumber)) & (WorkItems_.size() - 1)];
+		if (!Item)
+			return false; // Cancelled before
+
+		Function.swap(Item);
+		WorkItemsPending_--;
+
+		return true;
+	}
+
 
 private:
+	constexpr static const size_t MinWorkItems = 0x10;
+
+	uint64_t PushWorkItem(ThreadWorkItem Fn)
+	{
+		// Called with Mutex_ held.
+		if (WorkItemsCount_ == WorkItems_.size())
+		{
+			// Grown by doubling, a pool that reached its depth does not allocate per item anymore.
+			std::vector<ThreadWorkItem> Items(std::max(WorkItems_.size() * 2, MinWorkItems));
+			for (size_t i = 0; i < WorkItemsCount_; i++)
+				Items[i].swap(WorkItems_[(WorkItemsFront_ + i) & (WorkItems_.size() - 1)]);
+
+			WorkItems_.swap(Items);
+			WorkItemsFront_ = 0;
+		}
+
+		WorkItems_[(WorkItemsFront_ + WorkItemsCount_) & (WorkItems_.size() - 1)] = std::move(Fn);
+		WorkItemsCount_++;
+		WorkItemsPending_++;
+
+		return NextWorkItemNumber_++;
+	}
+
+	ThreadWorkItem PopWorkItem(uint64_t *WorkItemNumber)
+	{
+		// Called with Mutex_ held and WorkItemsPending_ > 0, cancelled items before the first pending one are dropped.
+		ThreadWorkItem Function;
+
+		while (!Function)
+		{
+			*WorkItemNumber = NextWorkItemNumber_ - WorkItemsCount_;
+			Function.swap(WorkItems_[WorkItemsFront_]);
+
+			WorkItemsFront_ = (WorkItemsFront_ + 1) & (WorkItems_.size() - 1);
+			WorkItemsCount_--;
+		}
+
+		WorkItemsPending_--;
+
+		return Function;
+	}
+
 	uint32_t ThreadsCount_;
 
 	std::mutex Mutex_;
 	std::condition_variable ConditionVariable_;
-	std::map<uint64_t, ThreadWorkItem> WorkItemMap_;
+	std::vector<ThreadWorkItem> WorkItems_;		// Ring of queued items in number order, power of 2 size, cancelled ones empty
+	size_t WorkItemsFront_;						// Index of the oldest item
+	size_t WorkItemsCount_;						// Items in the ring, cancelled included
+	size_t WorkItemsPending_;					// Items not cancelled
 	std::map<uint64_t, ThreadInfo> ThreadMap_;
 	uint64_t NextWorkItemNumber_;
 	std::atomic_bool ThreadsMustStop_;
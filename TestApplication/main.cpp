@@ -6,6 +6,10 @@
 #include "SRPCBase.h"
 #include "ThreadPool.h"
 #include "SRPCFrameHandler.h"
+#include "RpcFrameParser.h"
+#include "RpcTypeRecords.h"
+#include "RpcMarshalPlan.h"
+#include "RpcTypeTraits.h"
 
 #include <initializer_list>
 #include <Windows.h>
@@ -184,6 +188,8 @@ void usage(char **argv)
 	IOCP::Trace("usage: %s <opt> <mode> [<ip> <port>]\n", argv[0]);
 	IOCP::Trace("opt: v (verbose), vi (verbose with interval)\n");
 	IOCP::Trace("mode: 0 (server), 1 (client), else (self-test).\n");
+	IOCP::Trace("bench: frame parser benchmark.\n");
+	IOCP::Trace("test: self-test (see self_test()).\n");
 	IOCP::Trace("ip: address of ip.\n");
 	IOCP::Trace("port: port number.\n\n");
 }
@@ -238,9 +244,953 @@ void threadpool_test()
 
 }
 
+void frame_parser_benchmark()
+{
+	// Parse frames fed in ring buffer sized pieces (split across segments and calls).
+
+	const uint32_t BodySize = 0x1000;
+	const uint32_t FrameSize = static_cast<uint32_t>(SRPC::RpcFrame::HeaderSize) + BodySize;
+	const uint32_t FramesCount = 0x4000;
+	const uint32_t Iterations = 16;
+
+	auto Stream = std::make_unique<uint8_t[]>(FrameSize * FramesCount);
+
+	for (uint32_t i = 0; i < FramesCount; i++)
+	{
+		SRPC::RpcFrameHeader Header;
+		SRPC::RpcFrame::InitializeHeader(Header, SRPC::RpcFrameType::Call, i, false, true);
+		Header.Fsn = i;
+		Header.Length = BodySize;
+
+		uint8_t *Frame = Stream.get() + static_cast<size_t>(i) * FrameSize;
+		SRPC::RpcFrame::WriteHeader(Header, Frame, FrameSize);
+		memset(Frame + SRPC::RpcFrame::HeaderSize, i & 0xff, BodySize);
+	}
+
+	uint64_t BodyBytes = 0;
+	SRPC::RpcFrameParser Parser(BodySize, [&](const SRPC::RpcFrameHeader& Header, const SRPC::RpcFrameSegment *Body, uint32_t BodyCount)
+	{
+		for (uint32_t i = 0; i < BodyCount; i++)
+			BodyBytes += Body[i].Size;
+		return true;
+	});
+
+	const uint32_t TotalSize = FrameSize * FramesCount;
+	const uint32_t ChunkSize = 0x10000 - 0x123; // not aligned to frame size
+
+	auto Start = std::chrono::high_resolution_clock::now();
+
+	for (uint32_t n = 0; n < Iterations; n++)
+	{
+		uint32_t Offset = 0;
+		uint32_t Pending = 0; // bytes passed but not consumed yet
+
+		while (Offset < TotalSize)
+		{
+			uint32_t Count = std::min<uint32_t>(ChunkSize, TotalSize - Offset - Pending);
+			uint32_t Half = (Pending + Count) / 2;
+
+			SRPC::RpcFrameSegment Segments[2] = {
+				{ Stream.get() + Offset, Half },
+				{ Stream.get() + Offset + Half, Pending + Count - Half },
+			};
+
+			uint32_t Consumed = Parser.Parse(Segments, 2);
+			Offset += Consumed;
+			Pending = Pending + Count - Consumed;
+		}
+	}
+
+	auto Elapsed = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - Start).count();
+	double Bytes = static_cast<double>(TotalSize) * Iterations;
+
+	IOCP::Trace("frame parser: %llu frames, %llu body bytes, %.3f GB/s\n",
+		Parser.FramesParsed(), BodyBytes, Bytes / Elapsed / 1e9);
+}
+
+
+// 
+// Checks run by "test" argument. A failed check prints a "!! " line, each test returns false then.
+// 
+
+// Counts heap allocations of the whole process, see call_arena_test().
+std::atomic<uint64_t> AllocationCount(0);
+
+void *operator new(size_t Size)
+{
+	AllocationCount++;
+
+	if (void *Pointer = malloc(Size ? Size : 1))
+		return Pointer;
+
+	throw std::bad_alloc();
+}
+
+void operator delete(void *Pointer) noexcept
+{
+	free(Pointer);
+}
+
+void operator delete(void *Pointer, size_t Size) noexcept
+{
+	free(Pointer);
+}
+
+bool check(bool Condition, const char *What)
+{
+	if (!Condition)
+		IOCP::Trace("!! check failed: %s\n", What);
+
+	return Condition;
+}
+
+void append_frame(std::vector<uint8_t>& Stream, uint32_t Rsn, uint32_t BodySize, SRPC::RpcDigestType DigestType, bool Corrupt)
+{
+	SRPC::RpcFrameHeader Header;
+	SRPC::RpcFrame::InitializeHeader(Header, SRPC::RpcFrameType::Call, Rsn, false, true);
+	Header.Fsn = Rsn;
+	Header.Length = BodySize;
+	Header.u.Bitfields.Digest = static_cast<uint16_t>(DigestType);
+
+	std::vector<uint8_t> Body(BodySize);
+	for (uint32_t i = 0; i < BodySize; i++)
+		Body[i] = static_cast<uint8_t>(Rsn + i);
+
+	SRPC::RpcDigestSet Digests;
+	auto Digest = Digests.Select(DigestType);
+	if (Digest)
+	{
+		Digest->Reset();
+		SRPC::RpcFrame::UpdateDigestHeader(Digest, Header);
+		Digest->Update(Body.data(), Body.size());
+		SRPC::RpcFrame::SetDigest(Header, Digest->Finalize());
+	}
+
+	if (Corrupt)
+		Body[BodySize / 2] ^= 0x40;
+
+	size_t Offset = Stream.size();
+	Stream.resize(Offset + SRPC::RpcFrame::HeaderSize + BodySize);
+	SRPC::RpcFrame::WriteHeader(Header, Stream.data() + Offset, SRPC::RpcFrame::HeaderSize);
+	memcpy(Stream.data() + Offset + SRPC::RpcFrame::HeaderSize, Body.data(), BodySize);
+}
+
+bool frame_parser_test()
+{
+	// Garbage between frames is skipped, corrupted and refused frames are dropped,
+	// and every byte is consumed (it is granted back as credit).
+
+	const uint32_t GarbageSize = 13;
+
+	std::vector<uint8_t> Stream;
+	append_frame(Stream, 1, 0x20, SRPC::RpcDigestType::None, false);
+	Stream.insert(Stream.end(), GarbageSize, 0xee);
+	append_frame(Stream, 2, 0x30, SRPC::RpcDigestType::Crc32c, false);
+	append_frame(Stream, 3, 0x30, SRPC::RpcDigestType::Crc32c, true);
+	append_frame(Stream, 4, 0x10, SRPC::RpcDigestType::None, false);
+	append_frame(Stream, 5, 0x100, SRPC::RpcDigestType::Hash128, false);
+
+	std::vector<uint32_t> Handled;
+	SRPC::RpcFrameParser Parser(0x1000, [&](const SRPC::RpcFrameHeader& Header, const SRPC::RpcFrameSegment *Body, uint32_t BodyCount)
+	{
+		Handled.push_back(Header.Rsn);
+
+		uint32_t Size = 0;
+		for (uint32_t i = 0; i < BodyCount; i++)
+		{
+			for (uint32_t j = 0; j < Body[i].Size; j++)
+			{
+				if (Body[i].Pointer[j] != static_cast<uint8_t>(Header.Rsn + Size + j))
+					return false;
+			}
+			Size += Body[i].Size;
+		}
+
+		// Frame 4 is refused.
+		return Header.Rsn != 4 && Size == Header.Length;
+	});
+
+	// Last frame body is split between segments (ring buffer wraparound).
+	uint32_t Total = static_cast<uint32_t>(Stream.size());
+	uint32_t Split = Total - 0x80;
+
+	SRPC::RpcFrameSegment Segments[2] = {
+		{ Stream.data(), Split },
+		{ Stream.data() + Split, Total - Split },
+	};
+
+	uint32_t Consumed = Parser.Parse(Segments, 2);
+
+	bool Result = true;
+	Result &= check(Consumed == Total, "parser consumes every byte");
+	Result &= check(Handled == std::vector<uint32_t>({ 1, 2, 4, 5 }), "frames handled in order, corrupted one dropped");
+	Result &= check(Parser.FramesParsed() == 3, "frames parsed");
+	Result &= check(Parser.FramesDropped() == 1, "frame refused by handler dropped");
+	Result &= check(Parser.DigestErrors() == 1, "digest mismatch counted");
+	Result &= check(Parser.ResyncCount() == 1, "resynchronized once");
+	Result &= check(Parser.BytesSkipped() == GarbageSize, "garbage skipped");
+
+	// Same stream fed a few bytes at a time, unconsumed bytes passed again.
+	SRPC::RpcFrameParser Dribble(0x1000, [](const SRPC::RpcFrameHeader& Header, const SRPC::RpcFrameSegment *Body, uint32_t BodyCount)
+	{
+		return true;
+	});
+
+	uint32_t Offset = 0;
+	uint32_t Pending = 0;
+
+	while (Offset < Total)
+	{
+		uint32_t Count = std::min<uint32_t>(7, Total - Offset - Pending);
+		SRPC::RpcFrameSegment Segment = { Stream.data() + Offset, Pending + Count };
+
+		uint32_t Parsed = Dribble.Parse(&Segment, 1);
+		Offset += Parsed;
+		Pending = Pending + Count - Parsed;
+
+		if (!Count && !Parsed)
+			break;
+	}
+
+	Result &= check(Offset == Total, "dribbled stream fully consumed");
+	Result &= check(Dribble.FramesParsed() + Dribble.DigestErrors() >= 3, "dribbled frames parsed or dropped");
+	Result &= check(Dribble.DigestErrors() >= 1, "dribbled corrupted frame dropped");
+
+	return Result;
+}
+
+bool digest_test()
+{
+	// Known answers: CRC32C check value, MurmurHash3_x64_128 (seed 0) of a published string.
+	// CRC of the selected routine (CRC instructions on most hosts) matches the table driven one,
+	// for every length around the 8-byte step and every split into two Update() calls.
+
+	const char Check[] = "123456789";
+	const char Fox[] = "The quick brown fox jumps over the lazy dog";
+
+	SRPC::RpcDigestCrc32c Crc;
+	Crc.Update(reinterpret_cast<const uint8_t *>(Check), sizeof(Check) - 1);
+	bool Result = check(Crc.Finalize().Value[0] == 0xe3069283, "crc32c check value");
+	Result &= check(SRPC::RpcDigestCrc32c::ComputeSoftware(0, reinterpret_cast<const uint8_t *>(Check), sizeof(Check) - 1) == 0xe3069283, 
+		"software crc32c check value");
+
+	SRPC::RpcDigestHash128 Hash;
+	Hash.Update(reinterpret_cast<const uint8_t *>(Fox), sizeof(Fox) - 1);
+	auto Value = Hash.Finalize();
+	Result &= check(Value.Value[0] == 0xbc071b6c && Value.Value[1] == 0xe34bbc7b && 
+		Value.Value[2] == 0xc49a9347 && Value.Value[3] == 0x7a433ca9, "hash128 known value");
+
+	Hash.Reset();
+	Value = Hash.Finalize();
+	Result &= check(!Value.Value[0] && !Value.Value[1] && !Value.Value[2] && !Value.Value[3], "hash128 of nothing");
+
+	// Odd offset, so that no length starts aligned.
+	uint8_t Buffer[1 + 40];
+	for (size_t i = 0; i < sizeof(Buffer); i++)
+		Buffer[i] = static_cast<uint8_t>(i * 0x9d + 7);
+
+	bool Matched = true;
+	for (size_t Size = 0; Size <= 17; Size++)
+	{
+		uint32_t Expected = SRPC::RpcDigestCrc32c::ComputeSoftware(0, Buffer + 1, Size);
+
+		SRPC::RpcDigestHash128 Whole;
+		Whole.Update(Buffer + 1, Size);
+		auto WholeValue = Whole.Finalize();
+
+		for (size_t Split = 0; Split <= Size; Split++)
+		{
+			Crc.Reset();
+			Crc.Update(Buffer + 1, Split);
+			Crc.Update(Buffer + 1 + Split, Size - Split);
+			Matched &= Crc.Finalize().Value[0] == Expected;
+			Matched &= SRPC::RpcDigestCrc32c::ComputeSoftware(
+				SRPC::RpcDigestCrc32c::ComputeSoftware(0, Buffer + 1, Split), Buffer + 1 + Split, Size - Split) == Expected;
+
+			Hash.Reset();
+			Hash.Update(Buffer + 1, Split);
+			Hash.Update(Buffer + 1 + Split, Size - Split);
+			Matched &= !memcmp(Hash.Finalize().Value, WholeValue.Value, sizeof(WholeValue.Value));
+		}
+	}
+
+	Result &= check(Matched, "digests of split updates match");
+
+	return Result;
+}
+
+bool pending_calls_test()
+{
+	// Rsn of a reused slot is stale, generation 0 is never handed out, only calls with 
+	// a deadline expire, a full table refuses calls without touching them.
+
+	using SRPC::RpcCallStatus;
+	using SRPC::RpcPendingCallTable;
+
+	RpcPendingCallTable Table(2);
+
+	std::vector<RpcCallStatus> Statuses;
+	auto Completion = [&Statuses](RpcCallStatus Status, uint64_t Offset, const uint8_t *Chunk, uint32_t Size, bool EoR)
+	{
+		if (EoR)
+			Statuses.push_back(Status);
+	};
+
+	uint32_t First = 0;
+	bool Result = check(Table.Insert(Completion, &First) && (First >> 2), "call inserted, generation not 0");
+	Result &= check(Table.Deliver(First, 0, nullptr, 0, true), "call delivered");
+
+	// Each insert takes the next slot, the 4th one reuses the slot of First.
+	uint32_t Rsns[4] = {};
+	bool Inserted = true;
+	for (auto& Rsn : Rsns)
+		Inserted &= Table.Insert(Completion, &Rsn);
+
+	Result &= check(Inserted && Table.PendingCount() == 4, "table filled");
+	Result &= check(Rsns[3] != First && (Rsns[3] & 3) == (First & 3) && Rsns[3] == Table.NextRsn(First), "slot reused by next generation");
+	Result &= check(!Table.Deliver(First, 0, nullptr, 0, true) && !Table.Abandon(First, RpcCallStatus::Cancelled) &&
+		!Table.IsPending(First) && Table.IsPending(Rsns[3]), "stale rsn rejected");
+
+	bool Called = false;
+	uint32_t Rejected = 0xffffffff;
+	Result &= check(!Table.Insert([&Called](RpcCallStatus, uint64_t, const uint8_t *, uint32_t, bool) { Called = true; }, &Rejected) &&
+		!Called && Rejected == 0xffffffff && Table.PendingCount() == 4, "full table refuses call");
+
+	Result &= check(Table.Abandon(Rsns[3], RpcCallStatus::Cancelled) && !Table.Abandon(Rsns[3], RpcCallStatus::Cancelled), 
+		"call abandoned once");
+
+	// Generation wraps from the last one to 1.
+	Result &= check(Table.NextRsn((~0u << 2) | 1) == ((1u << 2) | 1) && Table.NextRsn(1) == ((1u << 2) | 1), "generation 0 skipped");
+
+	// Only the call with a deadline expires, and only once it passed.
+	auto Now = RpcPendingCallTable::Clock::now();
+	uint32_t Timed = 0;
+	Result &= check(Table.Insert(Completion, Now + std::chrono::seconds(1), &Timed), "call with deadline inserted");
+
+	Statuses.clear();
+	Result &= check(Table.ExpireDue(Now) == 0, "deadline not passed");
+	Result &= check(Table.ExpireDue(Now + std::chrono::seconds(2)) == 1 && !Table.IsPending(Timed) &&
+		Statuses.size() == 1 && Statuses[0] == RpcCallStatus::TimedOut, "call with deadline expired");
+	Result &= check(Table.IsPending(Rsns[0]) && Table.IsPending(Rsns[1]) && Table.IsPending(Rsns[2]), "calls without deadline kept");
+	Result &= check(Table.ExpireDue(Now + std::chrono::hours(1)) == 0, "nothing left to expire");
+
+	Statuses.clear();
+	Result &= check(Table.AbandonAll(RpcCallStatus::Disconnected) == 3 && Statuses.size() == 3 && !Table.PendingCount(), "calls abandoned");
+
+	return Result;
+}
+
+bool call_batch_test()
+{
+	// Parse dispatches nothing of a malformed batch. CallBatch completes every call it did not send
+	// with Cancelled and leaves its Rsn 0, the rest stays pending.
+
+	using SRPC::RpcCallBatch;
+	using SRPC::RpcCallStatus;
+
+	const uint8_t Parameters[] = { 1, 2, 3 };
+	RpcCallBatch Batch(0x100);
+	Batch.AppendCall(5, 0x10, Parameters, sizeof(Parameters));
+	Batch.AppendCall(6, 0x11, nullptr, 0);
+
+	std::vector<uint8_t> Body(Batch.Data(), Batch.Data() + Batch.Size());
+	uint32_t Entries = 0;
+	auto Count = [&Entries](uint32_t Rsn, const uint8_t *Entry, uint32_t Size)
+	{
+		Entries++;
+		return true;
+	};
+
+	bool Result = check(RpcCallBatch::Parse(Body.data(), static_cast<uint32_t>(Body.size()), Count) && Entries == 2, "batch parsed");
+
+	bool Truncated = true;
+	Entries = 0;
+	for (uint32_t Size = 0; Size < Body.size(); Size++)
+		Truncated &= !RpcCallBatch::Parse(Body.data(), Size, Count);
+	Result &= check(Truncated && !Entries, "truncated batch rejected");
+
+	// Count of 1 with 2 entries, count of 3 with 2 entries, trailing bytes.
+	std::vector<uint8_t> Mismatch(Body);
+	Mismatch[0] = 1;
+	Result &= check(!RpcCallBatch::Parse(Mismatch.data(), static_cast<uint32_t>(Mismatch.size()), Count) && !Entries, "count below entries rejected");
+	Mismatch[0] = 3;
+	Result &= check(!RpcCallBatch::Parse(Mismatch.data(), static_cast<uint32_t>(Mismatch.size()), Count) && !Entries, "count above entries rejected");
+	Mismatch = Body;
+	Mismatch.push_back(0);
+	Result &= check(!RpcCallBatch::Parse(Mismatch.data(), static_cast<uint32_t>(Mismatch.size()), Count) && !Entries, "trailing bytes rejected");
+
+	const uint8_t Empty[RpcCallBatch::CountSize] = {};
+	Result &= check(!RpcCallBatch::Parse(Empty, sizeof(Empty), Count) && !Entries, "batch without entries rejected");
+
+	// More calls than the pending call table holds. Handler is not attached, sent calls stay pending
+	// until it is destroyed.
+	uint32_t Cancelled = 0;
+	uint32_t Disconnected = 0;
+	{
+		SRPC::SRPCFrameHandler Handler;
+
+		const uint32_t Capacity = 1u << SRPC::SRPCFrameHandler::DefaultPendingCallsShift;
+		std::vector<SRPC::RpcBatchedCall> Calls(Capacity + 0x10);
+		std::vector<uint32_t> Rsns(Calls.size(), ~0u);
+
+		for (auto& Call : Calls)
+		{
+			Call = SRPC::RpcBatchedCall{ 0x10, Parameters, sizeof(Parameters), 
+				[&Cancelled, &Disconnected](RpcCallStatus Status, uint64_t Offset, const uint8_t *Chunk, uint32_t Size, bool EoR)
+			{
+				Cancelled += Status == RpcCallStatus::Cancelled;
+				Disconnected += Status == RpcCallStatus::Disconnected;
+			} };
+		}
+
+		Result &= check(!Handler.CallBatch(Calls.data(), static_cast<uint32_t>(Calls.size()), Rsns.data()), "batch over table capacity fails");
+		Result &= check(Cancelled == 0x10 && Handler.PendingCallCount() == Capacity, "calls not sent cancelled");
+		Result &= check(std::count(Rsns.begin(), Rsns.end(), 0u) == 0x10 && std::count(Rsns.begin(), Rsns.end(), ~0u) == 0 &&
+			!Rsns[Capacity] && Rsns[Capacity - 1], "rsns of calls not sent are 0");
+	}
+
+	Result &= check(Disconnected == 1u << SRPC::SRPCFrameHandler::DefaultPendingCallsShift, "sent calls complete once");
+
+	return Result;
+}
+
+bool varint_test()
+{
+	// Edge values round trip at their expected size, zigzag keeps small negatives short,
+	// truncated and over-long input is rejected.
+
+	const std::pair<uint64_t, size_t> Unsigned[] = {
+		{ 0, 1 }, { 0x7f, 1 }, { 0x80, 2 }, { 0x3fff, 2 }, { 0x4000, 3 },
+		{ 0xffffffffull, 5 }, { 0x7fffffffffffffffull, 9 }, { 0x8000000000000000ull, 10 }, { ~0ull, 10 },
+	};
+
+	const std::pair<int64_t, size_t> Signed[] = {
+		{ 0, 1 }, { -1, 1 }, { 1, 1 }, { -64, 1 }, { 64, 2 }, { -65, 2 },
+		{ INT32_MIN, 5 }, { INT32_MAX, 5 }, { INT64_MIN, 10 }, { INT64_MAX, 10 },
+	};
+
+	bool Result = true;
+	uint8_t Buffer[SRPC::ByteStream::MaxVarintSize + 1];
+
+	for (auto& it : Unsigned)
+	{
+		SRPC::ByteStream Writer(Buffer, sizeof(Buffer));
+		uint64_t Value = 0;
+
+		Result &= check(Writer.WriteVarint(it.first) == it.second && SRPC::ByteStream::VarintSize(it.first) == it.second, "varint size");
+
+		SRPC::ByteStream Reader(Buffer, it.second);
+		Result &= check(Reader.ReadVarint(&Value) == it.second && Value == it.first, "varint round trip");
+
+		// One byte short.
+		SRPC::ByteStream Truncated(Buffer, it.second - 1);
+		Result &= check(!Truncated.ReadVarint(&Value), "truncated varint rejected");
+	}
+
+	for (auto& it : Signed)
+	{
+		SRPC::ByteStream Writer(Buffer, sizeof(Buffer));
+		int64_t Value = 0;
+
+		Result &= check(Writer.WriteVarint(it.first) == it.second, "zigzag varint size");
+		Result &= check(SRPC::ByteStream::ZigZagDecode(SRPC::ByteStream::ZigZagEncode(it.first)) == it.first, "zigzag round trip");
+
+		SRPC::ByteStream Reader(Buffer, it.second);
+		Result &= check(Reader.ReadVarint(&Value) == it.second && Value == it.first, "zigzag varint round trip");
+	}
+
+	// More than 64 bits: 10th byte above 1, or an 11th byte.
+	uint8_t Overflow[] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x02 };
+	uint8_t OverLong[] = { 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x00 };
+	uint64_t Value = 0;
+
+	SRPC::ByteStream OverflowStream(Overflow, sizeof(Overflow));
+	SRPC::ByteStream OverLongStream(OverLong, sizeof(OverLong));
+	Result &= check(!OverflowStream.ReadVarint(&Value), "varint above 64 bits rejected");
+	Result &= check(!OverLongStream.ReadVarint(&Value), "varint longer than 10 bytes rejected");
+
+	return Result;
+}
+
+size_t serialize_records(SRPC::RpcTypeRecords& Records, std::vector<uint8_t>& Record)
+{
+	Record.resize(0x400);
+	Record.resize(Records.Serialize(Record.data(), Record.size()));
+	return Record.size();
+}
+
+bool type_records_test()
+{
+	// Deserialize accepts what Serialize wrote and nothing outside RpcTypeRecordLimits:
+	// truncated, circular, over deep, over long or over large records are rejected.
+
+	using SRPC::RpcTypeId;
+	using SRPC::RpcTypeRecords;
+	using SRPC::RpcTypeRecordLimits;
+
+	const uint16_t ParamList = static_cast<uint16_t>(RpcTypeId::PARAM_LIST);
+
+	// void f(Outer[16]), Outer { Inner, int32 }, Inner { Leaf, uint16[100] }, Leaf { int64 }
+	RpcTypeRecords Records;
+	uint16_t Leaf = Records.AddUDT(0, 3, "Leaf");
+	Records.AddField(Leaf, RpcTypeId::INT_64);
+	uint16_t Inner = Records.AddUDT(0, 3, "Inner");
+	Records.AddField(Inner, Leaf);
+	Records.SetArrayAttribute(Inner, Records.AddField(Inner, RpcTypeId::INT_16U), 100);
+	uint16_t Outer = Records.AddUDT(0, 3, "Outer");
+	Records.AddField(Outer, Inner);
+	Records.AddField(Outer, RpcTypeId::INT_32);
+	Records.AddUDT(ParamList, 3, nullptr);
+	Records.AddField(ParamList, RpcTypeId::Undefined);
+	Records.SetArrayAttribute(ParamList, Records.AddField(ParamList, Outer), 16);
+
+	std::vector<uint8_t> Record;
+	bool Result = check(serialize_records(Records, Record) > 0, "records serialized");
+
+	auto Parsed = RpcTypeRecords::Deserialize(Record.data(), Record.size());
+	std::vector<uint8_t> Again;
+	Result &= check(Parsed && serialize_records(*Parsed, Again) && Again == Record, "records round trip");
+
+	// Outer is 3 deep, 16 * 216 bytes native.
+	RpcTypeRecordLimits Limits;
+	Result &= check(!!RpcTypeRecords::Deserialize(Record.data(), Record.size(), Limits), "within default limits");
+
+	Limits = RpcTypeRecordLimits{};
+	Limits.MaxTypes = 3;
+	Result &= check(!RpcTypeRecords::Deserialize(Record.data(), Record.size(), Limits), "too many types rejected");
+
+	Limits = RpcTypeRecordLimits{};
+	Limits.MaxFields = 5;
+	Result &= check(!RpcTypeRecords::Deserialize(Record.data(), Record.size(), Limits), "too many fields rejected");
+
+	Limits = RpcTypeRecordLimits{};
+	Limits.MaxDepth = 2;
+	Result &= check(!RpcTypeRecords::Deserialize(Record.data(), Record.size(), Limits), "too deep rejected");
+	Limits.MaxDepth = 3;
+	Result &= check(!!RpcTypeRecords::Deserialize(Record.data(), Record.size(), Limits), "depth at limit accepted");
+
+	Limits = RpcTypeRecordLimits{};
+	Limits.MaxArrayCount = 99;
+	Result &= check(!RpcTypeRecords::Deserialize(Record.data(), Record.size(), Limits), "too long array rejected");
+
+	Limits = RpcTypeRecordLimits{};
+	Limits.MaxNativeSize = 16 * 216 - 1;
+	Result &= check(!RpcTypeRecords::Deserialize(Record.data(), Record.size(), Limits), "too large parameters rejected");
+	Limits.MaxNativeSize = 16 * 216;
+	Result &= check(!!RpcTypeRecords::Deserialize(Record.data(), Record.size(), Limits), "native size at limit accepted");
+
+	// Every prefix lacks a type it references or ends within a record.
+	bool Truncated = true;
+	for (size_t Size = 0; Size < Record.size(); Size++)
+		Truncated &= !RpcTypeRecords::Deserialize(Record.data(), Size);
+	Result &= check(Truncated, "truncated records rejected");
+
+	// Same type twice.
+	std::vector<uint8_t> Duplicate(Record);
+	Duplicate.insert(Duplicate.end(), Record.begin(), Record.end());
+	Result &= check(!RpcTypeRecords::Deserialize(Duplicate.data(), Duplicate.size()), "duplicate type rejected");
+
+	// Unknown attribute bit on PARAM_LIST.
+	std::vector<uint8_t> Attributes(Record);
+	Attributes[2] |= 0x40;
+	Result &= check(!RpcTypeRecords::Deserialize(Attributes.data(), Attributes.size()), "unknown attribute rejected");
+
+	// void f(A), A { B }, B { A }
+	RpcTypeRecords Circular;
+	uint16_t A = Circular.AddUDT(0, 3, "A");
+	uint16_t B = Circular.AddUDT(0, 3, "B");
+	Circular.AddField(A, B);
+	Circular.AddField(B, A);
+	Circular.AddUDT(ParamList, 3, nullptr);
+	Circular.AddField(ParamList, RpcTypeId::Undefined);
+	Circular.AddField(ParamList, A);
+
+	Result &= check(serialize_records(Circular, Record) && !RpcTypeRecords::Deserialize(Record.data(), Record.size()), 
+		"circular types rejected");
+
+	return Result;
+}
+
+// Described once for type_traits_test(), Sum is Out.
+#pragma pack(push, 8)
+struct TraitsSample
+{
+	int32_t Code;
+	std::array<uint16_t, 2> Flags;
+	int64_t Sum;
+};
+#pragma pack(pop)
+
+namespace SRPC
+{
+template <> struct RpcTypeOf<TraitsSample> : RpcStructTypeOf<TraitsSample, 0x81, 3, int32_t, std::array<uint16_t, 2>, int64_t&> {};
+}
+
+void traits_sample_call(TraitsSample& Sample, uint32_t Count)
+{
+}
+
+bool type_traits_test()
+{
+	// Records generated from signatures are byte for byte what Serialize() writes for the same 
+	// description, and the template Register() compiles a plan from them.
+
+	using SRPC::RpcTypeId;
+	using SRPC::RpcTypeRecords;
+
+	const uint16_t ParamList = static_cast<uint16_t>(RpcTypeId::PARAM_LIST);
+
+	// int32 f(int64, uint16[8])
+	RpcTypeRecords Records;
+	Records.AddUDT(ParamList, 0, nullptr);
+	Records.AddField(ParamList, RpcTypeId::INT_32);
+	Records.AddField(ParamList, RpcTypeId::INT_64);
+	Records.SetArrayAttribute(ParamList, Records.AddField(ParamList, RpcTypeId::INT_16U), 8);
+
+	std::vector<uint8_t> Record;
+	serialize_records(Records, Record);
+
+	using Function = SRPC::RpcFunctionTypeRecord<int32_t(int64_t, std::array<uint16_t, 8>)>;
+	bool Result = check(std::vector<uint8_t>(Function::Data(), Function::Data() + Function::Size) == Record, 
+		"function record matches");
+
+	// void f(TraitsSample& Out, uint32)
+	RpcTypeRecords Sample;
+	uint16_t Struct = Sample.AddUDT(0x81, 3, "TraitsSample");
+	Sample.AddField(Struct, RpcTypeId::INT_32);
+	Sample.SetArrayAttribute(Struct, Sample.AddField(Struct, RpcTypeId::INT_16U), 2);
+	Sample.SetOutAttribute(Struct, Sample.AddField(Struct, RpcTypeId::INT_64));
+	Sample.AddUDT(ParamList, 0, nullptr);
+	Sample.AddField(ParamList, RpcTypeId::Undefined);
+	Sample.SetOutAttribute(ParamList, Sample.AddField(ParamList, Struct));
+	Sample.AddField(ParamList, RpcTypeId::INT_32U);
+
+	serialize_records(Sample, Record);
+
+	using SampleFunction = SRPC::RpcFunctionTypeRecord<decltype(&traits_sample_call)>;
+	Result &= check(Struct == 0x81 && 
+		std::vector<uint8_t>(SampleFunction::Data(), SampleFunction::Data() + SampleFunction::Size) == Record, 
+		"structure record matches");
+
+	SRPC::Rpc Server(1);
+	Result &= check(Server.Register(&traits_sample_call, 0x40) == 0x40, "registered by signature");
+
+	auto Plan = Server.GetMarshalPlan(0x40);
+	Result &= check(Plan && Plan->ParamsCount() == 2, "plan compiled from generated record");
+
+	return Result;
+}
+
+bool marshal_test(SRPC::RpcIntegerEncoding Encoding)
+{
+	// int32 f(int32 In, Entry[3] Entries, uint64& Total), Entry { int32 Code; uint16 Flags; int64& Sum }.
+	// Call carries every parameter, CallReturn the return value, Total and Sum of each entry. 
+	// Decoding it writes only those into caller storage.
+
+	using SRPC::RpcTypeId;
+	using SRPC::RpcMarshalDirection;
+
+	struct Entry
+	{
+		int32_t Code;
+		uint16_t Flags;
+		int64_t Sum;
+	};
+
+	SRPC::RpcTypeRecords Records;
+	const uint16_t ParamList = static_cast<uint16_t>(RpcTypeId::PARAM_LIST);
+	uint16_t EntryType = Records.AddUDT(0, 3, "Entry");
+	Records.AddField(EntryType, RpcTypeId::INT_32);
+	Records.AddField(EntryType, RpcTypeId::INT_16U);
+	Records.SetOutAttribute(EntryType, Records.AddField(EntryType, RpcTypeId::INT_64));
+	Records.AddUDT(ParamList, 3, nullptr);
+	Records.AddField(ParamList, RpcTypeId::INT_32);
+	Records.AddField(ParamList, RpcTypeId::INT_32);
+	Records.SetArrayAttribute(ParamList, Records.AddField(ParamList, EntryType), 3);
+	Records.SetOutAttribute(ParamList, Records.AddField(ParamList, RpcTypeId::INT_64U));
+
+	SRPC::RpcMarshalPlan Plan;
+	bool Result = check(Plan.Compile(Records, Encoding), "marshal plan compiled");
+
+	int32_t Return = 0;
+	int32_t In = -5;
+	Entry Entries[3] = { { 1, 10, 0 }, { -2, 20, 0 }, { 300000, 30, 0 } };
+	uint64_t Total = 0;
+	void *Params[] = { &Return, &In, Entries, &Total };
+
+	std::vector<uint8_t> Message(Plan.WireSize(RpcMarshalDirection::Call));
+	size_t Size = Plan.Encode(RpcMarshalDirection::Call, Params, Message.data(), Message.size());
+	Result &= check(Size > 0, "call encoded");
+
+	// Callee decodes into arena storage, sets the return value and Out fields, and overwrites In-only ones.
+	auto Arena = SRPC::RpcCallArenaPool::Acquire();
+	auto Args = Plan.AllocateParams(RpcMarshalDirection::Call, *Arena);
+	Result &= check(Plan.Decode(RpcMarshalDirection::Call, Args, Message.data(), Size) == Size, "call decoded");
+
+	auto ArgEntries = static_cast<Entry *>(Args[2]);
+	Result &= check(*static_cast<int32_t *>(Args[1]) == -5 && ArgEntries[1].Code == -2 && ArgEntries[2].Code == 300000 &&
+		ArgEntries[2].Flags == 30, "arguments received");
+
+	int32_t ArgReturn = 42;
+	Args[0] = &ArgReturn;
+	*static_cast<int32_t *>(Args[1]) = 0;
+	*static_cast<uint64_t *>(Args[3]) = 0x123456789ull;
+	for (int i = 0; i < 3; i++)
+		ArgEntries[i] = Entry{ 0, 0, -1000 * (i + 1) };
+
+	Message.assign(Plan.WireSize(RpcMarshalDirection::Return), 0);
+	Size = Plan.Encode(RpcMarshalDirection::Return, Args, Message.data(), Message.size());
+	Result &= check(Size > 0, "return encoded");
+
+	// Fixed: int32 return value, 3 x int64 Sum, uint64 Total. Compact: 1 + 3 x 2 + 5 bytes.
+	Result &= check(Size == (Encoding == SRPC::RpcIntegerEncoding::Fixed ? 36 : 12), "return carries only Out fields");
+
+	Result &= check(Plan.Decode(RpcMarshalDirection::Return, Params, Message.data(), Size) == Size, "return decoded");
+	Result &= check(Return == 42 && Total == 0x123456789ull && 
+		Entries[0].Sum == -1000 && Entries[1].Sum == -2000 && Entries[2].Sum == -3000, "Out fields written back");
+	Result &= check(In == -5 && Entries[0].Code == 1 && Entries[1].Code == -2 && Entries[2].Code == 300000 && 
+		Entries[0].Flags == 10 && Entries[2].Flags == 30, "In-only fields kept");
+
+	return Result;
+}
+
+bool compact_wire_test()
+{
+	// void f(Point[2]), Point { int32 X; int32 Y; } has no padding. It is one copy in Fixed encoding,
+	// Compact still sends each integer as a zigzag varint.
+
+	using SRPC::RpcTypeId;
+	using SRPC::RpcMarshalDirection;
+
+	SRPC::RpcTypeRecords Records;
+	const uint16_t ParamList = static_cast<uint16_t>(RpcTypeId::PARAM_LIST);
+	uint16_t PointType = Records.AddUDT(0, 2, "Point");
+	Records.AddField(PointType, RpcTypeId::INT_32);
+	Records.AddField(PointType, RpcTypeId::INT_32);
+	Records.AddUDT(ParamList, 2, nullptr);
+	Records.AddField(ParamList, RpcTypeId::Undefined);
+	Records.SetArrayAttribute(ParamList, Records.AddField(ParamList, PointType), 2);
+
+	bool Result = check(Records.IsWireIdentical(PointType), "point is wire-identical");
+
+	SRPC::RpcMarshalPlan Fixed;
+	SRPC::RpcMarshalPlan Compact;
+	Result &= check(Fixed.Compile(Records) && Compact.Compile(Records, SRPC::RpcIntegerEncoding::Compact), "point plans compiled");
+
+	int32_t Points[] = { 1, -1, 63, -64 };
+	void *Params[] = { nullptr, Points };
+
+	std::vector<uint8_t> Wire(Fixed.WireSize(RpcMarshalDirection::Call));
+	Result &= check(Fixed.Encode(RpcMarshalDirection::Call, Params, Wire.data(), Wire.size()) == sizeof(Points) &&
+		!memcmp(Wire.data(), Points, sizeof(Points)), "fixed wire is the native bytes");
+
+	const uint8_t Expected[] = { 0x02, 0x01, 0x7e, 0x7f };
+	Wire.assign(Compact.WireSize(RpcMarshalDirection::Call), 0);
+	Result &= check(Compact.Encode(RpcMarshalDirection::Call, Params, Wire.data(), Wire.size()) == sizeof(Expected) &&
+		!memcmp(Wire.data(), Expected, sizeof(Expected)), "compact wire is zigzag varints");
+
+	int32_t Decoded[4] = {};
+	Params[1] = Decoded;
+	Result &= check(Compact.Decode(RpcMarshalDirection::Call, Params, Expected, sizeof(Expected)) == sizeof(Expected) &&
+		!memcmp(Decoded, Points, sizeof(Points)), "compact wire decoded");
+
+	return Result;
+}
+
+bool call_arena_test()
+{
+	// Once the pools are warm, a call allocates nothing: arena, decoded arguments and reply buffer
+	// come from the arena pool, the task and its token state from the arena, the work item from 
+	// the thread pool ring and the active call entry is the task itself.
+
+	using namespace std::chrono_literals;
+	using SRPC::RpcTypeId;
+	using SRPC::RpcMarshalDirection;
+
+	// int32 f(int64, uint16[8])
+	SRPC::RpcTypeRecords Records;
+	const uint16_t ParamList = static_cast<uint16_t>(RpcTypeId::PARAM_LIST);
+	Records.AddUDT(ParamList, 3, nullptr);
+	Records.AddField(ParamList, RpcTypeId::INT_32);
+	Records.AddField(ParamList, RpcTypeId::INT_64);
+	Records.SetArrayAttribute(ParamList, Records.AddField(ParamList, RpcTypeId::INT_16U), 8);
+
+	SRPC::RpcMarshalPlan Plan;
+	bool Result = check(Plan.Compile(Records), "plan compiled");
+
+	auto Decode = [&Plan]()
+	{
+		auto Arena = SRPC::RpcCallArenaPool::Acquire();
+		auto Params = Plan.AllocateParams(RpcMarshalDirection::Call, *Arena);
+		auto Reply = Arena->Allocate(Plan.WireSize(RpcMarshalDirection::Return), 8);
+
+		return Params && Reply;
+	};
+
+	Result &= check(Decode(), "arguments allocated");
+
+	uint64_t Before = AllocationCount;
+
+	bool Allocated = true;
+	for (int i = 0; i < 100; i++)
+		Allocated &= Decode();
+
+	Result &= check(Allocated, "arguments allocated again");
+	Result &= check(AllocationCount == Before, "arena reuse does not allocate");
+
+	SRPC::ThreadPool Pool(1);
+	SRPC::SRPCFrameHandler Handler;
+	std::atomic<uint32_t> Done(0);
+
+	auto Dispatch = [&](uint32_t Rsn)
+	{
+		bool Dispatched = Handler.DispatchCall(Pool, Rsn, [&Done](const SRPC::RpcCancellationToken& Token)
+		{
+			Done++;
+		});
+
+		while (Handler.ActiveCallCount())
+			std::this_thread::sleep_for(1ms);
+
+		return Dispatched;
+	};
+
+	Result &= check(Dispatch(1), "call dispatched");
+
+	Before = AllocationCount;
+
+	bool Dispatched = true;
+	for (uint32_t Rsn = 2; Rsn < 100; Rsn++)
+		Dispatched &= Dispatch(Rsn);
+
+	Result &= check(Dispatched && Done == 99, "calls dispatched and run");
+	Result &= check(AllocationCount == Before, "dispatched call does not allocate");
+
+	return Result;
+}
+
+bool send_order_test()
+{
+	// A file body goes out right behind the bulk message queued before it (its header), even if 
+	// the bulk quantum is used up and control data is queued meanwhile. No completion port here,
+	// so nothing issued ever leaves flight.
+
+	using IOCP::IOCPSendPriority;
+	using IOCP::IOCPResultCode;
+
+	WSADATA WSAData;
+	WSAStartup(MAKEWORD(2, 2), &WSAData);
+
+	const unsigned short Port = 9019;
+
+	IOCP::TCPListener Listener;
+	bool Result = check(Listener.BeginListen(Port), "listening");
+
+	SOCKET Sender = Connect("127.0.0.1", Port);
+	SOCKET Receiver = Result ? Listener.WaitAccept() : INVALID_SOCKET;
+	Result &= check(Sender != INVALID_SOCKET && Receiver != INVALID_SOCKET, "connected");
+
+	char TempPath[MAX_PATH];
+	char FilePath[MAX_PATH];
+	HANDLE File = INVALID_HANDLE_VALUE;
+	DWORD Written = 0;
+
+	if (GetTempPathA(MAX_PATH, TempPath) && GetTempFileNameA(TempPath, "srp", 0, FilePath))
+	{
+		File = CreateFileA(FilePath, GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+			FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, nullptr);
+	}
+
+	Result &= check(File != INVALID_HANDLE_VALUE && WriteFile(File, "body", 4, &Written, nullptr) && Written == 4, "file written");
+
+	if (!Result)
+	{
+		closesocket(Sender);
+		closesocket(Receiver);
+		if (File != INVALID_HANDLE_VALUE)
+			CloseHandle(File);
+
+		return false;
+	}
+
+	IOCP::IOCPConnection Connection(Sender, nullptr, 0x80000, 0x1000, 0x100);
+
+	std::vector<uint8_t> Filler(IOCP::IOCPConnection::SendBulkQuantum - 3, 'f');
+	uint8_t Header[] = { 'h', 'd', 'r' };
+	uint8_t Control[3][2] = { { 'c', '1' }, { 'c', '2' }, { 'c', '3' } };
+
+	// c1 occupies the send buffer list, so bulk sends are only queued until c2 schedules them.
+	// Filler and header then use up the quantum exactly and the file body is due next.
+	Result &= check(Connection.Send(Control[0], 2, nullptr, IOCPSendPriority::Control) == IOCPResultCode::Successful, "c1 sent");
+	Result &= check(Connection.Send(Filler.data(), static_cast<uint32_t>(Filler.size()), nullptr, IOCPSendPriority::Bulk) == IOCPResultCode::Successful, "filler queued");
+	Result &= check(Connection.Send(Header, sizeof(Header), nullptr, IOCPSendPriority::Bulk) == IOCPResultCode::Successful, "header queued");
+	Result &= check(Connection.Send(Control[1], 2, nullptr, IOCPSendPriority::Control) == IOCPResultCode::Successful, "c2 sent");
+	Result &= check(Connection.SendFile(File, 0, 4) == IOCPResultCode::Successful, "file queued");
+	Result &= check(Connection.Send(Control[2], 2, nullptr, IOCPSendPriority::Control) == IOCPResultCode::Successful, "c3 sent");
+
+	std::vector<uint8_t> Expected = { 'c', '1', 'c', '2' };
+	Expected.insert(Expected.end(), Filler.begin(), Filler.end());
+	for (auto Byte : { 'h', 'd', 'r', 'b', 'o', 'd', 'y', 'c', '3' })
+		Expected.push_back(static_cast<uint8_t>(Byte));
+
+	std::vector<uint8_t> Received(Expected.size());
+
+	// A body left behind would stall the stream, give up after a second then.
+	DWORD TimeoutMs = 1000;
+	setsockopt(Receiver, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char *>(&TimeoutMs), sizeof(TimeoutMs));
+
+	size_t ReceivedSize = 0;
+	while (ReceivedSize < Received.size())
+	{
+		int Size = recv(Receiver, reinterpret_cast<char *>(&Received[ReceivedSize]), static_cast<int>(Received.size() - ReceivedSize), 0);
+		if (Size <= 0)
+			break;
+
+		ReceivedSize += Size;
+	}
+
+	Result &= check(ReceivedSize == Expected.size() && Received == Expected, "file body follows its header, control data after it");
+
+	closesocket(Sender);
+	closesocket(Receiver);
+	CloseHandle(File);
+
+	return Result;
+}
+
+bool self_test()
+{
+	bool Result = true;
+
+	Result &= frame_parser_test();
+	Result &= digest_test();
+	Result &= pending_calls_test();
+	Result &= call_batch_test();
+	Result &= varint_test();
+	Result &= type_records_test();
+	Result &= type_traits_test();
+	Result &= marshal_test(SRPC::RpcIntegerEncoding::Fixed);
+	Result &= marshal_test(SRPC::RpcIntegerEncoding::Compact);
+	Result &= compact_wire_test();
+	Result &= call_arena_test();
+	Result &= send_order_test();
+
+	IOCP::Trace("self-test %s\n", Result ? "passed" : "FAILED");
+	return Result;
+}
+
 
 int main(int argc, char **argv)
 {
+	if (argc >= 2 && !strcmp(argv[1], "bench"))
+	{
+		frame_parser_benchmark();
+		return 0;
+	}
+
+	if (argc >= 2 && !strcmp(argv[1], "test"))
+		return self_test() ? 0 : 1;
+
 	threadpool_test();
 
 	printf("end\n");